@@ -0,0 +1,370 @@
+//
+// Copyright 2023, Jefferson Science Associates, LLC.
+// Subject to the terms in the LICENSE file found in the top-level directory.
+//
+// EPSCI Group
+// Thomas Jefferson National Accelerator Facility
+// 12000, Jefferson Ave, Newport News, VA 23606
+// (757)-269-7100
+
+
+#ifndef EVIO_6_0_COMPRESSIONADVISOR_H
+#define EVIO_6_0_COMPRESSIONADVISOR_H
+
+
+#include <cstdint>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+
+#include "Compressor.h"
+#include "EvioException.h"
+
+
+namespace evio {
+
+
+    class RecordSupply;
+
+
+    /**
+     * Class used to choose, record by record, how a stream written by a WriterMT is compressed.
+     * One object is shared by all the RecordCompressor threads of a writer.<p>
+     *
+     * For each compression type it keeps a running average of the compression ratio
+     * (compressed / uncompressed bytes) and of the time taken per byte, and it measures how
+     * busy the compressor threads are. For each record it then picks:
+     * <ul>
+     * <li>{@link Compressor#UNCOMPRESSED} if LZ4 saves less than a given fraction of the data
+     *     (e.g. raw FADC data), so no CPU is spent on it;</li>
+     * <li>{@link Compressor#LZ4_BEST} if it saves noticeably more than LZ4 and the compressor
+     *     threads have enough idle time left to afford it;</li>
+     * <li>{@link Compressor#LZ4} otherwise.</li>
+     * </ul>
+     * Every so often a record is compressed with a type that is not currently chosen, so
+     * the averages follow changes in the data. The type used is set in each record's header
+     * as usual, so readers need nothing special.<p>
+     *
+     * An advisor is attached to a writer's {@link RecordSupply} with {@link #attach} rather
+     * than stored in each RecordCompressor, so that class keeps the layout compiled into
+     * libeviocc. RecordCompressor looks it up with {@link #find} for each record.
+     * Since RecordCompressor runs inside libeviocc, this only happens when libeviocc, and
+     * all code using it, is compiled with EVIO_COMPRESSION_ADVISOR defined (like USE_GZIP).
+     * Otherwise RecordCompressor keeps the library's code and WriterMT refuses an advisor.
+     *
+     * @version 6.0
+     * @since 6.0 10/18/2026
+     * @author timmer
+     * @see RecordCompressor
+     */
+    class CompressionAdvisor {
+
+    private:
+
+        /** Running averages for one compression type. */
+        struct TypeStats {
+            /** Has any record been compressed with this type? */
+            bool   sampled = false;
+            /** Average compressed / uncompressed size. */
+            double ratio = 1.;
+            /** Average nanoseconds per uncompressed byte. */
+            double nanosPerByte = 0.;
+            /** Number of records compressed with this type. */
+            uint64_t records = 0;
+            /** Uncompressed bytes of those records. */
+            uint64_t bytesIn = 0;
+            /** Compressed bytes of those records. */
+            uint64_t bytesOut = 0;
+        };
+
+        /** Stats of UNCOMPRESSED, LZ4 and LZ4_BEST. */
+        TypeStats stats[3];
+
+        /** Most compression allowed (LZ4 or LZ4_BEST). */
+        Compressor::CompressionType maxType;
+
+        /** Smallest fraction of data LZ4 must save to be used. */
+        double minGain;
+
+        /** Smallest fraction of data LZ4_BEST must save beyond LZ4 to be used. */
+        double minBestGain;
+
+        /** Smallest fraction of idle compressor time needed to use LZ4_BEST. */
+        double minHeadroom;
+
+        /** One out of this many records is used to sample another type. */
+        uint32_t sampleInterval;
+
+        /** Weight of newest record in running averages. */
+        double weight = 0.125;
+
+        /** Number of compressor threads. */
+        uint32_t threads = 1;
+
+        /** Fraction of compressor time idle, measured over last period. */
+        double headroom = 1.;
+
+        /** Start of current period measuring busy time. */
+        std::chrono::steady_clock::time_point periodStart;
+
+        /** Busy nanoseconds of all compressor threads in current period. */
+        uint64_t busyNanos = 0;
+
+        /** Length of period measuring busy time in nanoseconds. */
+        static const uint64_t PERIOD_NANOS = 200000000ULL;
+
+        /** Number of records handed out. */
+        std::atomic<uint64_t> counter {0};
+
+        /** Protects everything but counter. Used once per record, so cost is negligible. */
+        mutable std::mutex mtx;
+
+
+    public:
+
+        /**
+         * Constructor.
+         * @param maxType        most compression allowed, LZ4 or LZ4_BEST.
+         * @param minGain        smallest fraction of data LZ4 must save to compress at all.
+         * @param minBestGain    smallest fraction of data LZ4_BEST must save beyond LZ4 to be used.
+         * @param minHeadroom    smallest fraction of idle compressor time needed to use LZ4_BEST.
+         * @param sampleInterval one out of this many records samples another type.
+         * @throws EvioException if maxType is not LZ4 or LZ4_BEST.
+         */
+        explicit CompressionAdvisor(Compressor::CompressionType maxType = Compressor::LZ4_BEST,
+                                    double minGain = 0.10, double minBestGain = 0.05,
+                                    double minHeadroom = 0.5, uint32_t sampleInterval = 32) :
+                maxType(maxType), minGain(minGain), minBestGain(minBestGain),
+                minHeadroom(minHeadroom), sampleInterval(std::max(2U, sampleInterval)),
+                periodStart(std::chrono::steady_clock::now()) {
+
+            if (maxType != Compressor::LZ4 && maxType != Compressor::LZ4_BEST) {
+                throw EvioException("adaptive compression only chooses among LZ4 types");
+            }
+        }
+
+
+        /**
+         * Set the number of compressor threads sharing this object.
+         * @param count number of threads.
+         */
+        void setThreads(uint32_t count) {
+            std::lock_guard<std::mutex> lock(mtx);
+            threads = std::max(1U, count);
+        }
+
+
+        /**
+         * Choose the compression type of the next record.
+         * @return compression type.
+         */
+        Compressor::CompressionType choose() {
+            uint64_t n = counter.fetch_add(1);
+
+            std::lock_guard<std::mutex> lock(mtx);
+            Compressor::CompressionType best = bestType();
+
+            // Get a first measurement of each type, then refresh the ones not in use now and then
+            if (!stats[Compressor::LZ4].sampled) return Compressor::LZ4;
+            if (maxType == Compressor::LZ4_BEST && !stats[Compressor::LZ4_BEST].sampled) {
+                return Compressor::LZ4_BEST;
+            }
+            if (n % sampleInterval == 0) {
+                if (best == Compressor::UNCOMPRESSED) return Compressor::LZ4;
+                if (best == Compressor::LZ4 && maxType == Compressor::LZ4_BEST) return Compressor::LZ4_BEST;
+                return Compressor::LZ4;
+            }
+            return best;
+        }
+
+
+        /**
+         * Record the result of building a record.
+         * @param type     compression type used.
+         * @param bytesIn  uncompressed size of record data in bytes.
+         * @param bytesOut compressed size of record data in bytes.
+         * @param nanos    time taken to build record.
+         */
+        void update(Compressor::CompressionType type, uint32_t bytesIn, uint32_t bytesOut, uint64_t nanos) {
+            if (type > Compressor::LZ4_BEST) return;
+
+            std::lock_guard<std::mutex> lock(mtx);
+            TypeStats & s = stats[type];
+            s.records++;
+            s.bytesIn  += bytesIn;
+            s.bytesOut += bytesOut;
+
+            if (bytesIn > 0) {
+                double ratio = (double)bytesOut / bytesIn;
+                double perByte = (double)nanos / bytesIn;
+                if (s.sampled) {
+                    s.ratio += weight * (ratio - s.ratio);
+                    s.nanosPerByte += weight * (perByte - s.nanosPerByte);
+                }
+                else {
+                    s.ratio = ratio;
+                    s.nanosPerByte = perByte;
+                    s.sampled = true;
+                }
+            }
+
+            // Fraction of compressor time idle over the last period
+            busyNanos += nanos;
+            auto now = std::chrono::steady_clock::now();
+            uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - periodStart).count();
+            if (elapsed >= PERIOD_NANOS) {
+                headroom = std::max(0., 1. - (double)busyNanos / ((double)elapsed * threads));
+                busyNanos = 0;
+                periodStart = now;
+            }
+        }
+
+
+        /** @return fraction of compressor time idle over the last period. */
+        double getHeadroom() const {
+            std::lock_guard<std::mutex> lock(mtx);
+            return headroom;
+        }
+
+
+        /**
+         * Get the average compression ratio (compressed / uncompressed) of a type.
+         * @param type compression type.
+         * @return average ratio, 1 if never used.
+         */
+        double getRatio(Compressor::CompressionType type) const {
+            if (type > Compressor::LZ4_BEST) return 1.;
+            std::lock_guard<std::mutex> lock(mtx);
+            return stats[type].ratio;
+        }
+
+
+        /**
+         * Get the number of records built with a type.
+         * @param type compression type.
+         * @return number of records.
+         */
+        uint64_t getRecordCount(Compressor::CompressionType type) const {
+            if (type > Compressor::LZ4_BEST) return 0;
+            std::lock_guard<std::mutex> lock(mtx);
+            return stats[type].records;
+        }
+
+
+        /** @return string with the statistics of each compression type. */
+        std::string toString() const {
+            static const char *names[] = {"none", "lz4", "lz4 best"};
+            std::lock_guard<std::mutex> lock(mtx);
+
+            std::stringstream ss;
+            ss << std::fixed << std::setprecision(3);
+            ss << "compression advisor: headroom " << headroom << std::endl;
+            for (int i = 0; i < 3; i++) {
+                const TypeStats & s = stats[i];
+                ss << "  " << std::setw(8) << names[i] << ": records " << s.records
+                   << ", in " << s.bytesIn << ", out " << s.bytesOut
+                   << ", ratio " << s.ratio << ", ns/byte " << s.nanosPerByte << std::endl;
+            }
+            return ss.str();
+        }
+
+
+        //-----------------------------------------------------------------
+        // Advisors attached to record supplies
+        //-----------------------------------------------------------------
+
+
+        /**
+         * Attach an advisor to the record supply of a writer, replacing any attached before.
+         * Entries whose supply has been destroyed are dropped here.
+         * @param supply  record supply shared by a writer's compressor threads.
+         * @param advisor advisor to use for its records, or null to detach.
+         */
+        static void attach(const std::shared_ptr<RecordSupply> & supply,
+                           const std::shared_ptr<CompressionAdvisor> & advisor) {
+            std::lock_guard<std::mutex> lock(registryMutex());
+            auto & reg = registry();
+            reg.erase(std::remove_if(reg.begin(), reg.end(), [&supply](const Attached & a) {
+                return a.supply.expired() || sameOwner(a.supply, supply);
+            }), reg.end());
+
+            if (advisor) {
+                reg.push_back(Attached{supply, advisor});
+            }
+            attachedCount().store(reg.size(), std::memory_order_release);
+        }
+
+
+        /**
+         * Find the advisor attached to a record supply.
+         * @param supply record supply of a writer.
+         * @return advisor, or null if none is attached.
+         */
+        static std::shared_ptr<CompressionAdvisor> find(const std::shared_ptr<RecordSupply> & supply) {
+            // Cheap test so writers without advisors never take the lock
+            if (attachedCount().load(std::memory_order_acquire) == 0) return nullptr;
+
+            std::lock_guard<std::mutex> lock(registryMutex());
+            for (auto const & a : registry()) {
+                if (sameOwner(a.supply, supply)) return a.advisor;
+            }
+            return nullptr;
+        }
+
+
+    private:
+
+
+        /** Advisor attached to a record supply. */
+        struct Attached {
+            std::weak_ptr<RecordSupply> supply;
+            std::shared_ptr<CompressionAdvisor> advisor;
+        };
+
+        static std::vector<Attached> & registry() {
+            static std::vector<Attached> reg;
+            return reg;
+        }
+
+        static std::mutex & registryMutex() {
+            static std::mutex m;
+            return m;
+        }
+
+        static std::atomic<size_t> & attachedCount() {
+            static std::atomic<size_t> count {0};
+            return count;
+        }
+
+        /** Do these point to the same object? (Unlike comparing addresses, safe after it is freed.) */
+        static bool sameOwner(const std::weak_ptr<RecordSupply> & a, const std::shared_ptr<RecordSupply> & b) {
+            return !a.owner_before(b) && !b.owner_before(a);
+        }
+
+        /**
+         * Get the type to use given current averages. Mutex must be held.
+         * @return compression type.
+         */
+        Compressor::CompressionType bestType() const {
+            const TypeStats & lz4 = stats[Compressor::LZ4];
+            if (1. - lz4.ratio < minGain) return Compressor::UNCOMPRESSED;
+
+            if (maxType == Compressor::LZ4_BEST && headroom >= minHeadroom) {
+                const TypeStats & best = stats[Compressor::LZ4_BEST];
+                if (best.sampled && lz4.ratio - best.ratio >= minBestGain) return Compressor::LZ4_BEST;
+            }
+            return Compressor::LZ4;
+        }
+    };
+
+}
+
+
+#endif //EVIO_6_0_COMPRESSIONADVISOR_H
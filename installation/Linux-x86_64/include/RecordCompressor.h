@@ -17,12 +17,14 @@
 #include <string>
 #include <thread>
 #include <memory>
+#include <chrono>
 
 
 #include "RecordOutput.h"
 #include "RecordHeader.h"
 #include "Compressor.h"
 #include "RecordSupply.h"
+#include "CompressionAdvisor.h"
 
 
 #include "Disruptor/Util.h"
@@ -134,10 +136,30 @@ namespace evio {
                         std::shared_ptr<RecordOutput> & record = item->getRecord();
                         // Set compression type
                         auto & header = record->getHeader();
+#ifdef EVIO_COMPRESSION_ADVISOR
+                        // An advisor attached to our supply (see WriterMT::setCompressionAdvisor)
+                        // chooses the type record by record
+                        auto advisor = CompressionAdvisor::find(supply);
+                        Compressor::CompressionType type = advisor ? advisor->choose() : compressionType;
+                        header->setCompressionType(type);
+//cout << "RecordCompressor thd " << threadNumber << ": got record, set rec # to " << header->getRecordNumber() << endl;
+                        // Do compression
+                        auto start = std::chrono::steady_clock::now();
+                        record->build();
+                        if (advisor) {
+                            auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                    std::chrono::steady_clock::now() - start).count();
+                            uint32_t bytesIn = header->getDataLength();
+                            uint32_t bytesOut = type == Compressor::UNCOMPRESSED ?
+                                                bytesIn : header->getCompressedDataLength();
+                            advisor->update(type, bytesIn, bytesOut, nanos);
+                        }
+#else
                         header->setCompressionType(compressionType);
 //cout << "RecordCompressor thd " << threadNumber << ": got record, set rec # to " << header->getRecordNumber() << endl;
                         // Do compression
                         record->build();
+#endif
                         // Release back to supply
                         supply->releaseCompressor(item);
                     }
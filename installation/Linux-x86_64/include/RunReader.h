@@ -0,0 +1,420 @@
+//
+// Copyright 2023, Jefferson Science Associates, LLC.
+// Subject to the terms in the LICENSE file found in the top-level directory.
+//
+// EPSCI Group
+// Thomas Jefferson National Accelerator Facility
+// 12000, Jefferson Ave, Newport News, VA 23606
+// (757)-269-7100
+
+
+#ifndef EVIO_6_0_RUNREADER_H
+#define EVIO_6_0_RUNREADER_H
+
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <functional>
+#include <exception>
+
+#include <glob.h>
+
+
+#include "Reader.h"
+#include "EvioException.h"
+
+
+namespace evio {
+
+
+    /**
+     * Class to read a whole run, made of many split files in the HIPO format,
+     * as if it were a single file.<p>
+     *
+     * The list of files is given directly or as a glob pattern (sorted by name,
+     * which is the split order for CODA file names). Nothing is read until needed.
+     * The first call needing the global event index opens all files in parallel,
+     * one thread per file up to a given limit, and records the number of events
+     * in each file and in each of its records. After that:
+     * <ul>
+     * <li>{@link #getEvent(uint64_t, uint32_t *)} gives random access by global
+     *     event number (starting at 0);</li>
+     * <li>{@link #forEach} and {@link #forEachRecord} partition the whole run by record
+     *     among threads, each with its own Reader, so that skims and replays scale
+     *     with cores and disks. Records of the same file are handed out in order,
+     *     so each thread mostly reads forward.</li>
+     * </ul>
+     *
+     * @version 6.0
+     * @since 6.0 10/18/2026
+     * @author timmer
+     * @see Reader
+     */
+    class RunReader {
+
+    public:
+
+        /**
+         * Callback for each event. Gets the global event number, the event's data
+         * and length in bytes, and the byte order of the data.
+         * Called from multiple threads at once in no particular order of events.
+         */
+        typedef std::function<void(uint64_t, std::shared_ptr<uint8_t> &, uint32_t, const ByteOrder &)> EventHandler;
+
+        /**
+         * Callback for each record. Gets the file index, record index in that file,
+         * global number of its first event, and the record, whose events can be
+         * read with RecordInput::getEvent.
+         */
+        typedef std::function<void(size_t, uint32_t, uint64_t, RecordInput &)> RecordHandler;
+
+    private:
+
+        /** Index info of a single file. */
+        struct FileInfo {
+            /** File name. */
+            std::string name;
+            /** Global number of first event in file. */
+            uint64_t firstEvent = 0;
+            /** Number of events in file. */
+            uint32_t eventCount = 0;
+            /** Run-wide number of first record in file. */
+            uint64_t firstRecord = 0;
+            /** Global number of first event of each record. */
+            std::vector<uint64_t> recordFirstEvent;
+        };
+
+        /** Files of run in order. */
+        std::vector<FileInfo> files;
+
+        /** Total number of events in run. */
+        uint64_t eventCount = 0;
+
+        /** Total number of records in run. */
+        uint64_t recordCount = 0;
+
+        /** Max number of threads used to build index. */
+        uint32_t indexThreads;
+
+        /** Has the global index been built? */
+        std::atomic<bool> indexed {false};
+
+        /** Mutex for building index and for random access. */
+        std::mutex indexMutex;
+
+        /** Reader used for random access. */
+        Reader randomReader;
+
+        /** Index of file open in randomReader, -1 if none. */
+        int64_t randomFile = -1;
+
+
+    public:
+
+        /**
+         * Constructor.
+         * @param fileNames    names of files of the run in order.
+         * @param indexThreads max number of threads to use to build index (0 = number of cores).
+         */
+        explicit RunReader(const std::vector<std::string> & fileNames, uint32_t indexThreads = 0) {
+            for (auto const & name : fileNames) {
+                FileInfo info;
+                info.name = name;
+                files.push_back(info);
+            }
+            this->indexThreads = indexThreads > 0 ? indexThreads :
+                                 std::max(1U, std::thread::hardware_concurrency());
+        }
+
+
+        /**
+         * Constructor.
+         * @param pattern      glob pattern matching files of run (e.g. "/data/run_004013.hipo.*").
+         * @param indexThreads max number of threads to use to build index (0 = number of cores).
+         * @throws EvioException if no file matches.
+         */
+        explicit RunReader(const std::string & pattern, uint32_t indexThreads = 0) :
+                RunReader(globFiles(pattern), indexThreads) {}
+
+
+        RunReader(const RunReader & reader) = delete;
+
+
+        /**
+         * Find the files matching a glob pattern, sorted by name.
+         * @param pattern glob pattern.
+         * @return names of matching files.
+         * @throws EvioException if no file matches.
+         */
+        static std::vector<std::string> globFiles(const std::string & pattern) {
+            std::vector<std::string> names;
+            glob_t g;
+            if (glob(pattern.c_str(), 0, nullptr, &g) == 0) {
+                for (size_t i = 0; i < g.gl_pathc; i++) {
+                    names.emplace_back(g.gl_pathv[i]);
+                }
+            }
+            globfree(&g);
+
+            if (names.empty()) {
+                throw EvioException("no file matches " + pattern);
+            }
+            std::sort(names.begin(), names.end());
+            return names;
+        }
+
+
+        /** @return number of files in run. */
+        size_t getFileCount() const {return files.size();}
+
+
+        /**
+         * Get the name of a file.
+         * @param index index of file in run.
+         * @return name of file.
+         */
+        const std::string & getFileName(size_t index) const {return files.at(index).name;}
+
+
+        /**
+         * Get the total number of events in run. Builds the index if necessary.
+         * @return number of events in run.
+         */
+        uint64_t getEventCount() {
+            buildIndex();
+            return eventCount;
+        }
+
+
+        /**
+         * Get the total number of records in run. Builds the index if necessary.
+         * @return number of records in run.
+         */
+        uint64_t getRecordCount() {
+            buildIndex();
+            return recordCount;
+        }
+
+
+        /**
+         * Get the run-wide number of a record, which gives the order of
+         * records passed to {@link #forEachRecord}. Builds the index if necessary.
+         *
+         * @param fileIndex index of file in run.
+         * @param record    index of record in that file.
+         * @return number of record in run (starting at 0).
+         */
+        uint64_t getRecordNumber(size_t fileIndex, uint32_t record) {
+            buildIndex();
+            return files.at(fileIndex).firstRecord + record;
+        }
+
+
+        /**
+         * Find the file and the index within it of an event.
+         * Builds the index if necessary.
+         *
+         * @param event      global event number.
+         * @param fileIndex  filled with index of file containing event.
+         * @param localIndex filled with index of event in that file.
+         * @throws EvioException if event number is too large.
+         */
+        void locate(uint64_t event, size_t & fileIndex, uint32_t & localIndex) {
+            buildIndex();
+            if (event >= eventCount) {
+                throw EvioException("event " + std::to_string(event) + " out of range, run has " +
+                                    std::to_string(eventCount));
+            }
+
+            // Last file whose first event <= event (skipping empty files)
+            auto it = std::upper_bound(files.begin(), files.end(), event,
+                                       [](uint64_t ev, const FileInfo & f) {return ev < f.firstEvent;});
+            fileIndex = (it - files.begin()) - 1;
+            while (files[fileIndex].eventCount == 0) fileIndex++;
+            localIndex = (uint32_t)(event - files[fileIndex].firstEvent);
+        }
+
+
+        /**
+         * Get an event by its global number. Thread safe, but calls are serialized;
+         * use {@link #forEach} for parallel access.
+         *
+         * @param event global event number (starting at 0).
+         * @param len   filled with length of event in bytes.
+         * @return event's data.
+         * @throws EvioException if event number is too large or file cannot be read.
+         */
+        std::shared_ptr<uint8_t> getEvent(uint64_t event, uint32_t *len) {
+            size_t fileIndex;
+            uint32_t localIndex;
+            locate(event, fileIndex, localIndex);
+
+            std::lock_guard<std::mutex> lock(indexMutex);
+            if (randomFile != (int64_t)fileIndex) {
+                if (randomFile >= 0) randomReader.close();
+                randomReader.open(files[fileIndex].name);
+                randomFile = (int64_t)fileIndex;
+            }
+            return randomReader.getEvent(localIndex, len);
+        }
+
+
+        /**
+         * Read all records of the run in parallel. Records are handed out to the
+         * threads one at a time, in run order.
+         *
+         * @param threads number of threads (0 = number of cores).
+         * @param handler called for each record.
+         * @throws EvioException (the first exception thrown by any thread).
+         */
+        void forEachRecord(uint32_t threads, const RecordHandler & handler) {
+            buildIndex();
+            if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+
+            // Flat list of (file, record) for all records of run
+            std::vector<std::pair<size_t, uint32_t>> work;
+            work.reserve(recordCount);
+            for (size_t f = 0; f < files.size(); f++) {
+                for (uint32_t r = 0; r < files[f].recordFirstEvent.size(); r++) {
+                    work.emplace_back(f, r);
+                }
+            }
+
+            std::atomic<size_t> next {0};
+            // Set once error is, so other threads stop without reading error unlocked
+            std::atomic<bool> failed {false};
+            std::exception_ptr error = nullptr;
+            std::mutex errorMutex;
+
+            auto worker = [&]() {
+                Reader reader;
+                int64_t openFile = -1;
+                try {
+                    while (true) {
+                        size_t i = next.fetch_add(1);
+                        if (i >= work.size() || failed.load(std::memory_order_relaxed)) break;
+
+                        size_t f = work[i].first;
+                        uint32_t r = work[i].second;
+                        if (openFile != (int64_t)f) {
+                            if (openFile >= 0) reader.close();
+                            reader.open(files[f].name);
+                            openFile = (int64_t)f;
+                        }
+                        reader.readRecord(r);
+                        handler(f, r, files[f].recordFirstEvent[r], reader.getCurrentRecordStream());
+                    }
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (error == nullptr) error = std::current_exception();
+                    failed = true;
+                }
+            };
+
+            std::vector<std::thread> pool;
+            for (uint32_t t = 0; t < threads; t++) pool.emplace_back(worker);
+            for (auto & t : pool) t.join();
+
+            if (error != nullptr) std::rethrow_exception(error);
+        }
+
+
+        /**
+         * Read all events of the run in parallel, partitioned among threads by record.
+         *
+         * @param threads number of threads (0 = number of cores).
+         * @param handler called for each event.
+         * @throws EvioException (the first exception thrown by any thread).
+         */
+        void forEach(uint32_t threads, const EventHandler & handler) {
+            forEachRecord(threads, [&handler](size_t /*file*/, uint32_t /*record*/, uint64_t first, RecordInput & input) {
+                uint32_t count = input.getEntries();
+                const ByteOrder & order = input.getByteOrder();
+                uint32_t len;
+                for (uint32_t i = 0; i < count; i++) {
+                    auto data = input.getEvent(i, &len);
+                    handler(first + i, data, len, order);
+                }
+            });
+        }
+
+
+    private:
+
+
+        /**
+         * Build the global event index if not done yet: open all files in parallel
+         * and get the number of events in each record.
+         * @throws EvioException if a file cannot be read.
+         */
+        void buildIndex() {
+            if (indexed.load(std::memory_order_acquire)) return;
+
+            std::lock_guard<std::mutex> lock(indexMutex);
+            if (indexed.load(std::memory_order_relaxed)) return;
+
+            std::atomic<size_t> next {0};
+            // Set once error is, so other threads stop without reading error unlocked
+            std::atomic<bool> failed {false};
+            std::exception_ptr error = nullptr;
+            std::mutex errorMutex;
+
+            auto worker = [&]() {
+                try {
+                    while (true) {
+                        size_t f = next.fetch_add(1);
+                        if (f >= files.size() || failed.load(std::memory_order_relaxed)) break;
+
+                        Reader reader(files[f].name);
+                        FileInfo & info = files[f];
+                        info.eventCount = reader.getEventCount();
+                        // Start over in case an earlier try failed part way
+                        info.recordFirstEvent.clear();
+
+                        // Relative first event of each record, made global below
+                        uint64_t count = 0;
+                        for (auto & pos : reader.getRecordPositions()) {
+                            info.recordFirstEvent.push_back(count);
+                            count += pos.getCount();
+                        }
+                        reader.close();
+                    }
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (error == nullptr) error = std::current_exception();
+                    failed = true;
+                }
+            };
+
+            uint32_t threads = std::min((uint32_t)files.size(), indexThreads);
+            std::vector<std::thread> pool;
+            for (uint32_t t = 0; t < threads; t++) pool.emplace_back(worker);
+            for (auto & t : pool) t.join();
+
+            if (error != nullptr) std::rethrow_exception(error);
+
+            eventCount = recordCount = 0;
+            for (auto & info : files) {
+                info.firstEvent = eventCount;
+                info.firstRecord = recordCount;
+                for (auto & first : info.recordFirstEvent) first += eventCount;
+                eventCount  += info.eventCount;
+                recordCount += info.recordFirstEvent.size();
+            }
+
+            indexed.store(true, std::memory_order_release);
+        }
+    };
+
+}
+
+
+#endif //EVIO_6_0_RUNREADER_H
@@ -0,0 +1,359 @@
+//
+// Copyright 2023, Jefferson Science Associates, LLC.
+// Subject to the terms in the LICENSE file found in the top-level directory.
+//
+// EPSCI Group
+// Thomas Jefferson National Accelerator Facility
+// 12000, Jefferson Ave, Newport News, VA 23606
+// (757)-269-7100
+
+
+#ifndef EVIO_6_0_SKIMMER_H
+#define EVIO_6_0_SKIMMER_H
+
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <exception>
+#include <condition_variable>
+#include <unordered_map>
+
+
+#include "ByteOrder.h"
+#include "DataType.h"
+#include "RunReader.h"
+#include "WriterMT.h"
+#include "EvioException.h"
+
+
+namespace evio {
+
+
+    /**
+     * Class to filter (skim) the events of HIPO files in parallel, preserving their order.<p>
+     *
+     * Worker threads each take a whole record at a time (through {@link RunReader#forEachRecord}),
+     * which decompresses it, then scan each of its events in place and apply a predicate.
+     * Events are found with the record's index directly in its uncompressed buffer,
+     * so only passing events are copied, into a buffer belonging to that record. The calling thread
+     * takes these buffers in record order and adds their events to a WriterMT, which packs
+     * them into full records and compresses them with its own threads. So the output has
+     * full records even when few events pass, and the order of events is unchanged.
+     * Workers may only run a limited number of records ahead of the writer.<p>
+     *
+     * Predicates for the most common cases are provided: top-level tag/num and presence of
+     * a bank anywhere in the event. They scan the evio headers without making any objects.
+     *
+     * <pre><code>
+     *   RunReader run("/data/run_004013.hipo.*");
+     *   WriterMT writer("skim.hipo", ByteOrder::ENDIAN_LOCAL, 0, 0, Compressor::LZ4, 4);
+     *   Skimmer skimmer(Skimmer::hasBank(0xe102));
+     *   skimmer.skim(run, writer, 8);
+     *   writer.close();
+     * </code></pre>
+     *
+     * @version 6.0
+     * @since 6.0 10/18/2026
+     * @author timmer
+     * @see RunReader
+     * @see WriterMT
+     */
+    class Skimmer {
+
+    public:
+
+        /** Predicate gets an event's data, its length in bytes, and byte order. Must be thread safe. */
+        typedef std::function<bool(const uint8_t *, uint32_t, const ByteOrder &)> Predicate;
+
+    private:
+
+        /** Passing events of one input record. */
+        struct Chunk {
+            std::vector<uint8_t>  data;
+            std::vector<uint32_t> lengths;
+        };
+
+        /** Predicate selecting events. */
+        Predicate predicate;
+
+        /** Number of events scanned. */
+        std::atomic<uint64_t> eventsIn {0};
+
+        /** Number of events written. */
+        std::atomic<uint64_t> eventsOut {0};
+
+
+    public:
+
+        /**
+         * Constructor.
+         * @param predicate function returning true for events to keep.
+         */
+        explicit Skimmer(Predicate predicate) : predicate(std::move(predicate)) {}
+
+
+        /** @return number of events scanned by last skim. */
+        uint64_t getEventsIn()  const {return eventsIn.load();}
+
+        /** @return number of events written by last skim. */
+        uint64_t getEventsOut() const {return eventsOut.load();}
+
+
+        /**
+         * Skim all events of a run into an open writer.
+         * Returns when all events have been added to the writer (which is not closed).
+         *
+         * @param run     run to read.
+         * @param writer  open writer to add passing events to.
+         * @param threads number of threads scanning records (0 = number of cores).
+         * @param window  max number of records workers may be ahead of the writer (0 = 4 per thread).
+         * @throws EvioException if reading or writing fails.
+         */
+        void skim(RunReader & run, WriterMT & writer, uint32_t threads = 0, uint32_t window = 0) {
+            if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+            if (window == 0) window = 4*threads;
+
+            eventsIn  = 0;
+            eventsOut = 0;
+
+            uint64_t recordCount = run.getRecordCount();
+            std::unordered_map<uint64_t, std::unique_ptr<Chunk>> done;
+            uint64_t nextToWrite = 0;
+            bool failed = false;
+            std::mutex mtx;
+            std::condition_variable cond;
+            std::exception_ptr error = nullptr;
+
+            std::thread reader([&]() {
+                try {
+                    run.forEachRecord(threads, [&](size_t file, uint32_t record, uint64_t /*first*/, RecordInput & input) {
+                        uint64_t number = run.getRecordNumber(file, record);
+                        {
+                            // Don't get too far ahead of writer
+                            std::unique_lock<std::mutex> lock(mtx);
+                            cond.wait(lock, [&]() {return number < nextToWrite + window || failed;});
+                            if (failed) throw EvioException("skim stopped");
+                        }
+
+                        std::unique_ptr<Chunk> chunk(new Chunk);
+                        uint32_t count = input.getEntries();
+                        const ByteOrder & order = input.getByteOrder();
+
+                        // Events follow the index and the padded user header in the uncompressed buffer
+                        auto buffer = input.getUncompressedDataBuffer();
+                        size_t offset = 4*(size_t)count + 4*(size_t)input.getHeader()->getUserHeaderLengthWords();
+                        size_t total = 0;
+                        for (uint32_t i = 0; i < count; i++) {
+                            total += input.getEventLength(i);
+                        }
+
+                        if (offset + total <= buffer->capacity()) {
+                            const uint8_t *event = buffer->array() + offset;
+                            for (uint32_t i = 0; i < count; i++) {
+                                uint32_t len = input.getEventLength(i);
+                                if (predicate(event, len, order)) {
+                                    chunk->data.insert(chunk->data.end(), event, event + len);
+                                    chunk->lengths.push_back(len);
+                                }
+                                event += len;
+                            }
+                        }
+                        else {
+                            // Not laid out as expected, let the record copy each event out
+                            uint32_t len;
+                            for (uint32_t i = 0; i < count; i++) {
+                                auto event = input.getEvent(i, &len);
+                                if (predicate(event.get(), len, order)) {
+                                    chunk->data.insert(chunk->data.end(), event.get(), event.get() + len);
+                                    chunk->lengths.push_back(len);
+                                }
+                            }
+                        }
+                        eventsIn += count;
+
+                        std::lock_guard<std::mutex> lock(mtx);
+                        done[number] = std::move(chunk);
+                        cond.notify_all();
+                    });
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    if (error == nullptr) error = std::current_exception();
+                    failed = true;
+                    cond.notify_all();
+                }
+            });
+
+            // Write chunks in record order
+            try {
+                while (nextToWrite < recordCount) {
+                    std::unique_ptr<Chunk> chunk;
+                    {
+                        std::unique_lock<std::mutex> lock(mtx);
+                        cond.wait(lock, [&]() {return done.count(nextToWrite) > 0 || failed;});
+                        if (failed) break;
+                        chunk = std::move(done[nextToWrite]);
+                        done.erase(nextToWrite);
+                    }
+
+                    uint32_t offset = 0;
+                    for (uint32_t len : chunk->lengths) {
+                        writer.addEvent(chunk->data.data(), offset, len);
+                        offset += len;
+                    }
+                    eventsOut += chunk->lengths.size();
+
+                    std::lock_guard<std::mutex> lock(mtx);
+                    nextToWrite++;
+                    cond.notify_all();
+                }
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (error == nullptr) error = std::current_exception();
+                failed = true;
+                cond.notify_all();
+            }
+
+            reader.join();
+            if (error != nullptr) std::rethrow_exception(error);
+        }
+
+
+        //-----------------------------------
+        // Predicates
+        //-----------------------------------
+
+
+        /**
+         * Get a predicate selecting events whose top-level bank has the given tag and num.
+         * @param tag tag of event.
+         * @param num num of event, or -1 for any.
+         * @return predicate.
+         */
+        static Predicate tagNum(uint16_t tag, int num = -1) {
+            return [tag, num](const uint8_t *data, uint32_t len, const ByteOrder & order) {
+                if (len < 8) return false;
+                uint32_t word = readWord(data + 4, order);
+                return (word >> 16) == tag && (num < 0 || (int)(word & 0xff) == num);
+            };
+        }
+
+
+        /**
+         * Get a predicate selecting events containing, at any depth (including
+         * the event itself), a bank with the given tag and num.
+         * @param tag tag of bank.
+         * @param num num of bank, or -1 for any.
+         * @return predicate.
+         */
+        static Predicate hasBank(uint16_t tag, int num = -1) {
+            return [tag, num](const uint8_t *data, uint32_t len, const ByteOrder & order) {
+                if (len < 8) return false;
+                return findBank(data, len/4, order, tag, num);
+            };
+        }
+
+
+        /**
+         * Get a predicate selecting events accepted by any of the given predicates.
+         * @param preds predicates.
+         * @return predicate.
+         */
+        static Predicate any(std::vector<Predicate> preds) {
+            return [preds](const uint8_t *data, uint32_t len, const ByteOrder & order) {
+                for (auto & p : preds) {
+                    if (p(data, len, order)) return true;
+                }
+                return false;
+            };
+        }
+
+
+    private:
+
+
+        /** Read a 32 bit word in the given byte order. */
+        static uint32_t readWord(const uint8_t *p, const ByteOrder & order) {
+            uint32_t word;
+            std::memcpy(&word, p, 4);
+            return order.isLocalEndian() ? word : SWAP_32(word);
+        }
+
+
+        /**
+         * Scan a bank and its children for a bank of given tag and num.
+         *
+         * @param data   start of bank.
+         * @param words  number of 32-bit words available.
+         * @param order  byte order.
+         * @param tag    tag to find.
+         * @param num    num to find, or -1 for any.
+         * @return true if found.
+         */
+        static bool findBank(const uint8_t *data, uint32_t words, const ByteOrder & order,
+                             uint16_t tag, int num) {
+            if (words < 2) return false;
+
+            // Length word counts the words after it, so a bank is at least 2 words (header)
+            uint32_t lenWord = readWord(data, order);
+            if (lenWord < 1 || lenWord >= words) return false;
+            uint32_t len  = lenWord + 1;
+            uint32_t word = readWord(data + 4, order);
+
+            if ((word >> 16) == tag && (num < 0 || (int)(word & 0xff) == num)) return true;
+
+            uint32_t type = (word >> 8) & 0x3f;
+            return findInContainer(data + 8, len - 2, type, order, tag, num);
+        }
+
+
+        /**
+         * Scan the children of a container for a bank of given tag and num.
+         *
+         * @param data   start of children.
+         * @param words  number of 32-bit words of children.
+         * @param type   content type of container.
+         * @param order  byte order.
+         * @param tag    tag to find.
+         * @param num    num to find, or -1 for any.
+         * @return true if found.
+         */
+        static bool findInContainer(const uint8_t *data, uint32_t words, uint32_t type,
+                                    const ByteOrder & order, uint16_t tag, int num) {
+            uint32_t pos = 0;
+
+            if (DataType::isBank(type)) {
+                while (pos + 2 <= words) {
+                    // Corrupt length would read past the container, or never advance
+                    uint32_t lenWord = readWord(data + 4*pos, order);
+                    if (lenWord < 1 || lenWord >= words - pos) return false;
+                    if (findBank(data + 4*pos, words - pos, order, tag, num)) return true;
+                    pos += lenWord + 1;
+                }
+            }
+            else if (DataType::isSegment(type) || DataType::isTagSegment(type)) {
+                while (pos + 1 <= words) {
+                    uint32_t word = readWord(data + 4*pos, order);
+                    uint32_t len  = (word & 0xffff) + 1;
+                    uint32_t childType = DataType::isSegment(type) ? (word >> 16) & 0x3f : (word >> 16) & 0xf;
+                    if (len > words - pos) return false;
+                    if (findInContainer(data + 4*(pos + 1), len - 1, childType, order, tag, num)) return true;
+                    pos += len;
+                }
+            }
+            return false;
+        }
+    };
+
+}
+
+
+#endif //EVIO_6_0_SKIMMER_H
@@ -50,6 +50,9 @@
 #include "RecordInput.h"
 #include "RecordNode.h"
 #include "RecordOutput.h"
+#include "RunReader.h"
+#include "Skimmer.h"
+#include "CompressionAdvisor.h"
 
 #include "SegmentHeader.h"
 #include "StructureFinder.h"
@@ -328,6 +328,29 @@ namespace evio {
 //    RecordOutput & getRecord();
         Compressor::CompressionType getCompressionType();
 
+        /**
+         * Let each record's compression be chosen by the given object instead of always
+         * using the type given in the constructor, which should then not be UNCOMPRESSED.
+         * Must be called before the first event is added.
+         * The advisor is attached to this writer's record supply, so neither this class nor
+         * RecordCompressor changes layout.<p>
+         * The compressor threads run inside libeviocc, so the advisor is only consulted if
+         * libeviocc, and everything including this header, is compiled with
+         * EVIO_COMPRESSION_ADVISOR defined. Otherwise no advisor can be set.
+         * @param advisor object choosing compression type, or null to turn off.
+         * @throws EvioException if an advisor is given and not compiled with EVIO_COMPRESSION_ADVISOR.
+         */
+        void setCompressionAdvisor(std::shared_ptr<CompressionAdvisor> advisor) {
+#ifdef EVIO_COMPRESSION_ADVISOR
+            if (advisor) advisor->setThreads(compressionThreadCount);
+            CompressionAdvisor::attach(supply, advisor);
+#else
+            if (advisor) {
+                throw EvioException("compression advisor needs evio built with EVIO_COMPRESSION_ADVISOR");
+            }
+#endif
+        }
+
         bool addTrailer() const;
         void addTrailer(bool add);
         bool addTrailerWithIndex();
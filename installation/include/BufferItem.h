@@ -142,6 +142,20 @@ namespace ejfat {
         std::shared_ptr<ByteBuffer> ensureCapacity(uint32_t capacity);
         std::shared_ptr<ByteBuffer> expandBuffer(uint32_t capacity);
 
+
+        /**
+         * Get the memory region of this item's ByteBuffer so that a supply can
+         * place it on a NUMA node.
+         *
+         * @param addr filled with start of buffer's backing array, or nullptr if none.
+         * @param len  filled with capacity of buffer in bytes.
+         */
+        void getDataRegion(void **addr, size_t *len) const {
+            std::shared_ptr<ByteBuffer> buf = getBuffer();
+            *addr = (buf == nullptr) ? nullptr : (void *)buf->array();
+            *len  = (buf == nullptr) ? 0 : buf->capacity();
+        }
+
     };
 
 }
@@ -17,10 +17,13 @@
 #include <vector>
 #include <atomic>
 #include <mutex>
+#include <stdexcept>
 
 
 #include "ByteOrder.h"
 #include "BufferSupplyItem.h"
+#include "NumaUtil.h"
+#include "SupplyStats.h"
 #include "Disruptor/Disruptor.h"
 #include "Disruptor/SpinCountBackoffWaitStrategy.h"
 
@@ -130,6 +133,9 @@ namespace ejfat {
         // For item id
         int itemCounter;
 
+        // Places this supply's items in memory
+        friend class NumaBufferSupply;
+
 
     public:
 
@@ -141,7 +147,6 @@ namespace ejfat {
                      const ByteOrder & order = ByteOrder::ENDIAN_LOCAL,
                      bool orderedRelease = false);
 
-
         ~BufferSupply() {ringBuffer.reset();}
 
         void errorAlert() const;
@@ -161,6 +166,165 @@ namespace ejfat {
 
         void get(int32_t n, std::shared_ptr<BufferSupplyItem> items[]);
         void publish(int32_t n, std::shared_ptr<BufferSupplyItem> items[]);
+
+
+        /**
+         * Did the user promise to release items in the same order as acquired?
+         * @return true if items must be released in order.
+         */
+        bool isOrderedRelease() const {return orderedRelease;}
+
+
+        /**
+         * Get the fraction of the items' buffer pages which are resident on a NUMA node
+         * other than the given one, in other words, the ratio of memory accesses that
+         * are remote for a thread running on that node. Only touched pages are counted.
+         * This walks every page of every buffer so do not call it in the data path.
+         *
+         * @param node NUMA node of the accessing thread, -1 for node of calling thread.
+         * @return fraction of remote pages (0 to 1), or 0 if no pages could be counted.
+         */
+        double getRemoteAccessRatio(int node = -1) {
+            if (node < 0) node = numaCurrentNode();
+
+            uint64_t local = 0, remote = 0;
+            for (int64_t i = 0; i < ringBuffer->bufferSize(); i++) {
+                std::shared_ptr<ByteBuffer> buf = (*ringBuffer.get())[i]->getBuffer();
+                if (buf == nullptr) continue;
+                numaPageCount(buf->array(), buf->capacity(), node, &local, &remote);
+            }
+
+            if (local + remote == 0) return 0.;
+            return (double)remote / (double)(local + remote);
+        }
+    };
+
+
+    /**
+     * This class is a BufferSupply whose items' ByteBuffers are placed on a given NUMA node
+     * (NUMA_BIND), or spread over all nodes (NUMA_INTERLEAVE), and first-touched there
+     * regardless of which thread builds the supply. Pin producer and consumer threads
+     * with {@link #pinThread(pthread_t)} so they run on cores of the same node.<p>
+     *
+     * It is kept apart from BufferSupply, whose code is compiled into libejfat_util,
+     * so that class keeps the layout the library was built with. Since BufferSupply's
+     * destructor is not virtual, it can only be made with {@link #create}, whose
+     * shared pointer deletes it as what it is wherever a BufferSupply is expected.
+     *
+     * @date 10/18/2026
+     */
+    class NumaBufferSupply final : public BufferSupply {
+
+    private:
+
+        /** How ring items are placed in memory. */
+        numaPolicy numaPol;
+        /** NUMA node ring items are placed on if numaPol = NUMA_BIND, else -1. */
+        int numaNode;
+        /** Fill level samples and publishing rate for getStats(). */
+        SupplyCounters counters;
+
+
+        /**
+         * Constructor, see {@link #create}.
+         *
+         * @param ringSize        number of ByteBufferItems in ring buffer.
+         * @param bufferSize      initial size (bytes) of ByteBuffer in each ByteBufferItem object.
+         * @param order           byte order of ByteBuffer in each ByteBufferItem object.
+         * @param orderedRelease  if true, the user promises to release the ByteBufferItems
+         *                        in the same order as acquired.
+         * @param policy          NUMA_NONE, NUMA_BIND or NUMA_INTERLEAVE.
+         * @param node            NUMA node to place items on if policy = NUMA_BIND.
+         * @throws IllegalArgumentException if ringSize arg &lt; 1 or not power of 2,
+         *                                  or if policy = NUMA_BIND and node is not valid.
+         */
+        NumaBufferSupply(int ringSize, int bufferSize, const ByteOrder & order,
+                         bool orderedRelease, numaPolicy policy, int node) :
+                BufferSupply(ringSize, bufferSize, order, orderedRelease),
+                numaPol(policy), numaNode(policy == NUMA_BIND ? node : -1) {
+
+            if (policy == NUMA_BIND && !numaNodeValid(node)) {
+                throw std::runtime_error("bad NUMA node " + std::to_string(node));
+            }
+
+            if (policy == NUMA_NONE) return;
+
+            for (int64_t i = 0; i < ringBuffer->bufferSize(); i++) {
+                std::shared_ptr<ByteBuffer> buf = (*ringBuffer.get())[i]->getBuffer();
+                if (buf == nullptr) continue;
+                numaPlaceMemory(buf->array(), buf->capacity(), policy, node, true);
+            }
+        }
+
+    public:
+
+        /**
+         * Create a supply whose items are placed according to the given NUMA policy.
+         *
+         * @param ringSize        number of ByteBufferItems in ring buffer.
+         * @param bufferSize      initial size (bytes) of ByteBuffer in each ByteBufferItem object.
+         * @param order           byte order of ByteBuffer in each ByteBufferItem object.
+         * @param orderedRelease  if true, the user promises to release the ByteBufferItems
+         *                        in the same order as acquired.
+         * @param policy          NUMA_NONE, NUMA_BIND or NUMA_INTERLEAVE.
+         * @param node            NUMA node to place items on if policy = NUMA_BIND.
+         * @return shared pointer to new supply.
+         * @throws IllegalArgumentException if ringSize arg &lt; 1 or not power of 2,
+         *                                  or if policy = NUMA_BIND and node is not valid.
+         */
+        static std::shared_ptr<NumaBufferSupply> create(int ringSize, int bufferSize, const ByteOrder & order,
+                                                        bool orderedRelease, numaPolicy policy, int node) {
+            // Constructor is private, so make_shared cannot be used
+            return std::shared_ptr<NumaBufferSupply>(
+                    new NumaBufferSupply(ringSize, bufferSize, order, orderedRelease, policy, node));
+        }
+
+
+        /**
+         * Get the NUMA placement policy of the items in this supply.
+         * @return NUMA placement policy of the items in this supply.
+         */
+        numaPolicy getNumaPolicy() const {return numaPol;}
+
+
+        /**
+         * Get the NUMA node the items of this supply are placed on.
+         * @return NUMA node of items, or -1 if not bound to a single node.
+         */
+        int getNumaNode() const {return numaNode;}
+
+
+        /**
+         * Restrict the given (producer or consumer) thread to the cores of the NUMA node
+         * the items of this supply are placed on. Does nothing if items are not bound to a node.
+         * @param thread thread to pin (e.g. pthread_self() or std::thread::native_handle()).
+         * @return 0 if OK, else error number.
+         */
+        int pinThread(pthread_t thread) const {
+            if (numaNode < 0) return 0;
+            return pinThreadToNode(thread, numaNode);
+        }
+
+
+        /**
+         * Get a snapshot of this supply's statistics for a SupplyMonitor (see addSupplier).
+         * BufferSupply keeps no counters of its own, so the fill level is sampled into
+         * the histogram at each call. The consumer lag is taken from the ring's cursor and
+         * its slowest gating sequence. If items are bound to a node, the fraction of their
+         * pages found elsewhere is included, which walks every page of the ring.
+         *
+         * @return snapshot of this supply's statistics.
+         */
+        supplyStats getStats() {
+            supplyStats stats;
+            stats.ringSize    = getRingSize();
+            stats.fillLevel   = getFillLevel();
+            stats.consumerLag = ringBuffer->cursor() - ringBuffer->getMinimumGatingSequence();
+            counters.addFill(stats.fillLevel);
+            counters.fillSnapshot(stats, getLastSequence());
+            if (numaNode >= 0) stats.remoteAccessRatio = getRemoteAccessRatio(numaNode);
+            return stats;
+        }
     };
 
 }
@@ -0,0 +1,338 @@
+//
+// Copyright 2023, Jefferson Science Associates, LLC.
+// Subject to the terms in the LICENSE file found in the top-level directory.
+//
+// EPSCI Group
+// Thomas Jefferson National Accelerator Facility
+// 12000, Jefferson Ave, Newport News, VA 23606
+// (757)-269-7100
+
+
+/**
+ * @file
+ * Contains routines to discover the NUMA layout of a node and to place
+ * memory and threads on a given NUMA node. It talks directly to the kernel
+ * (sysfs and the mbind / move_pages system calls) so that
+ * libnuma is not required. On non-linux systems all routines are no-ops
+ * which report a single node.
+ */
+#ifndef UTIL_NUMAUTIL_H
+#define UTIL_NUMAUTIL_H
+
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#ifdef __linux__
+    #ifndef _GNU_SOURCE
+        #define _GNU_SOURCE
+    #endif
+    #include <sched.h>
+    #include <unistd.h>
+    #include <sys/syscall.h>
+
+    // Kernel memory policy constants (from linux/mempolicy.h, also in numaif.h)
+    #ifndef MPOL_DEFAULT
+        #define MPOL_DEFAULT     0
+        #define MPOL_PREFERRED   1
+        #define MPOL_BIND        2
+        #define MPOL_INTERLEAVE  3
+    #endif
+    #ifndef MPOL_MF_MOVE
+        #define MPOL_MF_MOVE     (1<<1)
+    #endif
+#endif
+
+
+namespace ejfat {
+
+
+    /** How items of a supply are to be placed in memory. */
+    enum numaPolicy {
+        /** Leave placement to the kernel (first touch by whichever thread). */
+        NUMA_NONE = 0,
+        /** Allocate and first-touch items on one given node. */
+        NUMA_BIND = 1,
+        /** Interleave item pages over all nodes. */
+        NUMA_INTERLEAVE = 2
+    };
+
+
+    /**
+     * Parse a sysfs style cpu or node list (e.g. "0-7,16-23") into a vector of ints.
+     * @param list string to parse.
+     * @return vector of listed numbers.
+     */
+    static std::vector<int> numaParseList(const std::string & list) {
+        std::vector<int> vals;
+        const char *p = list.c_str();
+
+        while (*p != '\0' && *p != '\n') {
+            char *end;
+            long lo = strtol(p, &end, 10);
+            if (end == p) break;
+            long hi = lo;
+            p = end;
+            if (*p == '-') {
+                hi = strtol(p + 1, &end, 10);
+                p = end;
+            }
+            for (long i = lo; i <= hi; i++) {
+                vals.push_back((int)i);
+            }
+            if (*p == ',') p++;
+        }
+        return vals;
+    }
+
+
+    /**
+     * Read the first line of a (sysfs) file.
+     * @param path file to read.
+     * @return first line of file or empty string if it cannot be read.
+     */
+    static std::string numaReadLine(const std::string & path) {
+        char line[4096];
+        FILE *fp = fopen(path.c_str(), "r");
+        if (fp == nullptr) return "";
+        if (fgets(line, sizeof(line), fp) == nullptr) line[0] = '\0';
+        fclose(fp);
+        return std::string(line);
+    }
+
+
+    /**
+     * Get the NUMA nodes of this host which are online.
+     * Node numbers need not be contiguous (e.g. 0,2 on some multi-socket hosts).
+     * @return NUMA nodes, {0} if unknown.
+     */
+    static std::vector<int> numaNodes() {
+#ifdef __linux__
+        std::vector<int> nodes = numaParseList(numaReadLine("/sys/devices/system/node/online"));
+        if (!nodes.empty()) {
+            return nodes;
+        }
+#endif
+        return std::vector<int>(1, 0);
+    }
+
+
+    /**
+     * Get one more than the highest NUMA node number on this host.
+     * With sparse node numbers this is more than the number of nodes,
+     * so use {@link #numaNodes()} to go through them.
+     * @return highest node number + 1, 1 if unknown.
+     */
+    static int numaNodeCount() {
+        return numaNodes().back() + 1;
+    }
+
+
+    /**
+     * Is the given NUMA node online on this host?
+     * @param node NUMA node.
+     * @return true if node is online.
+     */
+    static bool numaNodeValid(int node) {
+        for (int n : numaNodes()) {
+            if (n == node) return true;
+        }
+        return false;
+    }
+
+
+    /**
+     * Get the cpus belonging to the given NUMA node.
+     * @param node NUMA node.
+     * @return cpus of that node, empty if unknown.
+     */
+    static std::vector<int> numaNodeCpus(int node) {
+#ifdef __linux__
+        if (node >= 0) {
+            return numaParseList(numaReadLine("/sys/devices/system/node/node" +
+                                              std::to_string(node) + "/cpulist"));
+        }
+#endif
+        return std::vector<int>();
+    }
+
+
+    /**
+     * Get the NUMA node to which the given cpu belongs.
+     * @param cpu cpu number.
+     * @return NUMA node of cpu, 0 if unknown.
+     */
+    static int numaNodeOfCpu(int cpu) {
+        for (int node : numaNodes()) {
+            for (int c : numaNodeCpus(node)) {
+                if (c == cpu) return node;
+            }
+        }
+        return 0;
+    }
+
+
+    /**
+     * Get the NUMA node the calling thread is currently running on.
+     * @return NUMA node of calling thread, 0 if unknown.
+     */
+    static int numaCurrentNode() {
+#ifdef __linux__
+        int cpu = sched_getcpu();
+        if (cpu >= 0) return numaNodeOfCpu(cpu);
+#endif
+        return 0;
+    }
+
+
+    /**
+     * Restrict the given thread to run only on the given cpus.
+     * @param thread thread to pin.
+     * @param cpus   cpus to run on.
+     * @return 0 if OK, else error number.
+     */
+    static int pinThreadToCpus(pthread_t thread, const std::vector<int> & cpus) {
+#ifdef __linux__
+        if (cpus.empty()) return EINVAL;
+
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        for (int cpu : cpus) {
+            CPU_SET(cpu, &cpuset);
+        }
+        return pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset);
+#else
+        return 0;
+#endif
+    }
+
+
+    /**
+     * Restrict the given thread to run only on the cores of the given NUMA node.
+     * Use this to keep producer and consumer threads next to the memory of the
+     * supply they use.
+     *
+     * @param thread thread to pin.
+     * @param node   NUMA node.
+     * @return 0 if OK, else error number.
+     */
+    static int pinThreadToNode(pthread_t thread, int node) {
+        return pinThreadToCpus(thread, numaNodeCpus(node));
+    }
+
+
+    /**
+     * Restrict the calling thread to run only on the cores of the given NUMA node.
+     * @param node NUMA node.
+     * @return 0 if OK, else error number.
+     */
+    static int pinCurrentThreadToNode(int node) {
+#ifdef __linux__
+        return pinThreadToNode(pthread_self(), node);
+#else
+        return 0;
+#endif
+    }
+
+
+    /**
+     * Place the pages of the given memory region according to the given policy.
+     * Pages already touched are migrated, others get allocated per the policy
+     * when first touched. Only whole pages inside the region are affected.
+     * If touch is true, every page is written to so its placement is final.
+     *
+     * @param addr   start of memory region.
+     * @param len    length of memory region in bytes.
+     * @param policy NUMA_BIND or NUMA_INTERLEAVE, NUMA_NONE does nothing.
+     * @param node   node to bind to if policy is NUMA_BIND.
+     * @param touch  if true, first-touch (zero) every page of the region.
+     * @return 0 if OK, -1 on error (see errno).
+     */
+    static int numaPlaceMemory(void *addr, size_t len, numaPolicy policy, int node, bool touch) {
+        if (addr == nullptr || len == 0 || policy == NUMA_NONE) return 0;
+
+#ifdef __linux__
+        size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+        uintptr_t start = ((uintptr_t)addr + pageSize - 1) & ~(uintptr_t)(pageSize - 1);
+        uintptr_t end   = ((uintptr_t)addr + len) & ~(uintptr_t)(pageSize - 1);
+        if (end <= start) return 0;
+
+        // One mask word covers 64 nodes, which is more than enough here
+        unsigned long mask = 0UL;
+        int mode;
+        if (policy == NUMA_BIND) {
+            if (node < 0 || node >= 64) return -1;
+            mask = 1UL << node;
+            mode = MPOL_BIND;
+        }
+        else {
+            // Only nodes which exist, or mbind fails with EINVAL
+            for (int n : numaNodes()) {
+                if (n < 64) mask |= 1UL << n;
+            }
+            mode = MPOL_INTERLEAVE;
+        }
+
+        long err = syscall(SYS_mbind, (void *)start, end - start, mode,
+                           &mask, 8*sizeof(mask) + 1, MPOL_MF_MOVE);
+        if (err != 0) return -1;
+
+        if (touch) {
+            memset((void *)start, 0, end - start);
+        }
+#endif
+        return 0;
+    }
+
+
+    /**
+     * Count how many pages of the given memory region are resident on the given node
+     * and how many are resident elsewhere. Pages not yet touched are not counted.
+     *
+     * @param addr   start of memory region.
+     * @param len    length of memory region in bytes.
+     * @param node   node considered local.
+     * @param local  incremented by number of pages resident on node.
+     * @param remote incremented by number of pages resident on other nodes.
+     */
+    static void numaPageCount(const void *addr, size_t len, int node,
+                              uint64_t *local, uint64_t *remote) {
+#ifdef __linux__
+        if (addr == nullptr || len == 0) return;
+
+        const size_t batch = 256;
+        size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+        uintptr_t page  = (uintptr_t)addr & ~(uintptr_t)(pageSize - 1);
+        uintptr_t end   = (uintptr_t)addr + len;
+        void *pages[batch];
+        int status[batch];
+
+        while (page < end) {
+            size_t count = 0;
+            for (; count < batch && page < end; count++, page += pageSize) {
+                pages[count] = (void *)page;
+            }
+
+            // With null nodes, move_pages only reports where each page lives
+            if (syscall(SYS_move_pages, 0, count, pages, nullptr, status, 0) != 0) return;
+
+            for (size_t i = 0; i < count; i++) {
+                if (status[i] < 0) continue;
+                if (status[i] == node) (*local)++;
+                else (*remote)++;
+            }
+        }
+#endif
+    }
+
+
+}
+
+
+#endif // UTIL_NUMAUTIL_H
@@ -19,9 +19,13 @@
 #include <mutex>
 #include <iostream>
 #include <type_traits>
+#include <algorithm>
 
 
 #include "SupplyItem.h"
+#include "NumaUtil.h"
+#include "SupplyStats.h"
+#include "ejfat_probes.hpp"
 #include "Disruptor/Disruptor.h"
 #include "Disruptor/SpinCountBackoffWaitStrategy.h"
 
@@ -132,6 +136,20 @@ namespace ejfat {
         // For item id
         int itemCounter;
 
+        // For NUMA placement
+
+        /** How ring items are placed in memory. */
+        numaPolicy numaPol = NUMA_NONE;
+        /** NUMA node ring items are placed on if numaPol = NUMA_BIND, else -1. */
+        int numaNode = -1;
+
+        // For statistics
+
+        /** Producer stall, consumer wait and fill level counters. */
+        SupplyCounters counters;
+        /** Number of publish calls, used to prescale fill level sampling (single producer). */
+        uint32_t publishCount = 0;
+
 
     public:
 
@@ -236,6 +254,80 @@ namespace ejfat {
         }
 
 
+        /**
+         * Constructor which places all ring items in memory according to the given NUMA policy.
+         * Each item's data is moved to, and first-touched on, the given node (NUMA_BIND) or
+         * spread over all nodes (NUMA_INTERLEAVE) regardless of which thread builds this supply.
+         * Pin producer and consumer threads with {@link #pinThread(pthread_t)} so they run
+         * on cores of the same node. Only items which report a data region through
+         * getDataRegion() (e.g. BufferItem) are affected.
+         *
+         * @param ringSize        number of T item in ring buffer.
+         * @param orderedRelease  if true, the user promises to release the T items
+         *                        in the same order as acquired.
+         * @param consumerCount   number of consumers who will be operating on each ring item.
+         * @param policy          NUMA_NONE, NUMA_BIND or NUMA_INTERLEAVE.
+         * @param node            NUMA node to place items on if policy = NUMA_BIND.
+         * @throws IllegalArgumentException if ringSize arg &lt; 1 or not power of 2,
+         *                                  or if policy = NUMA_BIND and node is not valid.
+         */
+        SupplierN(uint32_t ringSize, bool orderedRelease, uint32_t consumerCount, numaPolicy policy, int node) :
+                SupplierN(ringSize, orderedRelease, consumerCount) {
+
+            if (policy == NUMA_BIND && !numaNodeValid(node)) {
+                throw std::runtime_error("bad NUMA node " + std::to_string(node));
+            }
+
+            numaPol  = policy;
+            numaNode = (policy == NUMA_BIND) ? node : -1;
+
+            if (policy == NUMA_NONE) return;
+
+            for (int64_t i = 0; i < ringBuffer->bufferSize(); i++) {
+                void *addr;
+                size_t len;
+                (*ringBuffer.get())[i]->getDataRegion(&addr, &len);
+                numaPlaceMemory(addr, len, policy, node, true);
+            }
+        }
+
+
+    protected:
+
+
+        /**
+         * Claim the next n items of the ring for the producer. Only if the ring is full
+         * is the time spent waiting for items to be released measured and counted.
+         * @param n number of ring buffer items to claim.
+         * @return highest sequence claimed.
+         */
+        int64_t claimNext(int32_t n) {
+            counters.producerGets.fetch_add(n, std::memory_order_relaxed);
+            if (ringBuffer->hasAvailableCapacity(n)) {
+                return ringBuffer->next(n);
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            int64_t hi = ringBuffer->next(n);
+            counters.addProducerStall(start);
+            return hi;
+        }
+
+
+        /**
+         * Sample the fill level into the histogram every 16th publish.
+         * Only called by the single producer.
+         */
+        void sampleFill() {
+            if ((++publishCount & 0xf) == 0) {
+                counters.addFill(getFillLevel());
+            }
+        }
+
+
+    public:
+
+
         /**
          * Method to have sequence barriers throw a Disruptor's AlertException.
          * In this case, we can use it to warn write and compress threads which
@@ -292,6 +384,84 @@ namespace ejfat {
         }
 
 
+        /**
+         * Get a snapshot of this supply's statistics: producer stall and consumer wait
+         * counts and times, fill level histogram, the slowest consumer's lag, and the rate
+         * at which items were published since the previous call.
+         * May be called from any thread.
+         *
+         * @return snapshot of this supply's statistics.
+         */
+        supplyStats getStats() {
+            supplyStats stats;
+            stats.ringSize  = ringBuffer->bufferSize();
+            stats.fillLevel = getFillLevel();
+            int64_t minReleased = sequence[0]->value();
+            for (uint32_t i = 1; i < consumerCount; i++) {
+                minReleased = std::min(minReleased, sequence[i]->value());
+            }
+            stats.consumerLag = ringBuffer->cursor() - minReleased;
+            counters.fillSnapshot(stats, getLastSequence());
+            if (numaNode >= 0) stats.remoteAccessRatio = getRemoteAccessRatio(numaNode);
+            return stats;
+        }
+
+
+        /** Clear this supply's statistics counters. */
+        void clearStats() {counters.clear();}
+
+
+        /**
+         * Get the NUMA placement policy of the items in this supply.
+         * @return NUMA placement policy of the items in this supply.
+         */
+        numaPolicy getNumaPolicy() const {return numaPol;}
+
+
+        /**
+         * Get the NUMA node the items of this supply are placed on.
+         * @return NUMA node of items, or -1 if not bound to a single node.
+         */
+        int getNumaNode() const {return numaNode;}
+
+
+        /**
+         * Restrict the given (producer or consumer) thread to the cores of the NUMA node
+         * the items of this supply are placed on. Does nothing if items are not bound to a node.
+         * @param thread thread to pin (e.g. pthread_self() or std::thread::native_handle()).
+         * @return 0 if OK, else error number.
+         */
+        int pinThread(pthread_t thread) const {
+            if (numaNode < 0) return 0;
+            return pinThreadToNode(thread, numaNode);
+        }
+
+
+        /**
+         * Get the fraction of the items' memory pages which are resident on a NUMA node
+         * other than the given one, in other words, the ratio of memory accesses that
+         * are remote for a thread running on that node. Only touched pages are counted.
+         * This walks every page of every item so do not call it in the data path.
+         *
+         * @param node NUMA node of the accessing thread, -1 for node of calling thread.
+         * @return fraction of remote pages (0 to 1), or 0 if no pages could be counted.
+         */
+        double getRemoteAccessRatio(int node = -1) {
+            if (node < 0) node = numaCurrentNode();
+
+            uint64_t local = 0, remote = 0;
+            for (int64_t i = 0; i < ringBuffer->bufferSize(); i++) {
+                void *addr;
+                size_t len;
+                (*ringBuffer.get())[i]->getDataRegion(&addr, &len);
+                numaPageCount(addr, len, node, &local, &remote);
+            }
+
+            if (local + remote == 0) return 0.;
+            return (double)remote / (double)(local + remote);
+        }
+
+
         /**
          * Get the next available item in ring buffer for writing/reading data.
          * Not sure if this method is thread-safe.
@@ -301,7 +471,7 @@ namespace ejfat {
          */
         std::shared_ptr<T> get() {
             // Next available item claimed by data producer
-            long getSequence = ringBuffer->next();
+            long getSequence = claimNext(1);
 
             // Get object in that position (sequence) of ring buffer
             std::shared_ptr<T> bufItem = (*ringBuffer.get())[getSequence];
@@ -311,6 +481,7 @@ namespace ejfat {
 
             // Store sequence for later releasing of the buffer
             bufItem->setProducerSequence(getSequence);
+            EJFAT_PROBE_SUPPLIER_GET(this, getSequence);
 
             return bufItem;
         }
@@ -328,7 +499,7 @@ namespace ejfat {
          */
         void get(int32_t n, std::shared_ptr<T> items[]) {
             // Next available n items claimed by data producer
-            long hi = ringBuffer->next(n);
+            long hi = claimNext(n);
             long lo = hi - (n - 1);
 
             for (long seq = lo; seq <= hi; seq++) {
@@ -337,6 +508,7 @@ namespace ejfat {
                 bufItem->reset();
                 items[seq - lo] = bufItem;
                 bufItem->setProducerSequence(seq);
+                EJFAT_PROBE_SUPPLIER_GET(this, seq);
             }
         }
 
@@ -354,7 +526,7 @@ namespace ejfat {
          */
         std::shared_ptr<T> getAsIs() {
             // Next available item claimed by data producer
-            long getSequence = ringBuffer->next();
+            long getSequence = claimNext(1);
 
             // Get object in that position (sequence) of ring buffer
             std::shared_ptr<T> bufItem = (*ringBuffer.get())[getSequence];
@@ -362,6 +534,7 @@ namespace ejfat {
 
             // Store sequence for later releasing of the buffer
             bufItem->setProducerSequence(getSequence);
+            EJFAT_PROBE_SUPPLIER_GET(this, getSequence);
 
             return bufItem;
         }
@@ -384,10 +557,20 @@ namespace ejfat {
             try  {
                 // Only wait for read-volatile-memory if necessary ...
                 if (availableConsumerSequence[id] < nextConsumerSequence[id]) {
-                    availableConsumerSequence[id] = barrier->waitFor(nextConsumerSequence[id]);
+                    if (ringBuffer->cursor() < nextConsumerSequence[id]) {
+                        // Nothing published yet, so time the wait
+                        auto start = std::chrono::steady_clock::now();
+                        availableConsumerSequence[id] = barrier->waitFor(nextConsumerSequence[id]);
+                        counters.addConsumerWait(start);
+                    }
+                    else {
+                        availableConsumerSequence[id] = barrier->waitFor(nextConsumerSequence[id]);
+                    }
                 }
+                counters.consumerGets.fetch_add(1, std::memory_order_relaxed);
 
                 item = (*ringBuffer.get())[nextConsumerSequence[id]];
+                EJFAT_PROBE_SUPPLIER_CONSUME(this, nextConsumerSequence[id]);
                 item->setConsumerSequence(nextConsumerSequence[id]++, id);
                 item->setFromConsumerGet(true);
             }
@@ -429,6 +612,8 @@ namespace ejfat {
             }
 
             if (item->decrementCounter(id)) {
+                EJFAT_PROBE_SUPPLIER_RELEASE(this, seq);
+
                 if (orderedRelease) {
                     //System.out.println(" <" + maxSequence + ">" );
                     sequence[id]->setValue(seq);
@@ -475,7 +660,9 @@ namespace ejfat {
          */
         void publish(std::shared_ptr<T> & item) {
             if (item == nullptr) return;
+            EJFAT_PROBE_SUPPLIER_PUBLISH(this, item->getProducerSequence());
             ringBuffer->publish(item->getProducerSequence());
+            sampleFill();
         }
 
 
@@ -488,7 +675,13 @@ namespace ejfat {
          */
         void publish(int32_t n, std::shared_ptr<T> items[]) {
             if (n < 1 || items == nullptr) return;
+#ifdef EJFAT_USDT
+            for (int32_t i = 0; i < n; i++) {
+                EJFAT_PROBE_SUPPLIER_PUBLISH(this, items[i]->getProducerSequence());
+            }
+#endif
             ringBuffer->publish(items[0]->getProducerSequence(), items[n-1]->getProducerSequence());
+            sampleFill();
         }
 
     };
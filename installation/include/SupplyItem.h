@@ -99,6 +99,16 @@ namespace ejfat {
         int  getUsers(uint32_t id = 0) const;
         void addUsers(int additionalUsers, uint32_t id = 0);
 
+        /**
+         * Get the memory region holding this item's data so that a supply can place
+         * it on a NUMA node. This base class has no data and returns an empty region.
+         * Items holding a data buffer hide this method with their own version.
+         *
+         * @param addr filled with start of data region, or nullptr if none.
+         * @param len  filled with length of data region in bytes.
+         */
+        void getDataRegion(void **addr, size_t *len) const {*addr = nullptr; *len = 0;}
+
     protected:
 
         bool decrementCounter(uint32_t id = 0);
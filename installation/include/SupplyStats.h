@@ -0,0 +1,377 @@
+//
+// Copyright 2023, Jefferson Science Associates, LLC.
+// Subject to the terms in the LICENSE file found in the top-level directory.
+//
+// EPSCI Group
+// Thomas Jefferson National Accelerator Facility
+// 12000, Jefferson Ave, Newport News, VA 23606
+// (757)-269-7100
+
+
+#ifndef UTIL_SUPPLYSTATS_H
+#define UTIL_SUPPLYSTATS_H
+
+
+#include <cstdio>
+#include <cinttypes>
+#include <string>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <utility>
+#include <functional>
+#include <condition_variable>
+
+
+namespace ejfat {
+
+
+    /** Number of bins in a fill level histogram, each 10% wide (last bin is 100%). */
+    #define SUPPLY_FILL_BINS 11
+
+
+    /**
+     * Structure holding a snapshot of the counters of one ring buffer based supply
+     * (Supplier, SupplierN, BufferSupply, or evio's RecordSupply).
+     * Times are in nanoseconds, counts since the counters were last cleared.
+     */
+    typedef struct supplyStats_t {
+        std::string name;                /**< Name given to supply when registered with a SupplyMonitor. */
+        uint32_t ringSize = 0;           /**< Number of items in ring. */
+        int64_t  lastSequence = -1;      /**< Sequence of last item published. */
+        uint64_t fillLevel = 0;          /**< Percentage of ring currently filled (unreleased). */
+        int64_t  consumerLag = 0;        /**< Items published but not yet released by slowest consumer
+                                              (estimated from fillLevel for sampled supplies). */
+        double   itemsPerSec = 0.;       /**< Items published per second since previous snapshot. */
+
+        uint64_t producerGets = 0;       /**< Items obtained by producer. */
+        uint64_t producerStalls = 0;     /**< Times producer found the ring full and had to wait. */
+        uint64_t producerStallNanos = 0; /**< Total time producer spent waiting for a free item. */
+
+        uint64_t consumerGets = 0;       /**< Items obtained by consumer(s). */
+        uint64_t consumerWaits = 0;      /**< Times consumer found the ring empty and had to wait. */
+        uint64_t consumerWaitNanos = 0;  /**< Total time consumer(s) spent waiting for a published item. */
+
+        uint64_t fillHistogram[SUPPLY_FILL_BINS] = {0}; /**< Fill level samples in 10% bins. */
+
+        double   remoteAccessRatio = -1.; /**< Fraction of item pages off the supply's NUMA node,
+                                               -1 if items are not bound to a node. */
+    } supplyStats;
+
+
+    /**
+     * This class holds the counters of a single ring buffer based supply.
+     * Counters are relaxed atomics which may be updated by producer and consumer
+     * threads while another thread takes snapshots. Waits are only timed when a
+     * thread actually has to wait, so the fast path costs one atomic increment.
+     *
+     * @date 10/18/2026
+     */
+    class SupplyCounters {
+
+    public:
+
+        std::atomic<uint64_t> producerGets {0};
+        std::atomic<uint64_t> producerStalls {0};
+        std::atomic<uint64_t> producerStallNanos {0};
+
+        std::atomic<uint64_t> consumerGets {0};
+        std::atomic<uint64_t> consumerWaits {0};
+        std::atomic<uint64_t> consumerWaitNanos {0};
+
+        std::atomic<uint64_t> fillHistogram[SUPPLY_FILL_BINS];
+
+    private:
+
+        /** Protect rate calculation between snapshots. */
+        std::mutex rateMutex;
+        /** Last sequence seen by previous snapshot. */
+        int64_t prevSequence = -1;
+        /** Time of previous snapshot. */
+        std::chrono::steady_clock::time_point prevTime {std::chrono::steady_clock::now()};
+
+    public:
+
+        SupplyCounters() {
+            for (auto & bin : fillHistogram) bin = 0;
+        }
+
+        SupplyCounters(const SupplyCounters & counters) = delete;
+
+
+        /** Clear all counters. */
+        void clear() {
+            producerGets = 0;
+            producerStalls = 0;
+            producerStallNanos = 0;
+            consumerGets = 0;
+            consumerWaits = 0;
+            consumerWaitNanos = 0;
+            for (auto & bin : fillHistogram) bin = 0;
+        }
+
+
+        /**
+         * Get the nanoseconds elapsed since the given time.
+         * @param start start time.
+         * @return nanoseconds since start.
+         */
+        static uint64_t nanosSince(const std::chrono::steady_clock::time_point & start) {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+        }
+
+
+        /**
+         * Record a producer's wait for a free item.
+         * @param start time producer started waiting.
+         */
+        void addProducerStall(const std::chrono::steady_clock::time_point & start) {
+            producerStalls.fetch_add(1, std::memory_order_relaxed);
+            producerStallNanos.fetch_add(nanosSince(start), std::memory_order_relaxed);
+        }
+
+
+        /**
+         * Record a consumer's wait for a published item.
+         * @param start time consumer started waiting.
+         */
+        void addConsumerWait(const std::chrono::steady_clock::time_point & start) {
+            consumerWaits.fetch_add(1, std::memory_order_relaxed);
+            consumerWaitNanos.fetch_add(nanosSince(start), std::memory_order_relaxed);
+        }
+
+
+        /**
+         * Record a fill level sample in the histogram.
+         * @param percent fill level in percent (0 - 100).
+         */
+        void addFill(uint64_t percent) {
+            uint64_t bin = percent / 10;
+            if (bin >= SUPPLY_FILL_BINS) bin = SUPPLY_FILL_BINS - 1;
+            fillHistogram[bin].fetch_add(1, std::memory_order_relaxed);
+        }
+
+
+        /**
+         * Copy the counters into the given snapshot and calculate the
+         * publishing rate since the previous call.
+         *
+         * @param stats        snapshot to fill.
+         * @param lastSequence sequence of last item published in supply.
+         */
+        void fillSnapshot(supplyStats & stats, int64_t lastSequence) {
+            stats.lastSequence       = lastSequence;
+            stats.producerGets       = producerGets.load(std::memory_order_relaxed);
+            stats.producerStalls     = producerStalls.load(std::memory_order_relaxed);
+            stats.producerStallNanos = producerStallNanos.load(std::memory_order_relaxed);
+            stats.consumerGets       = consumerGets.load(std::memory_order_relaxed);
+            stats.consumerWaits      = consumerWaits.load(std::memory_order_relaxed);
+            stats.consumerWaitNanos  = consumerWaitNanos.load(std::memory_order_relaxed);
+            for (int i = 0; i < SUPPLY_FILL_BINS; i++) {
+                stats.fillHistogram[i] = fillHistogram[i].load(std::memory_order_relaxed);
+            }
+
+            std::lock_guard<std::mutex> lock(rateMutex);
+            auto now = std::chrono::steady_clock::now();
+            double secs = std::chrono::duration<double>(now - prevTime).count();
+            if (secs > 0.) {
+                stats.itemsPerSec = (double)(lastSequence - prevSequence) / secs;
+            }
+            prevSequence = lastSequence;
+            prevTime = now;
+        }
+    };
+
+
+    /**
+     * Print the given supply snapshot on a single line.
+     * @param stats snapshot to print.
+     * @param fp    file to print to (e.g. stderr).
+     */
+    static void printSupplyStats(const supplyStats & stats, FILE *fp) {
+        double stallMs = stats.producerStallNanos / 1.e6;
+        double waitMs  = stats.consumerWaitNanos / 1.e6;
+
+        fprintf(fp, "%s: ring %" PRIu32 ", fill %" PRIu64 "%%, lag %" PRId64 ", %.1f items/s, "
+                    "prod gets %" PRIu64 " stalls %" PRIu64 " (%.3f ms), "
+                    "cons gets %" PRIu64 " waits %" PRIu64 " (%.3f ms), fill hist",
+                stats.name.c_str(), stats.ringSize, stats.fillLevel, stats.consumerLag,
+                stats.itemsPerSec,
+                stats.producerGets, stats.producerStalls, stallMs,
+                stats.consumerGets, stats.consumerWaits, waitMs);
+
+        for (int i = 0; i < SUPPLY_FILL_BINS; i++) {
+            fprintf(fp, " %" PRIu64, stats.fillHistogram[i]);
+        }
+        if (stats.remoteAccessRatio >= 0.) {
+            fprintf(fp, ", remote %.1f%%", 100. * stats.remoteAccessRatio);
+        }
+        fprintf(fp, "\n");
+    }
+
+
+    /**
+     * This class collects snapshots from any number of named supplies and
+     * can dump them periodically from its own thread, or on demand.
+     * A pipeline registers each of its rings once and the monitor shows which one
+     * is full (producer stalls, high fill) and which is starved (consumer waits).<p>
+     *
+     * Supplier and SupplierN count their own producer stalls and consumer waits.
+     * For supplies whose code is compiled elsewhere (BufferSupply, evio::RecordSupply)
+     * use {@link #addSampled}, in which case fill level and rate are sampled
+     * by the monitor at each snapshot. NumaBufferSupply has its own getStats().<p>
+     *
+     * Supplies bound to a NUMA node also report the fraction of their pages found on
+     * other nodes. Finding it walks every page of the ring, which is done by the
+     * monitor's thread, so keep the period at a second or so for very large rings.
+     *
+     * @date 10/18/2026
+     */
+    class SupplyMonitor {
+
+    private:
+
+        /** Protect list of supplies. */
+        std::mutex listMutex;
+
+        /** Named functions, each returning a snapshot of one supply. */
+        std::vector<std::pair<std::string, std::function<supplyStats()>>> sources;
+
+        /** Milliseconds between dumps. */
+        uint32_t periodMillis;
+
+        /** Where to dump snapshots. */
+        FILE *out;
+
+        /** Thread doing periodic dumps. */
+        std::thread dumpThread;
+
+        /** Used to end dumping thread quickly. */
+        std::mutex runMutex;
+        std::condition_variable runCond;
+        bool running = false;
+
+    public:
+
+        /**
+         * Constructor.
+         * @param periodMillis milliseconds between periodic dumps.
+         * @param out          file to dump to.
+         */
+        explicit SupplyMonitor(uint32_t periodMillis = 1000, FILE *out = stderr) :
+                periodMillis(periodMillis), out(out) {}
+
+        SupplyMonitor(const SupplyMonitor & monitor) = delete;
+
+        ~SupplyMonitor() {stop();}
+
+
+        /**
+         * Register a function that returns a snapshot of a supply.
+         * @param name   name of supply.
+         * @param source function returning a snapshot.
+         */
+        void add(const std::string & name, std::function<supplyStats()> source) {
+            std::lock_guard<std::mutex> lock(listMutex);
+            sources.emplace_back(name, std::move(source));
+        }
+
+
+        /**
+         * Register a Supplier or SupplierN, each of which keeps its own counters.
+         * @param name   name of supply.
+         * @param supply supply to monitor.
+         */
+        template<class S> void addSupplier(const std::string & name, std::shared_ptr<S> supply) {
+            add(name, [supply]() {return supply->getStats();});
+        }
+
+
+        /**
+         * Register a supply which only provides getRingSize(), getFillLevel() and
+         * getLastSequence(), such as BufferSupply or evio::RecordSupply.
+         * The fill level is sampled into a histogram at every snapshot and the
+         * consumer lag is only estimated from it (rounded down to a whole percent).
+         *
+         * @param name   name of supply.
+         * @param supply supply to monitor.
+         */
+        template<class S> void addSampled(const std::string & name, std::shared_ptr<S> supply) {
+            auto counters = std::make_shared<SupplyCounters>();
+            add(name, [supply, counters]() {
+                supplyStats stats;
+                stats.ringSize    = supply->getRingSize();
+                stats.fillLevel   = supply->getFillLevel();
+                // Estimate, getFillLevel() is rounded down to a whole percent
+                stats.consumerLag = (int64_t)(stats.fillLevel * stats.ringSize / 100);
+                counters->addFill(stats.fillLevel);
+                counters->fillSnapshot(stats, supply->getLastSequence());
+                return stats;
+            });
+        }
+
+
+        /**
+         * Take a snapshot of every registered supply.
+         * @return vector of snapshots, in order of registration.
+         */
+        std::vector<supplyStats> snapshot() {
+            std::vector<supplyStats> snaps;
+            std::lock_guard<std::mutex> lock(listMutex);
+            for (auto & src : sources) {
+                supplyStats stats = src.second();
+                stats.name = src.first;
+                snaps.push_back(stats);
+            }
+            return snaps;
+        }
+
+
+        /** Print a snapshot of every registered supply. */
+        void dump() {
+            for (auto & stats : snapshot()) {
+                printSupplyStats(stats, out);
+            }
+            fflush(out);
+        }
+
+
+        /** Start a thread which dumps all supplies every period. */
+        void start() {
+            std::lock_guard<std::mutex> lock(runMutex);
+            if (running) return;
+            running = true;
+
+            dumpThread = std::thread([this]() {
+                std::unique_lock<std::mutex> lock(runMutex);
+                while (running) {
+                    runCond.wait_for(lock, std::chrono::milliseconds(periodMillis));
+                    if (!running) break;
+                    lock.unlock();
+                    dump();
+                    lock.lock();
+                }
+            });
+        }
+
+
+        /** Stop the dumping thread. */
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(runMutex);
+                if (!running) return;
+                running = false;
+            }
+            runCond.notify_all();
+            if (dumpThread.joinable()) dumpThread.join();
+        }
+    };
+
+}
+
+
+#endif // UTIL_SUPPLYSTATS_H
@@ -0,0 +1,459 @@
+//
+// Copyright 2023, Jefferson Science Associates, LLC.
+// Subject to the terms in the LICENSE file found in the top-level directory.
+//
+// EPSCI Group
+// Thomas Jefferson National Accelerator Facility
+// 12000, Jefferson Ave, Newport News, VA 23606
+// (757)-269-7100
+
+
+/**
+ * @file
+ * Contains a thread placement plan built from the topology of the node, to be
+ * used instead of hand written core lists (-cores, -pinRead, -pinBuf, -pinCnt).
+ * The NUMA nodes, SMT siblings and the locality of the network interface
+ * (its NUMA node and the cpus handling its receive queue interrupts) are read
+ * from sysfs and /proc. Threads are then given cpus by role: packet reading
+ * first, on whole cores of the NIC's node away from its interrupts, then
+ * reassembly, sending and compression. SMT siblings are only handed out once
+ * every core has a thread. Any role can still be given an explicit cpu list.
+ */
+#ifndef UTIL_THREADPLACEMENT_H
+#define UTIL_THREADPLACEMENT_H
+
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <algorithm>
+#include <pthread.h>
+
+#ifdef __linux__
+    #include <dirent.h>
+#endif
+
+#include "NumaUtil.h"
+
+
+namespace ejfat {
+
+
+    /** What a thread does, in order of how close to the NIC it should be. */
+    enum threadRole {
+        /** Reads packets from the NIC. */
+        ROLE_READ = 0,
+        /** Reassembles packets into buffers. */
+        ROLE_REASSEMBLE = 1,
+        /** Sends packets out the NIC. */
+        ROLE_SEND = 2,
+        /** Compresses or builds records. */
+        ROLE_COMPRESS = 3,
+        /** Everything else (statistics, control plane, ...). */
+        ROLE_OTHER = 4
+    };
+
+    /** Number of thread roles. */
+    static const int THREAD_ROLES = 5;
+
+
+    /** One hardware thread (logical cpu). */
+    typedef struct cpuTopology_t {
+        /** Logical cpu number. */
+        int cpu = 0;
+        /** NUMA node. */
+        int node = 0;
+        /** Socket. */
+        int package = 0;
+        /** Core id within socket. */
+        int core = 0;
+        /** All logical cpus of this core, including this one. */
+        std::vector<int> siblings;
+        /** Handles interrupts of the NIC? */
+        bool nicIrq = false;
+    } cpuTopology;
+
+
+    /**
+     * Get the name of a thread role.
+     * @param role role.
+     * @return name.
+     */
+    static const char* threadRoleName(threadRole role) {
+        switch (role) {
+            case ROLE_READ:       return "read";
+            case ROLE_REASSEMBLE: return "reassemble";
+            case ROLE_SEND:       return "send";
+            case ROLE_COMPRESS:   return "compress";
+            default:              return "other";
+        }
+    }
+
+
+    /**
+     * Get the cpus allowed to the calling process (respects taskset and cgroups).
+     * @return allowed cpus in increasing order.
+     */
+    static std::vector<int> topoAllowedCpus() {
+        std::vector<int> cpus;
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int i = 0; i < CPU_SETSIZE; i++) {
+                if (CPU_ISSET(i, &set)) cpus.push_back(i);
+            }
+        }
+        if (cpus.empty()) {
+            cpus = numaParseList(numaReadLine("/sys/devices/system/cpu/online"));
+        }
+#endif
+        if (cpus.empty()) cpus.push_back(0);
+        return cpus;
+    }
+
+
+    /**
+     * Get the NUMA node of a network interface.
+     * @param interface name of interface, e.g. "enp193s0f1np1".
+     * @return NUMA node, -1 if unknown (virtual interface or single node host).
+     */
+    static int topoNicNode(const std::string & interface) {
+#ifdef __linux__
+        std::string line = numaReadLine("/sys/class/net/" + interface + "/device/numa_node");
+        if (!line.empty()) return atoi(line.c_str());
+#endif
+        return -1;
+    }
+
+
+    /**
+     * Get the cpus which handle the interrupts of a network interface
+     * (normally one MSI-X vector per receive queue).
+     * @param interface name of interface.
+     * @return cpus in the smp_affinity_list of the interface's irqs.
+     */
+    static std::set<int> topoNicIrqCpus(const std::string & interface) {
+        std::set<int> cpus;
+#ifdef __linux__
+        std::string dirName = "/sys/class/net/" + interface + "/device/msi_irqs";
+        DIR *dir = opendir(dirName.c_str());
+        if (dir == nullptr) return cpus;
+
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != nullptr) {
+            if (ent->d_name[0] < '0' || ent->d_name[0] > '9') continue;
+            std::string list = numaReadLine(std::string("/proc/irq/") + ent->d_name + "/smp_affinity_list");
+            for (int c : numaParseList(list)) cpus.insert(c);
+        }
+        closedir(dir);
+#endif
+        return cpus;
+    }
+
+
+    /**
+     * Plan of which cpus the threads of a program run on.
+     * Typical use:
+     * <pre>
+     *   ThreadPlacement plan("enp193s0f1np1");
+     *   plan.request(ROLE_READ, 1);
+     *   plan.request(ROLE_REASSEMBLE, 4);
+     *   plan.assign();
+     *   plan.printMap();
+     *   ...
+     *   // in each reassembly thread i:
+     *   plan.pinCurrent(ROLE_REASSEMBLE, i);
+     * </pre>
+     */
+    class ThreadPlacement {
+
+    private:
+
+        /** Interface whose locality is used. */
+        std::string interface;
+
+        /** NUMA node of NIC, -1 if unknown. */
+        int nicNode = -1;
+
+        /** Topology of each cpu this process may use. */
+        std::map<int, cpuTopology> cpus;
+
+        /** Number of threads wanted per role. */
+        int wanted[THREAD_ROLES] = {0, 0, 0, 0, 0};
+
+        /** Explicit cpus given for a role (overrides plan). */
+        std::vector<int> given[THREAD_ROLES];
+
+        /** Cpu of each thread per role, after assign(). */
+        std::vector<int> assigned[THREAD_ROLES];
+
+        /** More threads than cpus? */
+        bool oversubscribed = false;
+
+
+    public:
+
+        /**
+         * Constructor. Reads topology of this host.
+         * @param interface network interface the data goes through (empty if none).
+         */
+        explicit ThreadPlacement(const std::string & interface = "") : interface(interface) {
+            discover();
+        }
+
+
+        /**
+         * Say how many threads of a role there will be.
+         * @param role  role.
+         * @param count number of threads.
+         */
+        void request(threadRole role, int count) {
+            wanted[role] = count > 0 ? count : 0;
+        }
+
+
+        /**
+         * Give threads of a role explicit cpus (e.g. from a -cores option),
+         * thread i runs on cpus[i % cpus.size()]. Those cpus are not handed to other roles.
+         * @param role role.
+         * @param list cpu list such as "0-3,8".
+         */
+        void setCpus(threadRole role, const std::string & list) {
+            given[role] = numaParseList(list);
+        }
+
+
+        /**
+         * Make the plan. Roles get cpus in order of role: each takes the next free
+         * whole cores, those on the NIC's node and not handling its interrupts first,
+         * then the NIC's node interrupt cores, then cores on other nodes.
+         * Once all cores are used, SMT siblings follow in the same order,
+         * and if threads still remain, cpus are shared.
+         */
+        void assign() {
+            std::set<int> taken;
+            for (int r = 0; r < THREAD_ROLES; r++) {
+                for (int c : given[r]) taken.insert(c);
+            }
+
+            std::vector<int> order = candidateOrder(taken);
+            if (order.empty()) {
+                // Every cpu given away, so share them
+                order = candidateOrder(std::set<int>());
+            }
+            size_t next = 0;
+            oversubscribed = false;
+
+            for (int r = 0; r < THREAD_ROLES; r++) {
+                assigned[r].clear();
+                for (int i = 0; i < wanted[r]; i++) {
+                    if (!given[r].empty()) {
+                        assigned[r].push_back(given[r][i % given[r].size()]);
+                    }
+                    else if (!order.empty()) {
+                        if (next >= order.size()) oversubscribed = true;
+                        assigned[r].push_back(order[next++ % order.size()]);
+                    }
+                }
+            }
+        }
+
+
+        /**
+         * Get the cpu of a thread.
+         * @param role  role of thread.
+         * @param index index of thread within its role.
+         * @return cpu, -1 if none was assigned.
+         */
+        int cpuOf(threadRole role, int index) const {
+            if (index < 0 || (size_t) index >= assigned[role].size()) return -1;
+            return assigned[role][index];
+        }
+
+
+        /**
+         * Get the cpus of all threads of a role.
+         * @param role role.
+         * @return cpus, one per thread.
+         */
+        const std::vector<int> & cpusOf(threadRole role) const {
+            return assigned[role];
+        }
+
+
+        /**
+         * Pin a thread to its planned cpu.
+         * @param role   role of thread.
+         * @param index  index of thread within its role.
+         * @param thread thread to pin.
+         * @return 0 if OK, else error number.
+         */
+        int pin(threadRole role, int index, pthread_t thread) const {
+            int cpu = cpuOf(role, index);
+            if (cpu < 0) return EINVAL;
+            return pinThreadToCpus(thread, std::vector<int>{cpu});
+        }
+
+
+        /**
+         * Pin the calling thread to its planned cpu.
+         * @param role  role of thread.
+         * @param index index of thread within its role.
+         * @return 0 if OK, else error number.
+         */
+        int pinCurrent(threadRole role, int index) const {
+            return pin(role, index, pthread_self());
+        }
+
+
+        /** @return NUMA node of the NIC, -1 if unknown. */
+        int getNicNode() const {return nicNode;}
+
+        /** @return NUMA node the NIC is on, or 0 if unknown (where to put buffers). */
+        int getDataNode() const {return nicNode >= 0 ? nicNode : 0;}
+
+        /** @return true if there are more threads than cpus. */
+        bool isOversubscribed() const {return oversubscribed;}
+
+        /** @return topology of each usable cpu. */
+        const std::map<int, cpuTopology> & getTopology() const {return cpus;}
+
+
+        /**
+         * Print the topology found.
+         * @param fp file to print to.
+         */
+        void printTopology(FILE *fp = stderr) const {
+            fprintf(fp, "Topology: %zu NUMA node(s), %zu usable cpus", numaNodes().size(), cpus.size());
+            if (!interface.empty()) {
+                fprintf(fp, ", %s on node %d", interface.c_str(), nicNode);
+            }
+            fprintf(fp, "\n");
+
+            for (auto const & entry : cpus) {
+                auto const & t = entry.second;
+                if (t.siblings.empty() || t.siblings[0] != t.cpu) continue;
+                fprintf(fp, "  node %d, socket %d, core %3d: cpus", t.node, t.package, t.core);
+                for (int s : t.siblings) fprintf(fp, " %d", s);
+                if (t.nicIrq) fprintf(fp, " (NIC irq)");
+                fprintf(fp, "\n");
+            }
+        }
+
+
+        /**
+         * Print the plan made by assign().
+         * @param fp file to print to.
+         */
+        void printMap(FILE *fp = stderr) const {
+            fprintf(fp, "Thread placement%s%s:\n", interface.empty() ? "" : " for ", interface.c_str());
+            for (int r = 0; r < THREAD_ROLES; r++) {
+                for (size_t i = 0; i < assigned[r].size(); i++) {
+                    int cpu = assigned[r][i];
+                    auto it = cpus.find(cpu);
+                    int node = it != cpus.end() ? it->second.node : numaNodeOfCpu(cpu);
+                    fprintf(fp, "  %-10s %2zu -> cpu %3d (node %d)%s%s\n", threadRoleName((threadRole) r),
+                            i, cpu, node, given[r].empty() ? "" : " given",
+                            (it != cpus.end() && it->second.nicIrq) ? " NIC irq" : "");
+                }
+            }
+            if (oversubscribed) {
+                fprintf(fp, "  WARNING: more threads than cpus, some share a cpu\n");
+            }
+        }
+
+
+    private:
+
+
+        /** Read topology of all usable cpus. */
+        void discover() {
+            std::vector<int> allowed = topoAllowedCpus();
+            std::set<int> allowedSet(allowed.begin(), allowed.end());
+
+            std::map<int, int> nodeOf;
+            for (int node : numaNodes()) {
+                for (int c : numaNodeCpus(node)) nodeOf[c] = node;
+            }
+
+            std::set<int> irqCpus;
+            if (!interface.empty()) {
+                nicNode = topoNicNode(interface);
+                irqCpus = topoNicIrqCpus(interface);
+            }
+
+            for (int c : allowed) {
+                cpuTopology t;
+                t.cpu = c;
+                t.node = nodeOf.count(c) ? nodeOf[c] : 0;
+                t.nicIrq = irqCpus.count(c) > 0;
+#ifdef __linux__
+                std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(c) + "/topology/";
+                std::string line = numaReadLine(dir + "physical_package_id");
+                t.package = line.empty() ? 0 : atoi(line.c_str());
+                line = numaReadLine(dir + "core_id");
+                t.core = line.empty() ? c : atoi(line.c_str());
+                for (int s : numaParseList(numaReadLine(dir + "thread_siblings_list"))) {
+                    if (allowedSet.count(s)) t.siblings.push_back(s);
+                }
+#endif
+                if (t.siblings.empty()) t.siblings.push_back(c);
+                cpus[c] = t;
+            }
+        }
+
+
+        /**
+         * Order free cpus from best to worst for network threads.
+         * @param taken cpus given explicitly to some role.
+         * @return usable cpus in order.
+         */
+        std::vector<int> candidateOrder(const std::set<int> & taken) const {
+            // Rank of a core: 0 = NIC node, no irq, 1 = NIC node with irq, 2 = other node
+            auto rank = [this](const cpuTopology & t) {
+                bool irq = false;
+                for (int s : t.siblings) {
+                    auto it = cpus.find(s);
+                    if (it != cpus.end() && it->second.nicIrq) irq = true;
+                }
+                if (nicNode < 0 || t.node == nicNode) return irq ? 1 : 0;
+                return 2;
+            };
+
+            // One entry per core: its first free cpu, then the rest as siblings
+            std::vector<std::pair<int, std::vector<int>>> cores;
+            for (auto const & entry : cpus) {
+                auto const & t = entry.second;
+                if (t.siblings[0] != t.cpu) continue;
+                std::vector<int> free;
+                for (int s : t.siblings) {
+                    if (!taken.count(s)) free.push_back(s);
+                }
+                if (!free.empty()) cores.push_back({rank(t), free});
+            }
+            std::stable_sort(cores.begin(), cores.end(),
+                             [](const std::pair<int, std::vector<int>> & a,
+                                const std::pair<int, std::vector<int>> & b) {return a.first < b.first;});
+
+            std::vector<int> order;
+            for (size_t level = 0; ; level++) {
+                bool any = false;
+                for (auto const & core : cores) {
+                    if (level < core.second.size()) {
+                        order.push_back(core.second[level]);
+                        any = true;
+                    }
+                }
+                if (!any) break;
+            }
+            return order;
+        }
+    };
+
+}
+
+
+#endif // UTIL_THREADPLACEMENT_H
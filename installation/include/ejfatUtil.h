@@ -16,12 +16,14 @@
 #include "BufferSupplyItem.h"
 #include "ByteBuffer.h"
 #include "ByteOrder.h"
+#include "NumaUtil.h"
 #include "PacketRefItem.h"
 #include "PacketsItem.h"
 #include "PacketsItemN.h"
 #include "PacketStoreItem.h"
 #include "Supplier.h"
 #include "SupplierN.h"
+#include "SupplyStats.h"
 #include "SupplyItem.h"
 
 
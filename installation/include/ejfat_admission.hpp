@@ -0,0 +1,297 @@
+//
+// Copyright 2023, Jefferson Science Associates, LLC.
+// Subject to the terms in the LICENSE file found in the top-level directory.
+//
+// EPSCI Group
+// Thomas Jefferson National Accelerator Facility
+// 12000, Jefferson Ave, Newport News, VA 23606
+// (757)-269-7100
+
+
+/**
+ * @file Contains admission control for reassembly. When a backend falls behind,
+ * starting a tick which is later thrown away half-built wastes memcpy bandwidth
+ * and buffer space. Instead, on the first packet seen of a tick, AdmissionControl
+ * decides from the fill level of the output supply and from the bytes already
+ * promised to ticks being built whether the tick can be completed. If not, every
+ * packet of that tick is dropped by looking at its RE header only.
+ * As the reassembler builds one buffer per tick and data source, decisions
+ * are made, and budget is reserved, for each (tick, data id) pair.
+ * So overload drops whole ticks with minimal wasted work, and the counters
+ * raise the fill level reported to the load balancer so that it sends less.
+ */
+#ifndef EJFAT_ADMISSION_H
+#define EJFAT_ADMISSION_H
+
+
+#include <cstdio>
+#include <cinttypes>
+#include <vector>
+#include <atomic>
+#include <functional>
+
+#include "ejfat_header.hpp"
+#include "ejfat_probes.hpp"
+
+
+namespace ejfat {
+
+
+    /** Counters of an AdmissionControl, may be read from any thread. */
+    typedef struct admissionStats_t {
+        /** Ticks started. */
+        std::atomic<int64_t> admitted {0};
+        /** Ticks refused. */
+        std::atomic<int64_t> rejected {0};
+        /** Packets dropped since their tick was refused. */
+        std::atomic<int64_t> droppedPackets {0};
+        /** Payload bytes dropped since their tick was refused. */
+        std::atomic<int64_t> droppedBytes {0};
+        /** Ticks admitted but abandoned before completion. */
+        std::atomic<int64_t> abandoned {0};
+        /** Ticks admitted but forgotten, unfinished, when their slot was needed by a newer one. */
+        std::atomic<int64_t> evicted {0};
+    } admissionStats;
+
+
+    /**
+     * Admission control for one reassembly thread. Not thread safe, except for reading counters
+     * and for {@link #getLbFillPercent()}, which is meant for the control plane reporting thread.
+     */
+    class AdmissionControl {
+
+    private:
+
+        /** What was decided for a recent tick. */
+        struct Decision {
+            uint64_t tick = 0;
+            uint32_t length = 0;
+            uint16_t dataId = 0;
+            bool used = false;
+            bool admitted = false;
+        };
+
+        /** Recent decisions, direct mapped by tick / tickPrescale and data id. */
+        std::vector<Decision> decisions;
+
+        /** Difference between consecutive ticks. */
+        uint64_t tickPrescale;
+
+        /** Returns percentage (0-100) of output supply filled. */
+        std::function<uint64_t()> fillLevel;
+
+        /** Refuse new ticks when fill level reaches this percentage. */
+        uint32_t highWater;
+
+        /** Admit new ticks again when fill level drops to this percentage. */
+        uint32_t lowWater;
+
+        /** Max bytes of ticks being built at once. */
+        uint64_t budgetBytes;
+
+        /** Bytes of admitted ticks not yet completed. Only changed by the reassembly thread. */
+        std::atomic<uint64_t> reservedBytes {0};
+
+        /** Are new ticks being refused? Also cleared by the reporting thread. */
+        std::atomic<bool> shedding {false};
+
+        admissionStats stats;
+
+
+    public:
+
+        /**
+         * Constructor.
+         * @param fillLevel    returns percentage of the output supply filled,
+         *                     e.g. [&supply]() {return supply->getFillLevel();}.
+         * @param budgetBytes  max bytes of ticks being built at once (e.g. size of buffer pool).
+         * @param highWater    refuse new ticks at or above this fill percentage.
+         * @param lowWater     admit new ticks again at or below this fill percentage.
+         * @param tickPrescale difference between consecutive ticks.
+         * @param recentTicks  number of recent (tick, data id) decisions remembered (more than
+         *                     the ticks whose packets can be interleaved times the number of sources).
+         */
+        AdmissionControl(std::function<uint64_t()> fillLevel, uint64_t budgetBytes,
+                         uint32_t highWater = 90, uint32_t lowWater = 70,
+                         uint64_t tickPrescale = 1, size_t recentTicks = 256) :
+                decisions(recentTicks > 0 ? recentTicks : 1),
+                tickPrescale(tickPrescale > 0 ? tickPrescale : 1),
+                fillLevel(std::move(fillLevel)),
+                highWater(highWater), lowWater(lowWater < highWater ? lowWater : highWater),
+                budgetBytes(budgetBytes) {}
+
+
+        /**
+         * Decide whether to keep a packet, from its RE header alone.
+         * The first packet seen of a tick from a data source decides for all of
+         * that source's packets of the tick.
+         *
+         * @param reHeader     start of packet's (version 2) RE header.
+         * @param payloadBytes number of data bytes in packet (for counting drops).
+         * @return true if packet is to be reassembled, false if to be dropped.
+         */
+        bool accept(const char* reHeader, uint32_t payloadBytes) {
+            uint64_t tick   = wire::load64(reHeader + wire::RE_TICK);
+            uint32_t length = wire::load32(reHeader + wire::RE_LENGTH);
+            uint16_t dataId = wire::load16(reHeader + wire::RE_DATA_ID);
+
+            Decision & d = slot(tick, dataId);
+            if (!d.used || d.tick != tick || d.dataId != dataId) {
+                // Forget older tick in this slot, if still open
+                if (d.used && d.admitted) {
+                    release(d);
+                    stats.evicted++;
+                }
+                d.tick = tick;
+                d.dataId = dataId;
+                d.length = length;
+                d.used = true;
+                d.admitted = decide(length);
+                if (d.admitted) {
+                    reservedBytes.fetch_add(length, std::memory_order_relaxed);
+                    stats.admitted++;
+                }
+                else {
+                    stats.rejected++;
+                }
+            }
+
+            if (!d.admitted) {
+                stats.droppedPackets++;
+                stats.droppedBytes += payloadBytes;
+            }
+            return d.admitted;
+        }
+
+
+        /**
+         * Tell that a tick from a data source has been fully reassembled and handed on,
+         * freeing its share of the budget.
+         * @param tick   tick completed.
+         * @param dataId data id of source.
+         */
+        void completed(uint64_t tick, uint16_t dataId) {
+            Decision & d = slot(tick, dataId);
+            if (d.used && d.tick == tick && d.dataId == dataId && d.admitted) {
+                release(d);
+            }
+        }
+
+
+        /**
+         * Tell that an admitted tick from a data source was given up on (e.g. packets lost).
+         * @param tick   tick abandoned.
+         * @param dataId data id of source.
+         */
+        void abandoned(uint64_t tick, uint16_t dataId) {
+            Decision & d = slot(tick, dataId);
+            if (d.used && d.tick == tick && d.dataId == dataId && d.admitted) {
+                release(d);
+                stats.abandoned++;
+            }
+        }
+
+
+        /**
+         * Get the fill percentage to report to the load balancer's control plane
+         * (LbControlPlaneClient::update). While ticks are being refused this is 100,
+         * so the load balancer backs off until the backlog clears.
+         * Since backing off means few or no new ticks arrive to re-evaluate shedding,
+         * the low water mark is also checked here. May be called from any one thread
+         * while the reassembly thread runs.
+         * @return fill percentage.
+         */
+        float getLbFillPercent() {
+            uint64_t fill = fillLevel ? fillLevel() : 0;
+            if (fill <= lowWater) {
+                shedding.store(false, std::memory_order_relaxed);
+            }
+
+            bool shed = shedding.load(std::memory_order_relaxed);
+            float percent = 100.F;
+            if (!shed) {
+                uint64_t reserved = reservedBytes.load(std::memory_order_relaxed);
+                float budgetFill = budgetBytes > 0 ? 100.F * reserved / budgetBytes : 0.F;
+                percent = fill > budgetFill ? (float) fill : budgetFill;
+            }
+            EJFAT_PROBE_LB_STATE(percent, shed);
+            return percent;
+        }
+
+
+        /** @return true if new ticks are being refused. */
+        bool isShedding() const {return shedding.load(std::memory_order_relaxed);}
+
+        /** @return bytes of admitted ticks not yet completed. */
+        uint64_t getReservedBytes() const {return reservedBytes.load(std::memory_order_relaxed);}
+
+        /** @return counters. */
+        const admissionStats & getStats() const {return stats;}
+
+
+        /**
+         * Print counters.
+         * @param fp file to print to.
+         */
+        void printStats(FILE *fp = stderr) const {
+            fprintf(fp, "Admission: admitted %" PRId64 ", rejected %" PRId64 ", abandoned %" PRId64
+                        ", evicted %" PRId64 ", dropped %" PRId64 " pkts (%" PRId64 " bytes)%s\n",
+                    stats.admitted.load(), stats.rejected.load(), stats.abandoned.load(), stats.evicted.load(),
+                    stats.droppedPackets.load(), stats.droppedBytes.load(),
+                    isShedding() ? ", shedding" : "");
+        }
+
+
+    private:
+
+
+        /**
+         * Get the decision slot of a tick from a data source. Sources are spread
+         * by an odd multiplier so the same tick of different sources uses different slots.
+         * @param tick   tick.
+         * @param dataId data id of source.
+         * @return slot.
+         */
+        Decision & slot(uint64_t tick, uint16_t dataId) {
+            return decisions[(tick / tickPrescale + dataId * 0x9e3779b1ULL) % decisions.size()];
+        }
+
+
+        /**
+         * Decide whether a new tick can be completed.
+         * @param length total bytes of tick.
+         * @return true to admit it.
+         */
+        bool decide(uint32_t length) {
+            uint64_t fill = fillLevel ? fillLevel() : 0;
+            bool was = shedding.load(std::memory_order_relaxed);
+            bool shed = was;
+            if (shed) {
+                if (fill <= lowWater) shed = false;
+            }
+            else if (fill >= highWater) {
+                shed = true;
+            }
+            // Only write on change so as not to undo a clear by the reporting thread
+            if (shed != was) shedding.store(shed, std::memory_order_relaxed);
+            if (shed) return false;
+
+            // Room in the budget? Always admit one tick so huge ones can get through.
+            uint64_t reserved = reservedBytes.load(std::memory_order_relaxed);
+            return reserved == 0 || reserved + length <= budgetBytes;
+        }
+
+
+        /** Free the budget of an admitted tick. */
+        void release(Decision & d) {
+            uint64_t reserved = reservedBytes.load(std::memory_order_relaxed);
+            reservedBytes.store(reserved - (d.length < reserved ? d.length : reserved), std::memory_order_relaxed);
+            d.admitted = false;
+            // Keep d.used so that any late packets of this tick are dropped, not restarted
+        }
+    };
+
+}
+
+
+#endif // EJFAT_ADMISSION_H
@@ -0,0 +1,327 @@
+//
+// Copyright 2023, Jefferson Science Associates, LLC.
+// Subject to the terms in the LICENSE file found in the top-level directory.
+//
+// EPSCI Group
+// Thomas Jefferson National Accelerator Facility
+// 12000, Jefferson Ave, Newport News, VA 23606
+// (757)-269-7100
+
+
+/**
+ * @file Contains a tee which hands each buffer sent to the load balancer
+ * to a local archive writer as well, without copying it.
+ * The producer fills a BufferSupplyItem and calls ArchiveTee::tee() before
+ * packetizing it. This adds the archive to the item's users, so the supply recycles
+ * it only after the network sender(s) and the archive thread have all released it.
+ * Since the archive releases items whenever it is done with them, the supply must
+ * not have been created with orderedRelease = true.
+ * The archive side has its own bounded queue and policy: by default a full queue
+ * drops the buffer from the archive (counted).<p>
+ *
+ * The supply only reuses ring items past a contiguous run of released ones, so an item
+ * held by a slow archive stops the ring from advancing and the sender waits in get().
+ * With the DROP policy the item is therefore only shared while the archive is idle;
+ * once it lags (is writing or has a queue), the data is copied into an archive-owned
+ * buffer and the item is left to the network alone. The archive then holds at most one
+ * ring item, and the sender only waits on disk if writing one buffer takes longer than
+ * the network takes to go through the rest of the ring. With BLOCK, items are always
+ * shared, and the network waits for the archive both in tee() and in get().
+ */
+#ifndef EJFAT_ARCHIVE_TEE_H
+#define EJFAT_ARCHIVE_TEE_H
+
+
+#include <cstdio>
+#include <cinttypes>
+#include <string>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <stdexcept>
+#include <condition_variable>
+
+#include "BufferSupply.h"
+#include "BufferSupplyItem.h"
+
+
+namespace ejfat {
+
+
+    /** Counters of an ArchiveTee. */
+    typedef struct archiveTeeStats_t {
+        /** Buffers handed to tee(). */
+        std::atomic<int64_t> teed {0};
+        /** Buffers copied since the archive was lagging. */
+        std::atomic<int64_t> copied {0};
+        /** Buffers written by sink. */
+        std::atomic<int64_t> written {0};
+        /** Bytes written by sink. */
+        std::atomic<int64_t> bytes {0};
+        /** Buffers not archived because the queue was full. */
+        std::atomic<int64_t> dropped {0};
+        /** Buffers the sink failed to write. */
+        std::atomic<int64_t> errors {0};
+    } archiveTeeStats;
+
+
+    /**
+     * Tee of a stream of BufferSupplyItems to an archive sink running in its own thread.
+     */
+    class ArchiveTee {
+
+    public:
+
+        /** What tee() does when the archive queue is full. */
+        enum fullPolicy {
+            /** Don't archive this buffer, count it as dropped (network never waits). */
+            DROP = 0,
+            /** Wait for room in the queue (archive never loses data). */
+            BLOCK = 1
+        };
+
+        /**
+         * Archive sink. Gets the data, its length in bytes, and the tick.
+         * Throws or returns false on error.
+         */
+        typedef std::function<bool(uint8_t*, uint32_t, uint64_t)> Sink;
+
+    private:
+
+        /** Queued buffer, either a shared supply item or a copy of its data. */
+        struct Entry {
+            std::shared_ptr<BufferSupplyItem> item;
+            std::vector<uint8_t> copy;
+            uint64_t tick;
+        };
+
+        /** Supply the items come from and are released to. */
+        std::shared_ptr<BufferSupply> supply;
+
+        /** Writes buffers to archive. */
+        Sink sink;
+
+        /** Max number of buffers waiting for the archive. */
+        size_t depth;
+
+        /** What to do when queue is full. */
+        fullPolicy policy;
+
+        /** Buffers waiting for the archive. */
+        std::deque<Entry> queue;
+
+        /** Copy buffers no longer used, kept to avoid reallocating. */
+        std::vector<std::vector<uint8_t>> spares;
+
+        /** Is the archive thread writing a buffer? */
+        bool busy = false;
+
+        std::mutex mtx;
+        std::condition_variable notEmpty;
+        std::condition_variable notFull;
+
+        /** Archive thread. */
+        std::thread thd;
+
+        /** Stop archive thread once queue is empty. */
+        bool stopping = false;
+
+        archiveTeeStats stats;
+
+
+    public:
+
+        /**
+         * Constructor. Starts archive thread.
+         * @param supply supply the teed items come from.
+         * @param sink   writes one buffer to the archive.
+         * @param depth  max number of buffers waiting for the archive.
+         *               Must be less than the supply's ring size.
+         * @param policy what to do when the queue is full.
+         * @throws std::runtime_error if supply requires items to be released in order.
+         */
+        ArchiveTee(std::shared_ptr<BufferSupply> supply, Sink sink,
+                   size_t depth = 64, fullPolicy policy = DROP) :
+                supply(std::move(supply)), sink(std::move(sink)),
+                depth(depth > 0 ? depth : 1), policy(policy) {
+
+            // Archive and network releases interleave, so items are released out of order
+            if (this->supply->isOrderedRelease()) {
+                throw std::runtime_error("archive tee cannot use a supply with ordered release");
+            }
+            thd = std::thread([this]() {this->run();});
+        }
+
+        /** Destructor. Archives what's queued, then stops thread. */
+        ~ArchiveTee() {
+            stop();
+        }
+
+        ArchiveTee(const ArchiveTee&) = delete;
+        ArchiveTee& operator=(const ArchiveTee&) = delete;
+
+
+        /**
+         * Make a sink which adds each buffer as an event to an evio/HIPO writer
+         * such as WriterMT or Writer (anything with addEvent(uint8_t*, uint32_t, uint32_t)).
+         * The writer must outlive the tee.
+         *
+         * @param writer open writer.
+         * @return sink.
+         */
+        template<class W>
+        static Sink writerSink(W & writer) {
+            return [&writer](uint8_t* data, uint32_t len, uint64_t /*tick*/) {
+                writer.addEvent(data, 0, len);
+                return true;
+            };
+        }
+
+
+        /**
+         * Hand a filled item to the archive as well as to the network.
+         * Must be called before the item is given to the network sender(s),
+         * which then call supply->release(item) as usual when done.
+         * Any users already set on the item (e.g. several senders) are kept.
+         * The item's buffer limit must give the number of valid bytes.
+         * With the DROP policy, the data is copied if the archive is lagging.
+         *
+         * @param item filled item.
+         * @param tick tick of buffer.
+         * @return true if queued for archive, false if dropped.
+         */
+        bool tee(std::shared_ptr<BufferSupplyItem> & item, uint64_t tick) {
+            stats.teed++;
+            std::unique_lock<std::mutex> lock(mtx);
+            if (queue.size() >= depth && policy == BLOCK) {
+                notFull.wait(lock, [this]() {return queue.size() < depth || stopping;});
+            }
+
+            if (queue.size() >= depth || stopping) {
+                stats.dropped++;
+                return false;
+            }
+
+            Entry entry;
+            entry.tick = tick;
+            if (policy == BLOCK || (queue.empty() && !busy)) {
+                // Add the archive to the users set by the producer. Not addUsers(1): for an item
+                // with a single user it doesn't turn on counting, so the first release would recycle it.
+                // No one else has the item yet, so this is not racing any release.
+                item->setUsers(item->getUsers() + 1);
+                entry.item = item;
+            }
+            else {
+                // Archive is lagging, don't let it hold up the ring
+                auto buf = item->getBuffer();
+                if (!spares.empty()) {
+                    entry.copy = std::move(spares.back());
+                    spares.pop_back();
+                }
+                entry.copy.assign(buf->array(), buf->array() + buf->limit());
+                stats.copied++;
+            }
+
+            queue.push_back(std::move(entry));
+            notEmpty.notify_one();
+            return true;
+        }
+
+
+        /** Archive what's queued, then stop archive thread. */
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                stopping = true;
+            }
+            notEmpty.notify_all();
+            notFull.notify_all();
+            if (thd.joinable()) thd.join();
+        }
+
+
+        /** @return number of buffers waiting for archive. */
+        size_t getQueued() {
+            std::lock_guard<std::mutex> lock(mtx);
+            return queue.size();
+        }
+
+        /** @return counters. */
+        const archiveTeeStats & getStats() const {return stats;}
+
+
+        /**
+         * Print counters.
+         * @param fp file to print to.
+         */
+        void printStats(FILE *fp = stderr) const {
+            fprintf(fp, "Archive tee: teed %" PRId64 ", copied %" PRId64 ", written %" PRId64 " (%" PRId64
+                        " bytes), dropped %" PRId64 ", errors %" PRId64 "\n",
+                    stats.teed.load(), stats.copied.load(), stats.written.load(), stats.bytes.load(),
+                    stats.dropped.load(), stats.errors.load());
+        }
+
+
+    private:
+
+
+        /** Archive thread: write each queued buffer and release it. */
+        void run() {
+            while (true) {
+                Entry entry;
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    notEmpty.wait(lock, [this]() {return !queue.empty() || stopping;});
+                    if (queue.empty()) return;
+                    entry = std::move(queue.front());
+                    queue.pop_front();
+                    busy = true;
+                }
+                notFull.notify_one();
+
+                uint8_t *data;
+                uint32_t len;
+                if (entry.item) {
+                    auto buf = entry.item->getBuffer();
+                    data = buf->array();
+                    len = (uint32_t) buf->limit();
+                }
+                else {
+                    data = entry.copy.data();
+                    len = (uint32_t) entry.copy.size();
+                }
+
+                bool ok;
+                try {
+                    ok = sink(data, len, entry.tick);
+                }
+                catch (std::exception & e) {
+                    fprintf(stderr, "Archive tee: %s\n", e.what());
+                    ok = false;
+                }
+
+                if (ok) {
+                    stats.written++;
+                    stats.bytes += len;
+                }
+                else {
+                    stats.errors++;
+                }
+
+                if (entry.item) supply->release(entry.item);
+
+                std::lock_guard<std::mutex> lock(mtx);
+                if (!entry.item && spares.size() < depth) spares.push_back(std::move(entry.copy));
+                busy = false;
+            }
+        }
+    };
+
+}
+
+
+#endif // EJFAT_ARCHIVE_TEE_H
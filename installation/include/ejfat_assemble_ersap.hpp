@@ -41,6 +41,9 @@
 #include <sys/ioctl.h>
 #include <arpa/inet.h>
 
+#include "ejfat_header.hpp"
+#include "ejfat_probes.hpp"
+
 
 #ifdef __APPLE__
 #include <cctype>
@@ -60,9 +63,6 @@
     #ifndef _GNU_SOURCE
         #define _GNU_SOURCE
     #endif
-
-    #define htonll(x) ((1==htonl(1)) ? (x) : (((uint64_t)htonl((x) & 0xFFFFFFFFUL)) << 32) | htonl((uint32_t)((x) >> 32)))
-    #define ntohll(x) ((1==ntohl(1)) ? (x) : (((uint64_t)ntohl((x) & 0xFFFFFFFFUL)) << 32) | ntohl((uint32_t)((x) >> 32)))
 #endif
 
 
@@ -80,23 +80,6 @@ extern int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
 #endif
 
 
-#ifndef EJFAT_BYTESWAP_H
-#define EJFAT_BYTESWAP_H
-
-static inline uint16_t bswap_16(uint16_t x) {
-    return (x>>8) | (x<<8);
-}
-
-static inline uint32_t bswap_32(uint32_t x) {
-    return (bswap_16(x&0xffff)<<16) | (bswap_16(x>>16));
-}
-
-static inline uint64_t bswap_64(uint64_t x) {
-    return (((uint64_t)bswap_32(x&0xffffffffull))<<32) |
-           (bswap_32(x>>32));
-}
-#endif
-
     namespace ejfat {
 
         enum errorCodes {
@@ -113,17 +96,6 @@ static inline uint64_t bswap_64(uint64_t x) {
         };
 
 
-        // Structure to hold reassembly header info
-        typedef struct reHeader_t {
-            uint8_t  version  = 2;
-            int      reserved = 0; // use 8 of 12 bytes for testing for now
-            uint16_t dataId;
-            uint32_t offset;
-            uint32_t length;
-            uint64_t tick;
-        } reHeader;
-
-
         /**
          * Structure able to hold stats of packet-related quantities for receiving.
          * The contained info relates to the reading/reassembly of a complete buffer.
@@ -357,14 +329,15 @@ static inline uint64_t bswap_64(uint64_t x) {
         {
             *ll = buffer[0];
             *bb = buffer[1];
-            if ((*ll != 'L') || (*bb != 'B')) {
+            lbHeader hdr;
+            if (!wire::decodeLb(buffer, &hdr)) {
                 throw std::runtime_error("ersap pkt does not start with 'LB'");
             }
 
-            *version  = ((uint32_t)buffer[2] & 0xff);
-            *protocol = ((uint32_t)buffer[3] & 0xff);
-            *entropy  = ntohs(*((uint16_t *)(&buffer[6]))) & 0xffff;
-            *tick     = ntohll(*((uint64_t *)(&buffer[8])));
+            *version  = hdr.version;
+            *protocol = hdr.protocol;
+            *entropy  = hdr.entropy;
+            *tick     = hdr.tick;
         }
 
 
@@ -389,10 +362,12 @@ static inline uint64_t bswap_64(uint64_t x) {
             *ll = (int)buffer[0];
             *bb = (int)buffer[1];
 
-            *version  = ((uint32_t)buffer[2] & 0xff);
-            *protocol = ((uint32_t)buffer[3] & 0xff);
-            *entropy  = ntohs(*((uint16_t *)(&buffer[6]))) & 0xffff;
-            *tick     = ntohll(*((uint64_t *)(&buffer[8])));
+            lbHeader hdr;
+            wire::decodeLb(buffer, &hdr);
+            *version  = hdr.version;
+            *protocol = hdr.protocol;
+            *entropy  = hdr.entropy;
+            *tick     = hdr.tick;
         }
 
 
@@ -435,14 +410,7 @@ static inline uint64_t bswap_64(uint64_t x) {
                                   uint16_t* dataId, uint32_t* sequence,
                                   uint64_t *tick)
         {
-            // Now pull out the component values
-            *version = (buffer[0] >> 4) & 0xf;
-            *first   = (buffer[1] & 0x02) >> 1;
-            *last    =  buffer[1] & 0x01;
-
-            *dataId   = ntohs(*((uint16_t *) (buffer + 2)));
-            *sequence = ntohl(*((uint32_t *) (buffer + 4)));
-            *tick     = ntohll(*((uint64_t *) (buffer + 8)));
+            wire::decodeReOld(buffer, version, first, last, dataId, sequence, tick);
         }
 
 
@@ -479,12 +447,13 @@ static inline uint64_t bswap_64(uint64_t x) {
         static void parseReHeader(const char* buffer, int* version, uint16_t* dataId,
                                   uint32_t* offset, uint32_t* length, uint64_t *tick)
         {
-            // Now pull out the component values
-            *version = (buffer[0] >> 4) & 0xf;
-            *dataId  = ntohs(*((uint16_t *)  (buffer + 2)));
-            *offset  = ntohl(*((uint32_t *)  (buffer + 4)));
-            *length  = ntohl(*((uint32_t *)  (buffer + 8)));
-            *tick    = ntohll(*((uint64_t *) (buffer + 12)));
+            reHeader hdr;
+            wire::decodeRe(buffer, &hdr);
+            *version = hdr.version;
+            *dataId  = hdr.dataId;
+            *offset  = hdr.offset;
+            *length  = hdr.length;
+            *tick    = hdr.tick;
         }
 
 
@@ -518,14 +487,8 @@ static inline uint64_t bswap_64(uint64_t x) {
          */
         static void parseReHeader(const char* buffer, reHeader* header)
         {
-            // Now pull out the component values
             if (header != nullptr) {
-                header->version  =                       (buffer[0] >> 4) & 0xf;
-                header->reserved =                        buffer[1] & 0xff;
-                header->dataId   = ntohs(*((uint16_t *)  (buffer + 2)));
-                header->offset   = ntohl(*((uint32_t *)  (buffer + 4)));
-                header->length   = ntohl(*((uint32_t *)  (buffer + 8)));
-                header->tick     = ntohll(*((uint64_t *) (buffer + 12)));
+                wire::decodeRe(buffer, header);
             }
         }
 
@@ -560,9 +523,9 @@ static inline uint64_t bswap_64(uint64_t x) {
         */
         static void parseReHeader(const char* buffer, uint32_t* offset, uint32_t *length, uint64_t *tick)
         {
-            *offset = ntohl(*((uint32_t *)  (buffer + 4)));
-            *length = ntohl(*((uint32_t *)  (buffer + 8)));
-            *tick   = ntohll(*((uint64_t *) (buffer + 12)));
+            *offset = wire::load32(buffer + wire::RE_OFFSET);
+            *length = wire::load32(buffer + wire::RE_LENGTH);
+            *tick   = wire::load64(buffer + wire::RE_TICK);
         }
 
 
@@ -599,11 +562,11 @@ static inline uint64_t bswap_64(uint64_t x) {
         {
             if (intArray != nullptr && arraySize > 4) {
                 intArray[0] = (buffer[0] >> 4) & 0xf;  // version
-                intArray[1] = ntohs(*((uint16_t *) (buffer + 2))); // data ID
-                intArray[2] = ntohl(*((uint32_t *) (buffer + 4))); // offset
-                intArray[3] = ntohl(*((uint32_t *) (buffer + 8))); // length
+                intArray[1] = wire::load16(buffer + wire::RE_DATA_ID);
+                intArray[2] = wire::load32(buffer + wire::RE_OFFSET);
+                intArray[3] = wire::load32(buffer + wire::RE_LENGTH);
             }
-            *tick = ntohll(*((uint64_t *) (buffer + 12)));
+            *tick = wire::load64(buffer + wire::RE_TICK);
         }
 
         /**
@@ -619,12 +582,12 @@ static inline uint64_t bswap_64(uint64_t x) {
          */
         static void parseReHeaderFast(const char* buffer, uint32_t* intArray, int index, uint64_t *tick)
         {
-            intArray[index]     = ntohl(*((uint32_t *) (buffer + 4))); // offset
-            intArray[index + 1] = ntohl(*((uint32_t *) (buffer + 8))); // length
+            intArray[index]     = wire::load32(buffer + wire::RE_OFFSET);
+            intArray[index + 1] = wire::load32(buffer + wire::RE_LENGTH);
 
-            *tick = ntohll(*((uint64_t *) (buffer + 12)));
+            *tick = wire::load64(buffer + wire::RE_TICK);
             // store tick for later
-            *((uint64_t *) (&(intArray[index + 2]))) = *tick;
+            std::memcpy(&intArray[index + 2], tick, sizeof(uint64_t));
         }
 
 
@@ -865,6 +828,7 @@ static inline uint64_t bswap_64(uint64_t x) {
                 prevLength = length;
                 prevTotalPkts = totalPkts;
                 parseReHeader(pkt, &version, &packetDataId, &offset, &length, &packetTick);
+                EJFAT_PROBE_PACKET_RECV(packetTick, packetDataId, offset, dataBytes);
                 if (veryFirstRead) {
                     // record data id of first packet of buffer
                     srcId = packetDataId;
@@ -922,6 +886,8 @@ static inline uint64_t bswap_64(uint64_t x) {
                         dumpTick = true;
                         prevTick = packetTick;
 
+                        EJFAT_PROBE_TICK_DISCARD(packetTick, packetDataId, length);
+
                         // Stats. Guess at # of packets.
                         discardedPackets += totalPkts;
                         discardedBytes += length;
@@ -934,6 +900,7 @@ static inline uint64_t bswap_64(uint64_t x) {
                         // The last tick's buffer was not fully contructed
                         // before this new tick showed up!
                         if (debug) fprintf(stderr, "Discard tick %" PRIu64 "\n", prevTick);
+                        EJFAT_PROBE_TICK_DISCARD(prevTick, srcId, prevLength);
 
                         pktCount = 0;
                         totalBytesRead = 0;
@@ -949,6 +916,7 @@ static inline uint64_t bswap_64(uint64_t x) {
                     // There's a chance we can construct a full buffer.
                     // Overwrite everything we saved from previous tick.
                     dumpTick = false;
+                    EJFAT_PROBE_TICK_START(packetTick, packetDataId, length);
                 }
                 else if (dumpTick) {
                     // Same as last tick.
@@ -977,6 +945,7 @@ static inline uint64_t bswap_64(uint64_t x) {
                 // If we've written all data to this buf ...
                 if (totalBytesRead >= length) {
                     // Done
+                    EJFAT_PROBE_TICK_COMPLETE(packetTick, packetDataId, totalBytesRead);
                     *tick = packetTick;
                     if (dataId != nullptr) *dataId = packetDataId;
 
@@ -1174,6 +1143,7 @@ static inline uint64_t bswap_64(uint64_t x) {
                 prevLength = length;
                 prevTotalPkts = totalPkts;
                 parseReHeader(pkt, &version, &packetDataId, &offset, &length, &packetTick);
+                EJFAT_PROBE_PACKET_RECV(packetTick, packetDataId, offset, dataBytes);
                 if (veryFirstRead) {
                     // record data id of first packet of buffer
                     srcId = packetDataId;
@@ -1231,6 +1201,8 @@ static inline uint64_t bswap_64(uint64_t x) {
                         dumpTick = true;
                         prevTick = packetTick;
 
+                        EJFAT_PROBE_TICK_DISCARD(packetTick, packetDataId, length);
+
                         // Stats. Guess at # of packets.
                         discardedPackets += totalPkts;
                         discardedBytes += length;
@@ -1243,6 +1215,7 @@ static inline uint64_t bswap_64(uint64_t x) {
                         // The last tick's buffer was not fully contructed
                         // before this new tick showed up!
                         if (debug) fprintf(stderr, "Discard tick %" PRIu64 "\n", prevTick);
+                        EJFAT_PROBE_TICK_DISCARD(prevTick, srcId, prevLength);
 
                         pktCount = 0;
                         totalBytesRead = 0;
@@ -1258,6 +1231,7 @@ static inline uint64_t bswap_64(uint64_t x) {
                     // There's a chance we can construct a full buffer.
                     // Overwrite everything we saved from previous tick.
                     dumpTick = false;
+                    EJFAT_PROBE_TICK_START(packetTick, packetDataId, length);
                 }
                 else if (dumpTick) {
                     // Same as last tick.
@@ -1296,6 +1270,7 @@ static inline uint64_t bswap_64(uint64_t x) {
                 // If we've written all data to this buf ...
                 if (totalBytesRead >= length) {
                     // Done
+                    EJFAT_PROBE_TICK_COMPLETE(packetTick, packetDataId, totalBytesRead);
                     *tick = packetTick;
                     if (dataId != nullptr) *dataId = packetDataId;
                     *pBufLen = bufLen;
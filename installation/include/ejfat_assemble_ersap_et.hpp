@@ -43,6 +43,7 @@
 
 
 #include "ejfat_assemble_ersap.hpp"
+#include "ejfat_probes.hpp"
 
 
     namespace ejfat {
@@ -191,6 +192,7 @@
                 readDataFrom = packetBuffer + HEADER_BYTES;
 
                 parseReHeader(packetBuffer, &version, &dataId, &bufOffset, &bufLen, &tick);
+                EJFAT_PROBE_PACKET_RECV(tick, dataId, bufOffset, nBytes);
                 if (debug) {
                     fprintf(stderr, "\n\nPkt hdr: ver = %d, dataId = %hu, offset = %u, len = %u, tick = %" PRIu64 ", nBytes = %d\n",
                             version, dataId, bufOffset, bufLen, tick, nBytes);
@@ -275,7 +277,9 @@
                             freeEntries.erase(itt);
                         }
 
+                        EJFAT_PROBE_ET_GET_START(srcIdCount);
                         err = et_fifo_newEntry(fid, entry);
+                        EJFAT_PROBE_ET_GET_DONE(err == ET_OK ? srcIdCount : 0, err);
                         if (err != ET_OK) {
                             throw std::runtime_error(et_perror(err));
                         }
@@ -364,6 +368,11 @@
                                              std::to_string(bufLen) + " bytes");
                 }
 
+                // First packet of this tick from this data source?
+                if (packetCount == 0) {
+                    EJFAT_PROBE_TICK_START(tick, dataId, bufLen);
+                }
+
                 // Copy data into buffer
                 memcpy(buffer + bufOffset, readDataFrom, nBytes);
 
@@ -398,6 +407,7 @@
                 if (packetLast) {
                     // Store in event that buffer is now fully assembled
                     et_fifo_setHasData(event, 1);
+                    EJFAT_PROBE_TICK_COMPLETE(tick, dataId, totalBytesWritten);
 
                     // Has all data in every buffer of this entry been collected?
                     bool tickCompleted = false;
@@ -425,7 +435,8 @@
                         buffers.erase(tick);
 
                         // Put complete array of buffers associated w/ one tick back into ET
-                        et_fifo_putEntry(entry);
+                        err = et_fifo_putEntry(entry);
+                        EJFAT_PROBE_ET_PUT(srcIdCount, err);
 
                         // Put entry back into freeEntries for reuse
                         freeEntries.insert(entry);
@@ -460,16 +471,18 @@
                     // The idea is that any tick < 4 prescales below max Tick need to be removed from maps
                     if (tik + 4 * tickPrescale < biggestTick) {
 //std::cout << "Remove tick " << tik << ", tick + (4*prescale) " << (tik + 4 * tickPrescale) << " < bigT " <<  biggestTick << std::endl;
-                        if (takeStats) {
-                            // Each tick has a component from each incoming data source - update all.
-                            et_event **evs = et_fifo_getBufs(entry);
-                            for (int i=0; i < srcIdCount; i++) {
-                                int id = bufIds[i];
-                                et_event *ev = evs[i];
-                                if (ev != nullptr) {
-                                    et_event_getcontrol(event, con);
-                                    et_event_getlength(event, &totalBytesWritten);
+                        // Each tick has a component from each incoming data source.
+                        // Those not fully reassembled are discarded.
+                        et_event **evs = et_fifo_getBufs(entrie);
+                        for (int i=0; i < srcIdCount; i++) {
+                            int id = bufIds[i];
+                            et_event *ev = evs[i];
+                            if (ev != nullptr && !et_fifo_hasData(ev)) {
+                                et_event_getlength(ev, &totalBytesWritten);
+                                EJFAT_PROBE_TICK_DISCARD(tik, id, totalBytesWritten);
 
+                                if (takeStats) {
+                                    et_event_getcontrol(ev, con);
                                     statMap[id]->discardedBytes += totalBytesWritten;
                                     statMap[id]->discardedBuffers++;
                                     statMap[id]->discardedPackets += con[5];
@@ -483,7 +496,8 @@
                         // Each event in this entry has already been labelled as "having data"
                         // if it's been fully reassembled. So reader of this fifo entry
                         // needs to be aware.
-                        et_fifo_putEntry(entrie);
+                        err = et_fifo_putEntry(entrie);
+                        EJFAT_PROBE_ET_PUT(srcIdCount, err);
 
                         // Put entry back into freeEntries for reuse
                         freeEntries.insert(entrie);
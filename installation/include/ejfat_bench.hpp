@@ -0,0 +1,730 @@
+//
+// Copyright 2023, Jefferson Science Associates, LLC.
+// Subject to the terms in the LICENSE file found in the top-level directory.
+//
+// EPSCI Group
+// Thomas Jefferson National Accelerator Facility
+// 12000, Jefferson Ave, Newport News, VA 23606
+// (757)-269-7100
+
+
+/**
+ * @file Contains microbenchmarks of the hot kernels of the EJFAT and evio headers,
+ * run on realistic inputs: jumbo (9000 byte) packets, ~16 kB CLAS12-like
+ * events, and 1 MB buffers built from them. Each benchmark is timed in batches
+ * long enough to swamp the clock, repeated, and the median time per operation
+ * is reported, either as a table or as one JSON object per line so results can
+ * be stored and compared. Given a stored baseline, benchMain() returns non-zero
+ * if any benchmark got slower than a tolerance, so it can gate a build.
+ * <p>
+ * A benchmark program is just:
+ * <pre>
+ *   #define EJFAT_BENCH_EVIO     // to include the evio kernels (link eviocc, lz4)
+ *   #define EJFAT_BENCH_XMSG     // to include xmsg topic matching (link xmsg)
+ *   #include "ejfat_bench.hpp"
+ *   int main(int argc, char **argv) {return ejfat::bench::benchMain(argc, argv);}
+ * </pre>
+ * linked with ejfat_util, Disruptor and pthread.
+ * <pre>
+ *   ejfat_bench [-json] [-filter name] [-time sec] [-repeat n]
+ *               [-baseline file] [-tolerance percent]
+ * </pre>
+ */
+#ifndef EJFAT_BENCH_H
+#define EJFAT_BENCH_H
+
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <getopt.h>
+#include <sys/socket.h>
+
+#include "ejfat_header.hpp"
+#include "ejfat_packetize.hpp"
+#include "ejfat_crc32c.hpp"
+#include "BufferSupply.h"
+#include "BufferSupplyItem.h"
+#include "ByteBuffer.h"
+
+#ifdef EJFAT_BENCH_EVIO
+    #include "eviocc.h"
+#endif
+
+#ifdef EJFAT_BENCH_XMSG
+    #include "xmsg/topic.h"
+    #include "xmsg/topic_index.h"
+#endif
+
+
+namespace ejfat {
+
+    namespace bench {
+
+
+        /** Result of one benchmark. */
+        typedef struct benchResult_t {
+            /** Name of benchmark. */
+            std::string name;
+            /** Bytes handled per operation (0 if not meaningful). */
+            uint64_t bytesPerOp = 0;
+            /** Operations per timed batch. */
+            uint64_t opsPerBatch = 0;
+            /** Median nanoseconds per operation over batches. */
+            double nsPerOp = 0.;
+            /** Fastest batch, nanoseconds per operation. */
+            double nsPerOpMin = 0.;
+        } benchResult;
+
+
+        /** Keep the compiler from optimizing away a value. */
+        template<class T>
+        inline void keep(T const & value) {
+            asm volatile("" : : "r,m"(value) : "memory");
+        }
+
+
+        /**
+         * Runs benchmarks and collects their results.
+         */
+        class Bench {
+
+        private:
+
+            /** Minimum time of one timed batch in seconds. */
+            double minSeconds;
+
+            /** Number of timed batches. */
+            int repeats;
+
+            /** Only run benchmarks whose name contains this. */
+            std::string filter;
+
+            std::vector<benchResult> results;
+
+            static double secondsOf(std::chrono::steady_clock::duration d) {
+                return std::chrono::duration<double>(d).count();
+            }
+
+        public:
+
+            /**
+             * Constructor.
+             * @param minSeconds minimum time of one timed batch in seconds.
+             * @param repeats    number of timed batches, median is reported.
+             * @param filter     only run benchmarks whose name contains this (empty = all).
+             */
+            explicit Bench(double minSeconds = 0.1, int repeats = 5, const std::string & filter = "") :
+                    minSeconds(minSeconds > 0. ? minSeconds : 0.1),
+                    repeats(repeats > 0 ? repeats : 1), filter(filter) {}
+
+
+            /**
+             * Is a benchmark selected by the filter?
+             * @param name name of benchmark.
+             * @return true if it is to be run.
+             */
+            bool wanted(const std::string & name) const {
+                return filter.empty() || name.find(filter) != std::string::npos;
+            }
+
+
+            /**
+             * Run a benchmark given as a batch: ops(n) must do n operations.
+             * @param name       name of benchmark.
+             * @param bytesPerOp bytes handled per operation (0 if not meaningful).
+             * @param ops        does the given number of operations.
+             */
+            template<class F>
+            void runBatch(const std::string & name, uint64_t bytesPerOp, F && ops) {
+                if (!wanted(name)) return;
+
+                // Warm up, then grow the batch until it takes a tenth of the batch time
+                ops(1);
+                uint64_t n = 1;
+                while (true) {
+                    auto t = std::chrono::steady_clock::now();
+                    ops(n);
+                    double s = secondsOf(std::chrono::steady_clock::now() - t);
+                    if (s >= minSeconds / 10. || n >= (1ULL << 40)) {
+                        double scale = s > 0. ? minSeconds / s : 1024.;
+                        if (scale > 1.) n = (uint64_t) (n * scale);
+                        break;
+                    }
+                    n *= 4;
+                }
+                if (n < 1) n = 1;
+
+                std::vector<double> ns;
+                for (int r = 0; r < repeats; r++) {
+                    auto t = std::chrono::steady_clock::now();
+                    ops(n);
+                    ns.push_back(1.e9 * secondsOf(std::chrono::steady_clock::now() - t) / n);
+                }
+                std::sort(ns.begin(), ns.end());
+
+                benchResult res;
+                res.name = name;
+                res.bytesPerOp = bytesPerOp;
+                res.opsPerBatch = n;
+                res.nsPerOp = ns[ns.size() / 2];
+                res.nsPerOpMin = ns[0];
+                results.push_back(res);
+            }
+
+
+            /**
+             * Run a benchmark given as a single operation.
+             * @param name       name of benchmark.
+             * @param bytesPerOp bytes handled per operation (0 if not meaningful).
+             * @param op         does one operation.
+             */
+            template<class F>
+            void run(const std::string & name, uint64_t bytesPerOp, F && op) {
+                runBatch(name, bytesPerOp, [&op](uint64_t n) {
+                    for (uint64_t i = 0; i < n; i++) op();
+                });
+            }
+
+
+            /** @return results so far. */
+            const std::vector<benchResult> & getResults() const {return results;}
+
+
+            /**
+             * Print results as a table.
+             * @param fp file to print to.
+             */
+            void print(FILE *fp = stdout) const {
+                fprintf(fp, "%-34s %12s %12s %12s %10s\n", "benchmark", "ns/op", "min ns/op", "Mops/s", "GB/s");
+                for (auto const & r : results) {
+                    fprintf(fp, "%-34s %12.1f %12.1f %12.3f", r.name.c_str(), r.nsPerOp, r.nsPerOpMin,
+                            r.nsPerOp > 0. ? 1.e3 / r.nsPerOp : 0.);
+                    if (r.bytesPerOp > 0 && r.nsPerOp > 0.) {
+                        fprintf(fp, " %10.2f\n", r.bytesPerOp / r.nsPerOp);
+                    }
+                    else {
+                        fprintf(fp, " %10s\n", "-");
+                    }
+                }
+            }
+
+
+            /**
+             * Print results as one JSON object per line.
+             * @param fp file to print to.
+             */
+            void printJson(FILE *fp = stdout) const {
+                for (auto const & r : results) {
+                    fprintf(fp, "{\"name\":\"%s\",\"ns_per_op\":%.3f,\"ns_per_op_min\":%.3f,"
+                                "\"bytes_per_op\":%" PRIu64 ",\"gb_per_s\":%.4f,\"ops_per_batch\":%" PRIu64 "}\n",
+                            r.name.c_str(), r.nsPerOp, r.nsPerOpMin, r.bytesPerOp,
+                            (r.bytesPerOp > 0 && r.nsPerOp > 0.) ? r.bytesPerOp / r.nsPerOp : 0.,
+                            r.opsPerBatch);
+                }
+            }
+
+
+            /**
+             * Compare results with a baseline written by printJson().
+             * @param fileName  baseline file.
+             * @param tolerance percent a benchmark may be slower before it counts as a regression.
+             * @param fp        file to print comparison to.
+             * @return number of regressions.
+             * @throws std::runtime_error if the baseline cannot be read.
+             */
+            int compare(const std::string & fileName, double tolerance, FILE *fp = stdout) const {
+                FILE *in = fopen(fileName.c_str(), "r");
+                if (in == nullptr) {
+                    throw std::runtime_error("cannot read baseline " + fileName);
+                }
+
+                int regressions = 0;
+                char line[1024], name[256];
+                double base;
+                while (fgets(line, sizeof(line), in) != nullptr) {
+                    if (sscanf(line, "{\"name\":\"%255[^\"]\",\"ns_per_op\":%lf", name, &base) != 2) continue;
+                    for (auto const & r : results) {
+                        if (r.name != name || base <= 0.) continue;
+                        double change = 100. * (r.nsPerOp - base) / base;
+                        bool slower = change > tolerance;
+                        if (slower) regressions++;
+                        fprintf(fp, "%-34s %10.1f -> %10.1f ns/op  %+7.1f%%%s\n",
+                                name, base, r.nsPerOp, change, slower ? "  REGRESSION" : "");
+                    }
+                }
+                fclose(in);
+                return regressions;
+            }
+        };
+
+
+        /** Deterministic pseudo random numbers (xorshift64) so inputs are the same every run. */
+        class Random {
+            uint64_t s;
+        public:
+            explicit Random(uint64_t seed = 0x9E3779B97F4A7C15ULL) : s(seed) {}
+            uint64_t next() {
+                s ^= s << 13;
+                s ^= s >> 7;
+                s ^= s << 17;
+                return s;
+            }
+        };
+
+
+        /** Size of jumbo frame payload. */
+        static const uint32_t JUMBO_BYTES = 9000;
+
+        /** Size of a big reassembled buffer (an aggregated tick). */
+        static const uint32_t BIG_BYTES = 1 << 20;
+
+
+        /**
+         * Make detector-like data: small integers (ADC/TDC values) with noise,
+         * which compress about like real data.
+         * @param bytes number of bytes.
+         * @param rnd   random numbers.
+         * @return data.
+         */
+        static std::vector<uint8_t> detectorData(size_t bytes, Random & rnd) {
+            std::vector<uint8_t> data(bytes);
+            size_t i = 0;
+            for (; i + 4 <= bytes; i += 4) {
+                uint32_t v = (uint32_t) (rnd.next() & 0xfff);
+                memcpy(data.data() + i, &v, 4);
+            }
+            for (; i < bytes; i++) data[i] = (uint8_t) rnd.next();
+            return data;
+        }
+
+
+        /**
+         * Benchmark parsing of RE headers of jumbo packets, one at a time
+         * and in recvmmsg sized batches.
+         * @param bench harness.
+         */
+        static void benchReHeader(Bench & bench) {
+            const int count = 64;
+            uint32_t payload = JUMBO_BYTES - wire::RE_BYTES;
+            std::vector<char> pkts((size_t) count * JUMBO_BYTES);
+            for (int i = 0; i < count; i++) {
+                wire::encodeRe(pkts.data() + (size_t) i * JUMBO_BYTES, i * payload, BIG_BYTES,
+                               1000 + i / 8, 2, (uint16_t) (i % 4));
+            }
+
+            int i = 0;
+            reHeader hdr;
+            bench.run("re_header_parse", 0, [&]() {
+                wire::decodeRe(pkts.data() + (size_t) i * JUMBO_BYTES, &hdr);
+                keep(hdr);
+                if (++i == count) i = 0;
+            });
+
+            struct iovec iov[count];
+            struct mmsghdr msgs[count];
+            memset(msgs, 0, sizeof(msgs));
+            for (int j = 0; j < count; j++) {
+                iov[j].iov_base = pkts.data() + (size_t) j * JUMBO_BYTES;
+                iov[j].iov_len  = JUMBO_BYTES;
+                msgs[j].msg_hdr.msg_iov = &iov[j];
+                msgs[j].msg_hdr.msg_iovlen = 1;
+                msgs[j].msg_len = JUMBO_BYTES;
+            }
+            reHeader hdrs[count];
+            bench.run("re_header_parse_batch64", 0, [&]() {
+                keep(wire::decodeReBatch(msgs, count, 0, hdrs));
+                keep(hdrs[count - 1]);
+            });
+        }
+
+
+        /**
+         * Benchmark writing RE headers, and building whole jumbo packets (header + payload copy).
+         * @param bench harness.
+         */
+        static void benchSetReMetadata(Bench & bench) {
+            Random rnd;
+            std::vector<uint8_t> src = detectorData(BIG_BYTES, rnd);
+            std::vector<char> pkt(JUMBO_BYTES + LB_HEADER_BYTES);
+            uint32_t payload = JUMBO_BYTES - RE_HEADER_BYTES;
+            uint32_t packets = BIG_BYTES / payload;
+
+            uint32_t p = 0;
+            uint64_t tick = 0;
+            bench.run("set_re_metadata", 0, [&]() {
+                setReMetadata(pkt.data(), p * payload, BIG_BYTES, tick, 2, 3);
+                keep(pkt[0]);
+                if (++p == packets) {p = 0; tick++;}
+            });
+
+            p = 0;
+            bench.run("build_jumbo_packet", JUMBO_BYTES, [&]() {
+                setLbMetadata(pkt.data(), tick, 2, 1, 0);
+                setReMetadata(pkt.data() + LB_HEADER_BYTES, p * payload, BIG_BYTES, tick, 2, 3);
+                memcpy(pkt.data() + HEADER_BYTES, src.data() + (size_t) p * payload, payload);
+                keep(pkt[HEADER_BYTES]);
+                if (++p == packets) {p = 0; tick++;}
+            });
+        }
+
+
+        /**
+         * Benchmark CRC32C of a jumbo packet and of a big buffer.
+         * @param bench harness.
+         */
+        static void benchCrc32c(Bench & bench) {
+            Random rnd;
+            std::vector<uint8_t> data = detectorData(BIG_BYTES, rnd);
+
+            bench.run("crc32c_9000", JUMBO_BYTES, [&]() {
+                keep(crc::crc32c(data.data(), JUMBO_BYTES));
+            });
+            bench.run("crc32c_1M", BIG_BYTES, [&]() {
+                keep(crc::crc32c(data.data(), BIG_BYTES));
+            });
+            bench.run("crc32c_1M_software", BIG_BYTES, [&]() {
+                keep(crc::updateSoft(0xffffffff, data.data(), BIG_BYTES));
+            });
+        }
+
+
+        /**
+         * Benchmark Supplier round trips: get, publish, consumerGet, release.
+         * @param bench harness.
+         */
+        static void benchSupplier(Bench & bench) {
+            const int ringSize = 1024;
+
+            if (bench.wanted("supplier_round_trip")) {
+                BufferSupply supply(ringSize, JUMBO_BYTES);
+                bench.run("supplier_round_trip", 0, [&]() {
+                    auto item = supply.get();
+                    supply.publish(item);
+                    auto got = supply.consumerGet();
+                    supply.release(got);
+                });
+            }
+
+            if (bench.wanted("supplier_two_threads")) {
+                // Producer in this thread, consumer in another: the usual pipeline stage.
+                // Supply and consumer live across all batches so only the hand-offs are timed.
+                BufferSupply supply(ringSize, JUMBO_BYTES);
+                std::atomic<uint64_t> consumed {0};
+                std::atomic<bool> stop {false};
+                std::thread consumer([&supply, &consumed, &stop]() {
+                    while (true) {
+                        auto item = supply.consumerGet();
+                        supply.release(item);
+                        if (stop.load(std::memory_order_acquire)) return;
+                        consumed.fetch_add(1, std::memory_order_release);
+                    }
+                });
+
+                uint64_t produced = 0;
+                bench.runBatch("supplier_two_threads", 0, [&](uint64_t n) {
+                    for (uint64_t i = 0; i < n; i++) {
+                        auto item = supply.get();
+                        supply.publish(item);
+                    }
+                    // Batch ends when the consumer has taken everything
+                    produced += n;
+                    while (consumed.load(std::memory_order_acquire) < produced) {
+                        std::this_thread::yield();
+                    }
+                });
+
+                // Wake the consumer with one last item so it sees the stop flag
+                stop.store(true, std::memory_order_release);
+                auto item = supply.get();
+                supply.publish(item);
+                consumer.join();
+            }
+        }
+
+
+        /**
+         * Benchmark ByteBuffer bulk gets of a jumbo packet and of a big buffer.
+         * @param bench harness.
+         */
+        static void benchByteBuffer(Bench & bench) {
+            Random rnd;
+            std::vector<uint8_t> data = detectorData(BIG_BYTES, rnd);
+            ByteBuffer buf(BIG_BYTES);
+            memcpy(buf.array(), data.data(), BIG_BYTES);
+            std::vector<uint8_t> dst(BIG_BYTES);
+
+            bench.run("bytebuffer_get_9000", JUMBO_BYTES, [&]() {
+                buf.position(0);
+                buf.getBytes(dst.data(), JUMBO_BYTES);
+                keep(dst[0]);
+            });
+            bench.run("bytebuffer_get_1M", BIG_BYTES, [&]() {
+                buf.position(0);
+                buf.getBytes(dst.data(), BIG_BYTES);
+                keep(dst[0]);
+            });
+        }
+
+
+#ifdef EJFAT_BENCH_XMSG
+
+        /**
+         * Benchmark finding the subscriptions that accept a message topic among 10k
+         * subscriptions (domain, subject and full topics of 100 detectors with 100
+         * channels each), with a TopicIndex and by testing each with Topic::is_parent.
+         * @param bench harness.
+         */
+        static void benchTopicIndex(Bench & bench) {
+            if (!bench.wanted("topic_")) return;
+
+            const int detectors = 100, channels = 98;
+            std::vector<xmsg::Topic> subs;
+            subs.push_back(xmsg::Topic::raw("data"));
+            for (int d = 0; d < detectors; d++) {
+                std::string det = "data:det" + std::to_string(d);
+                subs.push_back(xmsg::Topic::raw(det));
+                for (int c = 0; c < channels; c++) {
+                    subs.push_back(xmsg::Topic::raw(det + ":ch" + std::to_string(c)));
+                }
+            }
+            for (int i = 0; subs.size() < 10000; i++) {
+                subs.push_back(xmsg::Topic::raw("ctrl:node" + std::to_string(i)));
+            }
+
+            xmsg::TopicIndex<size_t> index;
+            for (size_t i = 0; i < subs.size(); i++) index.add(subs[i], i);
+
+            // Messages to existing channels, to their children, and to no subscriber
+            const int count = 256;
+            Random rnd;
+            std::vector<xmsg::Topic> topics;
+            for (int i = 0; i < count; i++) {
+                std::string t = "data:det" + std::to_string(rnd.next() % detectors) +
+                                ":ch" + std::to_string(rnd.next() % channels);
+                if (i % 4 == 1) t += ":raw";
+                if (i % 4 == 3) t = "mon:node" + std::to_string(i);
+                topics.push_back(xmsg::Topic::raw(t));
+            }
+
+            int i = 0;
+            bench.run("topic_index_match_10k", 0, [&]() {
+                size_t found = 0;
+                index.match(topics[i], [&found](size_t) {found++;});
+                keep(found);
+                if (++i == count) i = 0;
+            });
+
+            i = 0;
+            bench.run("topic_linear_match_10k", 0, [&]() {
+                size_t found = 0;
+                for (auto const & sub : subs) {
+                    if (sub.is_parent(topics[i])) found++;
+                }
+                keep(found);
+                if (++i == count) i = 0;
+            });
+        }
+
+#endif
+
+
+#ifdef EJFAT_BENCH_EVIO
+
+        /**
+         * Make a CLAS12-like evio event in local byte order: a bank of ~12 detector
+         * banks, each a bank of ADC (uint32), TDC (uint16) and hit (float) banks,
+         * about 16 kB in all.
+         * @param rnd random numbers.
+         * @return event as 32 bit words, starting with its bank header.
+         */
+        static std::vector<uint32_t> clas12Event(Random & rnd) {
+            // Bank header: length (words after first), tag(16)|pad(2)|type(6)|num(8)
+            auto header = [](std::vector<uint32_t> & ev, uint16_t tag, uint32_t type, uint8_t num) {
+                size_t pos = ev.size();
+                ev.push_back(0);
+                ev.push_back(((uint32_t) tag << 16) | (type << 8) | num);
+                return pos;
+            };
+            auto close = [](std::vector<uint32_t> & ev, size_t pos) {
+                ev[pos] = (uint32_t) (ev.size() - pos - 1);
+            };
+
+            std::vector<uint32_t> ev;
+            size_t top = header(ev, 1, 0xe, 0);
+            for (uint16_t det = 0; det < 12; det++) {
+                size_t d = header(ev, (uint16_t) (1000 + det), 0xe, (uint8_t) det);
+
+                size_t b = header(ev, (uint16_t) (1000 + det), 0x1, 1);        // ADC
+                for (int i = 0; i < 180; i++) ev.push_back((uint32_t) (rnd.next() & 0xfff));
+                close(ev, b);
+
+                b = header(ev, (uint16_t) (1000 + det), 0x5, 2);              // TDC, even count of shorts
+                for (int i = 0; i < 80; i++) ev.push_back((uint32_t) (rnd.next() & 0x3fff3fff));
+                close(ev, b);
+
+                b = header(ev, (uint16_t) (1000 + det), 0x2, 3);              // hits
+                for (int i = 0; i < 60; i++) {
+                    float f = (float) (rnd.next() & 0xffff) / 64.F;
+                    uint32_t w;
+                    memcpy(&w, &f, 4);
+                    ev.push_back(w);
+                }
+                close(ev, b);
+
+                close(ev, d);
+            }
+            close(ev, top);
+            return ev;
+        }
+
+
+        /**
+         * Benchmark evio kernels on CLAS12-like events.
+         * @param bench harness.
+         */
+        static void benchEvio(Bench & bench) {
+            Random rnd;
+            std::vector<uint32_t> event = clas12Event(rnd);
+            uint32_t eventBytes = (uint32_t) (4 * event.size());
+
+            // Swap an event's contents (local to opposite endian, into a separate buffer)
+            std::vector<uint32_t> swapped(event.size());
+            bench.run("evio_swap_event", eventBytes, [&]() {
+                evio::EvioSwap::swapData(event.data() + 2, 0xe, (uint32_t) event.size() - 2,
+                                         false, swapped.data() + 2);
+                keep(swapped[2]);
+            });
+
+            // Compress a 1 MB record of events
+            std::vector<uint8_t> record;
+            while (record.size() + eventBytes <= BIG_BYTES) {
+                std::vector<uint32_t> ev = clas12Event(rnd);
+                const uint8_t *p = (const uint8_t *) ev.data();
+                record.insert(record.end(), p, p + 4 * ev.size());
+            }
+            int recBytes = (int) record.size();
+            int maxSize = recBytes + recBytes / 255 + 16;
+            std::vector<uint8_t> compressed((size_t) maxSize);
+
+            bench.run("evio_compress_lz4_1M", (uint64_t) recBytes, [&]() {
+                keep(evio::Compressor::compressLZ4(record.data(), 0, recBytes, compressed.data(), 0, maxSize));
+            });
+
+            int cBytes = evio::Compressor::compressLZ4(record.data(), 0, recBytes, compressed.data(), 0, maxSize);
+            std::vector<uint8_t> uncompressed((size_t) recBytes);
+            bench.run("evio_uncompress_lz4_1M", (uint64_t) recBytes, [&]() {
+                keep(evio::Compressor::uncompressLZ4(compressed.data(), 0, cBytes,
+                                                     uncompressed.data(), 0, recBytes));
+            });
+
+            // Scan an event's structure (includes making its node)
+            auto buf = std::make_shared<evio::ByteBuffer>(eventBytes);
+            buf->order(evio::ByteOrder::ENDIAN_LOCAL);
+            memcpy(buf->array(), event.data(), eventBytes);
+            buf->limit(eventBytes);
+            bench.run("evio_scan_structure", eventBytes, [&]() {
+                auto node = evio::EvioNode::extractEventNode(buf, 0, 0, 0);
+                evio::EvioNode::scanStructure(node);
+                keep(node->getChildCount());
+            });
+        }
+
+#endif
+
+
+        /**
+         * Run all benchmarks.
+         * @param bench harness.
+         */
+        static void runAll(Bench & bench) {
+            benchReHeader(bench);
+            benchSetReMetadata(bench);
+            benchCrc32c(bench);
+            benchByteBuffer(bench);
+            benchSupplier(bench);
+#ifdef EJFAT_BENCH_XMSG
+            benchTopicIndex(bench);
+#endif
+#ifdef EJFAT_BENCH_EVIO
+            benchEvio(bench);
+#endif
+        }
+
+
+        /**
+         * Main routine of a benchmark program.
+         * @param argc number of args.
+         * @param argv args.
+         * @return 0 if OK, 1 if regressions were found against a baseline, 2 on error.
+         */
+        static int benchMain(int argc, char **argv) {
+            static struct option longOptions[] = {
+                    {"json",      0, nullptr, 1},
+                    {"filter",    1, nullptr, 2},
+                    {"time",      1, nullptr, 3},
+                    {"repeat",    1, nullptr, 4},
+                    {"baseline",  1, nullptr, 5},
+                    {"tolerance", 1, nullptr, 6},
+                    {"help",      0, nullptr, 7},
+                    {0, 0, 0, 0}
+            };
+
+            bool json = false;
+            std::string filter, baseline;
+            double seconds = 0.1, tolerance = 10.;
+            int repeats = 5, c, i = 0;
+
+            while ((c = getopt_long_only(argc, argv, "", longOptions, &i)) != -1) {
+                switch (c) {
+                    case 1: json = true; break;
+                    case 2: filter = optarg; break;
+                    case 3: seconds = atof(optarg); break;
+                    case 4: repeats = atoi(optarg); break;
+                    case 5: baseline = optarg; break;
+                    case 6: tolerance = atof(optarg); break;
+                    default:
+                        fprintf(stderr, "usage: %s [-json] [-filter name] [-time sec] [-repeat n]\n"
+                                        "          [-baseline file] [-tolerance percent]\n\n"
+                                        "  -json       print one JSON object per benchmark (store as baseline)\n"
+                                        "  -filter     only run benchmarks whose name contains this\n"
+                                        "  -time       seconds per timed batch (default 0.1)\n"
+                                        "  -repeat     number of timed batches, median is used (default 5)\n"
+                                        "  -baseline   compare with JSON output of an earlier run\n"
+                                        "  -tolerance  percent slower than baseline allowed (default 10)\n",
+                                argv[0]);
+                        return c == 7 ? 0 : 2;
+                }
+            }
+
+            Bench bench(seconds, repeats, filter);
+            try {
+                runAll(bench);
+                if (json) bench.printJson(stdout);
+                else      bench.print(stdout);
+
+                if (!baseline.empty()) {
+                    int regressions = bench.compare(baseline, tolerance, json ? stderr : stdout);
+                    return regressions > 0 ? 1 : 0;
+                }
+            }
+            catch (std::exception & e) {
+                fprintf(stderr, "%s\n", e.what());
+                return 2;
+            }
+            return 0;
+        }
+    }
+}
+
+
+#endif // EJFAT_BENCH_H
@@ -0,0 +1,559 @@
+//
+// Copyright 2023, Jefferson Science Associates, LLC.
+// Subject to the terms in the LICENSE file found in the top-level directory.
+//
+// EPSCI Group
+// Thomas Jefferson National Accelerator Facility
+// 12000, Jefferson Ave, Newport News, VA 23606
+// (757)-269-7100
+
+
+/**
+ * @file Contains an optional CRC32C integrity check of each buffer sent through
+ * the load balancer. The sender appends an 8 byte trailer ("CRC1" + CRC32C of the
+ * data, big endian) which travels in the final packet of the tick, so no extra
+ * packet is sent. Each packet of such a buffer has RE_TRAILER_FLAG set in the
+ * reserved field of its RE header, so whether a trailer is there never depends
+ * on the data. After reassembly the receiver hands the buffer to a CrcVerifier,
+ * which checks it in its own thread and counts corrupt or unprotected buffers.
+ * On x86_64 CPUs with SSE4.2 the CRC instruction is run on 3 interleaved streams
+ * to hide its latency, otherwise a table driven (slice by 8) version is used.
+ */
+#ifndef EJFAT_CRC32C_H
+#define EJFAT_CRC32C_H
+
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+
+#if defined(__x86_64__)
+    #include <nmmintrin.h>
+#endif
+
+#include "ejfat_header.hpp"
+#include "ejfat_packetize.hpp"
+
+
+namespace ejfat {
+
+    namespace crc {
+
+        /** CRC32C (Castagnoli) polynomial, reflected. */
+        static const uint32_t POLY = 0x82F63B78;
+
+        /** Bytes in each of the 3 streams run at once by the hardware version. */
+        static const size_t BLOCK = 4096;
+
+        /** Bytes in trailer. */
+        static const uint32_t TRAILER_BYTES = 8;
+
+        /** Start of trailer ("CRC1"). */
+        static const uint32_t TRAILER_MAGIC = 0x43524331;
+
+        /** Bit of the RE header reserved field set when the buffer ends with a trailer. */
+        static const int RE_TRAILER_FLAG = 0x800;
+
+
+        /** Tables for slice by 8 software CRC. */
+        struct SoftTables {
+            uint32_t t[8][256];
+
+            SoftTables() {
+                for (uint32_t i = 0; i < 256; i++) {
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ POLY : c >> 1;
+                    t[0][i] = c;
+                }
+                for (uint32_t i = 0; i < 256; i++) {
+                    for (int j = 1; j < 8; j++) {
+                        t[j][i] = (t[j-1][i] >> 8) ^ t[0][t[j-1][i] & 0xff];
+                    }
+                }
+            }
+        };
+
+
+        /** @return a * b modulo POLY, reflected. */
+        static uint32_t multModP(uint32_t a, uint32_t b) {
+            uint32_t m = 1U << 31, p = 0;
+            while (m != 0) {
+                if (a & m) p ^= b;
+                m >>= 1;
+                b = (b & 1) ? (b >> 1) ^ POLY : b >> 1;
+            }
+            return p;
+        }
+
+
+        /** Tables which advance a CRC register over BLOCK zero bytes. */
+        struct ShiftTables {
+            uint32_t t[4][256];
+
+            ShiftTables() {
+                // x^(8 * BLOCK) mod POLY, by repeated squaring of x^8
+                uint32_t op = 1U << 31;       // x^0
+                uint32_t sq = 1U << 23;       // x^8
+                for (size_t n = BLOCK; n > 0; n >>= 1) {
+                    if (n & 1) op = multModP(op, sq);
+                    sq = multModP(sq, sq);
+                }
+                for (uint32_t i = 0; i < 256; i++) {
+                    for (int j = 0; j < 4; j++) {
+                        t[j][i] = multModP(op, i << (8 * j));
+                    }
+                }
+            }
+
+            uint32_t shift(uint32_t c) const {
+                return t[0][c & 0xff] ^ t[1][(c >> 8) & 0xff] ^ t[2][(c >> 16) & 0xff] ^ t[3][c >> 24];
+            }
+        };
+
+
+        static const SoftTables & softTables() {
+            static const SoftTables tables;
+            return tables;
+        }
+
+        static const ShiftTables & shiftTables() {
+            static const ShiftTables tables;
+            return tables;
+        }
+
+
+        /** Software CRC register update (no pre or post inversion). */
+        static uint32_t updateSoft(uint32_t c, const uint8_t *p, size_t len) {
+            auto const & t = softTables().t;
+            while (len >= 8) {
+                uint32_t lo, hi;
+                memcpy(&lo, p, 4);
+                memcpy(&hi, p + 4, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+                lo = __builtin_bswap32(lo);
+                hi = __builtin_bswap32(hi);
+#endif
+                lo ^= c;
+                c = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+                    t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+                p += 8;
+                len -= 8;
+            }
+            while (len-- > 0) {
+                c = (c >> 8) ^ t[0][(c ^ *p++) & 0xff];
+            }
+            return c;
+        }
+
+
+#if defined(__x86_64__)
+
+        /** Hardware CRC register update of one stream. */
+        __attribute__((target("sse4.2")))
+        static uint32_t updateHw1(uint32_t c, const uint8_t *p, size_t len) {
+            uint64_t c64 = c;
+            while (len >= 8) {
+                uint64_t v;
+                memcpy(&v, p, 8);
+                c64 = _mm_crc32_u64(c64, v);
+                p += 8;
+                len -= 8;
+            }
+            c = (uint32_t) c64;
+            while (len-- > 0) c = _mm_crc32_u8(c, *p++);
+            return c;
+        }
+
+
+        /**
+         * Hardware CRC register update. The crc32 instruction has a latency of 3 cycles
+         * but can start every cycle, so 3 independent streams of BLOCK bytes are run
+         * together and joined with the shift tables.
+         */
+        __attribute__((target("sse4.2")))
+        static uint32_t updateHw(uint32_t c, const uint8_t *p, size_t len) {
+            auto const & shift = shiftTables();
+            while (len >= 3 * BLOCK) {
+                uint64_t c0 = c, c1 = 0, c2 = 0;
+                for (size_t i = 0; i < BLOCK; i += 8) {
+                    uint64_t v0, v1, v2;
+                    memcpy(&v0, p + i, 8);
+                    memcpy(&v1, p + BLOCK + i, 8);
+                    memcpy(&v2, p + 2*BLOCK + i, 8);
+                    c0 = _mm_crc32_u64(c0, v0);
+                    c1 = _mm_crc32_u64(c1, v1);
+                    c2 = _mm_crc32_u64(c2, v2);
+                }
+                c = shift.shift((uint32_t) c0) ^ (uint32_t) c1;
+                c = shift.shift(c) ^ (uint32_t) c2;
+                p += 3 * BLOCK;
+                len -= 3 * BLOCK;
+            }
+            return updateHw1(c, p, len);
+        }
+
+
+        /** @return true if this CPU has the SSE4.2 crc32 instruction. */
+        static bool haveHw() {
+            static const bool have = __builtin_cpu_supports("sse4.2");
+            return have;
+        }
+
+#endif
+
+
+        /**
+         * Continue a CRC32C over more data.
+         * @param crc  CRC of previous data (0 to start).
+         * @param data data.
+         * @param len  number of bytes.
+         * @return CRC32C of previous data followed by this data.
+         */
+        static uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+            const uint8_t *p = (const uint8_t *) data;
+            uint32_t c = ~crc;
+#if defined(__x86_64__)
+            if (haveHw()) return ~updateHw(c, p, len);
+#endif
+            return ~updateSoft(c, p, len);
+        }
+
+
+        /**
+         * Compute the CRC32C of data.
+         * @param data data.
+         * @param len  number of bytes.
+         * @return CRC32C.
+         */
+        static uint32_t crc32c(const void *data, size_t len) {
+            return crc32c(0, data, len);
+        }
+
+
+        /**
+         * Write the trailer of data right after it.
+         * @param data data, with room for TRAILER_BYTES after it.
+         * @param len  number of data bytes.
+         * @return len + TRAILER_BYTES.
+         */
+        static size_t addTrailer(char *data, size_t len) {
+            wire::store32(data + len, TRAILER_MAGIC);
+            wire::store32(data + len + 4, crc32c(data, len));
+            return len + TRAILER_BYTES;
+        }
+
+
+        /** Result of checking a trailer. */
+        enum result {
+            /** Data matches its CRC. */
+            OK = 0,
+            /** Data does not match its CRC. */
+            CORRUPT = 1,
+            /** Buffer was sent without a trailer. */
+            MISSING = 2,
+            /** Not checked (verifier queue full). */
+            UNCHECKED = 3
+        };
+
+
+        /**
+         * Does a packet's RE header say its buffer ends with a trailer?
+         * @param buffer RE header of any packet of the buffer.
+         * @return true if RE_TRAILER_FLAG is set.
+         */
+        static bool hasTrailer(const char *buffer) {
+            reHeader hdr;
+            wire::decodeRe(buffer, &hdr);
+            return (hdr.reserved & RE_TRAILER_FLAG) != 0;
+        }
+
+
+        /**
+         * Check a reassembled buffer.
+         * @param data       reassembled buffer.
+         * @param len        number of bytes in buffer, including any trailer.
+         * @param hasTrailer was the buffer sent with a trailer (RE_TRAILER_FLAG set)?
+         * @param dataLen    if not null, filled with number of data bytes (without trailer).
+         * @return MISSING if sent without a trailer, else OK or CORRUPT
+         *         (also if too short to hold a trailer or the magic is wrong).
+         */
+        static result checkTrailer(const char *data, size_t len, bool hasTrailer, size_t *dataLen = nullptr) {
+            if (dataLen != nullptr) *dataLen = len;
+            if (!hasTrailer) return MISSING;
+            if (len < TRAILER_BYTES) return CORRUPT;
+
+            size_t n = len - TRAILER_BYTES;
+            if (dataLen != nullptr) *dataLen = n;
+            if (wire::load32(data + n) != TRAILER_MAGIC) return CORRUPT;
+            return crc32c(data, n) == wire::load32(data + n + 4) ? OK : CORRUPT;
+        }
+    }
+
+
+    /**
+     * Send a whole buffer, as {@link #sendPacketizedBufferSendNew} does, followed by its
+     * CRC32C trailer. The trailer is put in the final packet along with the end of the
+     * data, so the number of packets only goes up if the last one has no room for it.
+     * The buffer is not changed. The RE header length of the tick is dataLen + 8 and
+     * every packet has crc::RE_TRAILER_FLAG set in its RE header reserved field.
+     * The CRC is computed on the calling thread before the first packet is sent, which
+     * takes an extra pass over the data (at several GB/s with SSE4.2). Where the sending
+     * thread cannot afford that, send the buffer with sendPacketizedBufferSendNew instead;
+     * the receiver counts such buffers as missing a trailer rather than corrupt.
+     *
+     * @param dataBuffer    data to send.
+     * @param dataLen       number of bytes to send.
+     * @param maxUdpPayload max data bytes in one packet (at most 65536 - HEADER_BYTES).
+     * @param clientSocket  connected UDP socket.
+     * @param tick          tick of buffer.
+     * @param protocol      protocol in LB header.
+     * @param entropy       entropy in LB header.
+     * @param version       version in RE header.
+     * @param dataId        data id in RE header.
+     * @param delay         microseconds to wait between packets.
+     * @param delayPrescale wait only once per this many packets.
+     * @param delayCounter  value-result counter of packets for delayPrescale.
+     * @param debug         turn debug printout on & off.
+     * @param direct        don't include LB header since packets go directly to receiver.
+     * @param packetsSent   filled with number of packets sent.
+     * @return 0 if OK, -1 if error when sending packet. Use errno for more details.
+     */
+    static int sendPacketizedBufferCrc(const char* dataBuffer, size_t dataLen, int maxUdpPayload,
+                                       int clientSocket, uint64_t tick, int protocol, int entropy,
+                                       int version, uint16_t dataId,
+                                       uint32_t delay, uint32_t delayPrescale, uint32_t *delayCounter,
+                                       bool debug, bool direct, int64_t *packetsSent) {
+
+        if (maxUdpPayload <= 0 || maxUdpPayload > 65536 - HEADER_BYTES) return -1;
+
+        uint32_t fullLen = (uint32_t) (dataLen + crc::TRAILER_BYTES);
+        uint32_t crcVal  = crc::crc32c(dataBuffer, dataLen);
+
+        // Bytes at the end which go in the final packet with the trailer
+        size_t tail = dataLen % maxUdpPayload;
+        if (tail == 0 && dataLen > 0) tail = maxUdpPayload;
+        if (tail + crc::TRAILER_BYTES > (size_t) maxUdpPayload) tail = 0;
+        size_t head = dataLen - tail;
+
+        uint32_t offset = 0;
+        int64_t packets = 0, total = 0;
+        int err;
+
+        if (head > 0) {
+            // If the first packet is too big, the payload is reduced, and the tail must use that too
+            err = sendPacketizedBufferSendNew(dataBuffer, head, maxUdpPayload, clientSocket,
+                                              tick, protocol, entropy, version, dataId, fullLen,
+                                              &offset, delay, delayPrescale, delayCounter,
+                                              true, false, debug, direct, false, &packets,
+                                              crc::RE_TRAILER_FLAG, nullptr, 0, &maxUdpPayload);
+            total += packets;
+            if (err < 0) {
+                *packetsSent = total;
+                return err;
+            }
+        }
+
+        char last[65536 + crc::TRAILER_BYTES];
+        memcpy(last, dataBuffer + head, tail);
+        wire::store32(last + tail, crc::TRAILER_MAGIC);
+        wire::store32(last + tail + 4, crcVal);
+
+        err = sendPacketizedBufferSendNew(last, tail + crc::TRAILER_BYTES, maxUdpPayload, clientSocket,
+                                          tick, protocol, entropy, version, dataId, fullLen,
+                                          &offset, delay, delayPrescale, delayCounter,
+                                          head == 0, true, debug, direct, false, &packets,
+                                          crc::RE_TRAILER_FLAG, nullptr, 0);
+        total += packets;
+        *packetsSent = total;
+        return err;
+    }
+
+
+    /** Counters of a CrcVerifier. */
+    typedef struct crcStats_t {
+        /** Buffers whose CRC matched. */
+        std::atomic<int64_t> good {0};
+        /** Buffers whose CRC did not match. */
+        std::atomic<int64_t> corrupt {0};
+        /** Buffers sent without a trailer. */
+        std::atomic<int64_t> missing {0};
+        /** Buffers not checked since the queue was full. */
+        std::atomic<int64_t> unchecked {0};
+        /** Bytes checked. */
+        std::atomic<int64_t> bytes {0};
+        /** Nanoseconds spent computing CRCs. */
+        std::atomic<int64_t> nanos {0};
+    } crcStats;
+
+
+    /**
+     * Checks the CRC trailer of reassembled buffers in its own threads,
+     * so the receiving thread only queues them.
+     */
+    class CrcVerifier {
+
+    public:
+
+        /**
+         * Called, in a verifier thread, when a buffer has been checked:
+         * with its tick, data id, number of data bytes (without trailer), result, and
+         * the user pointer given to submit(). Typically passes the buffer on or releases it.
+         */
+        typedef std::function<void(uint64_t, uint16_t, size_t, crc::result, void*)> Done;
+
+    private:
+
+        struct Entry {
+            const char *data;
+            size_t len;
+            bool hasTrailer;
+            uint64_t tick;
+            uint16_t dataId;
+            void *user;
+        };
+
+        Done done;
+        size_t depth;
+
+        std::deque<Entry> queue;
+        std::mutex mtx;
+        std::condition_variable notEmpty;
+        std::vector<std::thread> threads;
+        bool stopping = false;
+
+        crcStats stats;
+
+
+    public:
+
+        /**
+         * Constructor. Starts verifier threads.
+         * @param done     called with the result of each buffer.
+         * @param depth    max number of buffers waiting to be checked.
+         * @param nThreads number of verifier threads.
+         */
+        explicit CrcVerifier(Done done, size_t depth = 64, int nThreads = 1) :
+                done(std::move(done)), depth(depth > 0 ? depth : 1) {
+            if (nThreads < 1) nThreads = 1;
+            for (int i = 0; i < nThreads; i++) {
+                threads.emplace_back([this]() {this->run();});
+            }
+        }
+
+        /** Destructor. Checks what's queued, then stops threads. */
+        ~CrcVerifier() {
+            stop();
+        }
+
+        CrcVerifier(const CrcVerifier&) = delete;
+        CrcVerifier& operator=(const CrcVerifier&) = delete;
+
+
+        /**
+         * Queue a reassembled buffer to be checked. Never blocks: if the queue is full,
+         * done is called right away with UNCHECKED.
+         *
+         * @param data       reassembled buffer, valid until done is called.
+         * @param len        number of bytes in buffer, including any trailer.
+         * @param hasTrailer was RE_TRAILER_FLAG set in the buffer's RE headers
+         *                   (see crc::hasTrailer)?
+         * @param tick       tick of buffer.
+         * @param dataId     data id of buffer.
+         * @param user       passed on to done.
+         * @return true if queued.
+         */
+        bool submit(const char *data, size_t len, bool hasTrailer, uint64_t tick, uint16_t dataId,
+                    void *user = nullptr) {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (queue.size() < depth && !stopping) {
+                    queue.push_back(Entry{data, len, hasTrailer, tick, dataId, user});
+                    notEmpty.notify_one();
+                    return true;
+                }
+            }
+
+            stats.unchecked++;
+            size_t dataLen = hasTrailer && len >= crc::TRAILER_BYTES ? len - crc::TRAILER_BYTES : len;
+            done(tick, dataId, dataLen, crc::UNCHECKED, user);
+            return false;
+        }
+
+
+        /** Check what's queued, then stop threads. */
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                stopping = true;
+            }
+            notEmpty.notify_all();
+            for (auto & t : threads) {
+                if (t.joinable()) t.join();
+            }
+        }
+
+
+        /** @return counters. */
+        const crcStats & getStats() const {return stats;}
+
+
+        /**
+         * Print counters.
+         * @param fp file to print to.
+         */
+        void printStats(FILE *fp = stderr) const {
+            int64_t b = stats.bytes.load(), ns = stats.nanos.load();
+            fprintf(fp, "CRC32C: good %" PRId64 ", corrupt %" PRId64 ", missing %" PRId64
+                        ", unchecked %" PRId64 ", %.2f GB/s per thread\n",
+                    stats.good.load(), stats.corrupt.load(), stats.missing.load(),
+                    stats.unchecked.load(), ns > 0 ? (double) b / ns : 0.);
+        }
+
+
+    private:
+
+
+        /** Verifier thread. */
+        void run() {
+            while (true) {
+                Entry e;
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    notEmpty.wait(lock, [this]() {return !queue.empty() || stopping;});
+                    if (queue.empty()) return;
+                    e = queue.front();
+                    queue.pop_front();
+                }
+
+                size_t dataLen;
+                auto t1 = std::chrono::steady_clock::now();
+                crc::result r = crc::checkTrailer(e.data, e.len, e.hasTrailer, &dataLen);
+                auto t2 = std::chrono::steady_clock::now();
+
+                switch (r) {
+                    case crc::OK:      stats.good++;    break;
+                    case crc::CORRUPT: stats.corrupt++; break;
+                    default:           stats.missing++; break;
+                }
+                if (r != crc::MISSING) {
+                    stats.bytes += (int64_t) dataLen;
+                    stats.nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+                }
+
+                done(e.tick, e.dataId, dataLen, r, e.user);
+            }
+        }
+    };
+
+}
+
+
+#endif // EJFAT_CRC32C_H
@@ -0,0 +1,484 @@
+//
+// Copyright 2023, Jefferson Science Associates, LLC.
+// Subject to the terms in the LICENSE file found in the top-level directory.
+//
+// EPSCI Group
+// Thomas Jefferson National Accelerator Facility
+// 12000, Jefferson Ave, Newport News, VA 23606
+// (757)-269-7100
+
+
+/**
+ * @file Contains a pipelined, multi-threaded bridge which moves events from
+ * a station of one ET system into GRAND_CENTRAL of another ET system.
+ * It replaces the single get/put cycle of et_2_et with several parallel
+ * "lanes", each with its own attachment to the source station and to the
+ * destination system. Each lane gets and creates events in large chunks
+ * while a pool of copier threads moves the data between them, so that
+ * ET calls of one lane overlap with the data copies of another.
+ */
+#ifndef EJFAT_ET_BRIDGE_H
+#define EJFAT_ET_BRIDGE_H
+
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <condition_variable>
+
+#include "et.h"
+#include "ejfat_probes.hpp"
+
+
+namespace ejfat {
+
+
+    /**
+     * Structure able to hold the counters of one stage of the bridge.
+     * Times are the total microseconds threads spent in that stage.
+     */
+    typedef struct etBridgeStageStats_t {
+        std::atomic<uint64_t> events {0};  /**< Number of events passing through stage. */
+        std::atomic<uint64_t> bytes  {0};  /**< Number of data bytes passing through stage. */
+        std::atomic<uint64_t> micros {0};  /**< Microseconds spent in stage. */
+    } etBridgeStageStats;
+
+
+    /**
+     * This class moves events between 2 ET systems using several lanes in parallel.
+     * Each lane:
+     * <ol>
+     * <li>gets a chunk of events from its attachment to the source station,</li>
+     * <li>creates the same number of new events in the destination system,</li>
+     * <li>has the copier pool copy data and metadata (length, control ints,
+     *     priority, endian, data status) from old to new events,</li>
+     * <li>puts the new events into the destination and the old ones back into the source.</li>
+     * </ol>
+     * Use {@link #printStats(FILE*)} periodically to see events/s and MB/s of each stage.
+     * A lane stops at the first ET error other than a timeout or wakeup. The error is
+     * printed, and kept for {@link #getLaneError(int)} and {@link #getFailedLanes()}.
+     *
+     * @date 10/18/2026
+     */
+    class EtBridge {
+
+    private:
+
+        /** Copy job: copy events [first, last) of a lane. */
+        struct copyJob {
+            et_event **from;
+            et_event **to;
+            int first;
+            int last;
+            std::atomic<int> *remaining;
+        };
+
+        /** ET system events come from. */
+        et_sys_id idFrom;
+        /** ET system events go to. */
+        et_sys_id idTo;
+        /** Name of station in source ET system to attach to. */
+        std::string stationName;
+
+        /** Number of parallel lanes (each with its own attachments). */
+        int laneCount;
+        /** Max number of events to get in one call. */
+        int chunk;
+        /** Number of copier threads, 0 means lanes copy their own data. */
+        int copierCount;
+        /** Number of events in one copy job. */
+        int copyBatch;
+        /** Print out debug info? */
+        bool debug;
+
+        /** Source station id. */
+        et_stat_id statFrom;
+        /** Attachments to source station, one per lane. */
+        std::vector<et_att_id> attsFrom;
+        /** Attachments to destination GRAND_CENTRAL, one per lane. */
+        std::vector<et_att_id> attsTo;
+
+        std::vector<std::thread> lanes;
+        std::vector<std::thread> copiers;
+
+        /** Queue of copy jobs for copier threads. */
+        std::deque<copyJob> jobs;
+        std::mutex jobMutex;
+        std::condition_variable jobCond;
+        std::condition_variable doneCond;
+
+        std::atomic<bool> running {false};
+
+        /** ET error which stopped each lane, ET_OK while it runs. */
+        std::unique_ptr<std::atomic<int>[]> laneErrors;
+        /** Number of lanes stopped by an error. */
+        std::atomic<int> failedLanes {0};
+
+        /** Time stats were last printed. */
+        std::chrono::steady_clock::time_point lastPrint;
+        uint64_t lastEvents[3] = {0, 0, 0};
+        uint64_t lastBytes[3]  = {0, 0, 0};
+
+    public:
+
+        /** Counters of stage getting events from source (including creating new ones in destination). */
+        etBridgeStageStats getStats;
+        /** Counters of stage copying data. */
+        etBridgeStageStats copyStats;
+        /** Counters of stage putting events into both systems. */
+        etBridgeStageStats putStats;
+
+
+    public:
+
+        /**
+         * Constructor.
+         *
+         * @param idFrom      ET system to take events from.
+         * @param idTo        ET system to put events into.
+         * @param stationName station in idFrom to attach lanes to.
+         *                    It should be a parallel or round-robin station if
+         *                    lanes are not to compete for the same events.
+         * @param lanes       number of parallel lanes (attachments).
+         * @param chunk       max number of events handled by a lane at once.
+         * @param copiers     number of copier threads, 0 for lanes copying themselves.
+         * @param debug       if true, print out debug info.
+         */
+        EtBridge(et_sys_id idFrom, et_sys_id idTo, const std::string & stationName,
+                 int lanes = 4, int chunk = 100, int copiers = 4, bool debug = false) :
+                idFrom(idFrom), idTo(idTo), stationName(stationName),
+                laneCount(lanes), chunk(chunk), copierCount(copiers), debug(debug) {
+
+            if (lanes < 1 || chunk < 1 || copiers < 0) {
+                throw std::runtime_error("bad arg");
+            }
+
+            // Split a chunk into about 2 jobs per copier
+            copyBatch = (copiers > 0) ? std::max(1, chunk / (2*copiers)) : chunk;
+
+            laneErrors.reset(new std::atomic<int>[lanes]);
+            for (int i = 0; i < lanes; i++) laneErrors[i] = ET_OK;
+        }
+
+        EtBridge(const EtBridge & bridge) = delete;
+
+        ~EtBridge() {stop();}
+
+
+        /**
+         * Attach lanes to both ET systems and start all threads.
+         * @throws std::runtime_error if station cannot be found or attached to.
+         */
+        void start() {
+            if (running) return;
+
+            int err = et_station_name_to_id(idFrom, &statFrom, stationName.c_str());
+            if (err != ET_OK) {
+                throw std::runtime_error("cannot find station " + stationName + ": " + et_perror(err));
+            }
+
+            for (int i = 0; i < laneCount; i++) {
+                et_att_id att;
+                if ((err = et_station_attach(idFrom, statFrom, &att)) != ET_OK) {
+                    detachAll();
+                    throw std::runtime_error(std::string("cannot attach to source: ") + et_perror(err));
+                }
+                attsFrom.push_back(att);
+
+                // GRAND_CENTRAL is always station 0
+                if ((err = et_station_attach(idTo, 0, &att)) != ET_OK) {
+                    detachAll();
+                    throw std::runtime_error(std::string("cannot attach to destination: ") + et_perror(err));
+                }
+                attsTo.push_back(att);
+            }
+
+            for (int i = 0; i < laneCount; i++) laneErrors[i] = ET_OK;
+            failedLanes = 0;
+
+            running = true;
+            lastPrint = std::chrono::steady_clock::now();
+
+            for (int i = 0; i < copierCount; i++) {
+                copiers.emplace_back(&EtBridge::copyThread, this);
+            }
+            for (int i = 0; i < laneCount; i++) {
+                lanes.emplace_back(&EtBridge::laneThread, this, i);
+            }
+        }
+
+
+        /** Stop all threads, then detach from both ET systems. */
+        void stop() {
+            if (!running.exchange(false)) return;
+
+            // Wake up lanes waiting in et_events_get / et_events_new
+            for (size_t i = 0; i < attsFrom.size(); i++) {
+                et_wakeup_attachment(idFrom, attsFrom[i]);
+                et_wakeup_attachment(idTo, attsTo[i]);
+            }
+            for (auto & t : lanes) t.join();
+
+            jobCond.notify_all();
+            for (auto & t : copiers) t.join();
+
+            lanes.clear();
+            copiers.clear();
+            detachAll();
+        }
+
+
+        /**
+         * Get the ET error which stopped a lane.
+         * @param lane lane number (0 to lanes-1).
+         * @return ET error code, or ET_OK if the lane has not failed.
+         */
+        int getLaneError(int lane) const {
+            if (lane < 0 || lane >= laneCount) return ET_OK;
+            return laneErrors[lane].load();
+        }
+
+
+        /**
+         * Get the number of lanes stopped by an ET error since start().
+         * The bridge keeps moving events with the other lanes.
+         * @return number of failed lanes.
+         */
+        int getFailedLanes() const {return failedLanes.load();}
+
+
+        /**
+         * Print events/s and MB/s of each stage since last call.
+         * @param fp file to print to.
+         */
+        void printStats(FILE *fp) {
+            auto now = std::chrono::steady_clock::now();
+            double secs = std::chrono::duration<double>(now - lastPrint).count();
+            lastPrint = now;
+            if (secs <= 0.) return;
+
+            const char *names[3] = {"get", "copy", "put"};
+            etBridgeStageStats *stats[3] = {&getStats, &copyStats, &putStats};
+
+            for (int i = 0; i < 3; i++) {
+                uint64_t events = stats[i]->events.load();
+                uint64_t bytes  = stats[i]->bytes.load();
+                fprintf(fp, "%s: %.0f events/s, %.2f MB/s, %" PRIu64 " us busy; ", names[i],
+                        (events - lastEvents[i]) / secs, (bytes - lastBytes[i]) / secs / 1.e6,
+                        stats[i]->micros.load());
+                lastEvents[i] = events;
+                lastBytes[i]  = bytes;
+            }
+            int failed = failedLanes.load();
+            if (failed > 0) {
+                fprintf(fp, "%d of %d lanes failed", failed, laneCount);
+            }
+            fprintf(fp, "\n");
+        }
+
+
+    private:
+
+
+        void detachAll() {
+            for (auto att : attsFrom) et_station_detach(idFrom, att);
+            for (auto att : attsTo)   et_station_detach(idTo, att);
+            attsFrom.clear();
+            attsTo.clear();
+        }
+
+
+        static uint64_t microsSince(const std::chrono::steady_clock::time_point & t) {
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - t).count();
+        }
+
+
+        /**
+         * Copy data and metadata of events [first, last).
+         * @return number of data bytes copied.
+         */
+        static uint64_t copyEvents(et_event **from, et_event **to, int first, int last) {
+            uint64_t bytes = 0;
+            int con[ET_STATION_SELECT_INTS];
+            int val;
+            size_t len;
+            void *src, *dst;
+
+            for (int i = first; i < last; i++) {
+                et_event_getlength(from[i], &len);
+                et_event_getdata(from[i], &src);
+                et_event_getdata(to[i], &dst);
+                memcpy(dst, src, len);
+                et_event_setlength(to[i], len);
+
+                et_event_getcontrol(from[i], con);
+                et_event_setcontrol(to[i], con, ET_STATION_SELECT_INTS);
+                et_event_getpriority(from[i], &val);
+                et_event_setpriority(to[i], val);
+                et_event_getendian(from[i], &val);
+                et_event_setendian(to[i], val);
+                et_event_getdatastatus(from[i], &val);
+                et_event_setdatastatus(to[i], val);
+                bytes += len;
+            }
+            return bytes;
+        }
+
+
+        /** Copier thread: run copy jobs until stopped. */
+        void copyThread() {
+            while (true) {
+                copyJob job;
+                {
+                    std::unique_lock<std::mutex> lock(jobMutex);
+                    jobCond.wait(lock, [this] {return !jobs.empty() || !running;});
+                    if (jobs.empty()) return;
+                    job = jobs.front();
+                    jobs.pop_front();
+                }
+
+                auto t = std::chrono::steady_clock::now();
+                uint64_t bytes = copyEvents(job.from, job.to, job.first, job.last);
+                copyStats.micros += microsSince(t);
+                copyStats.bytes  += bytes;
+                copyStats.events += job.last - job.first;
+
+                if (job.remaining->fetch_sub(1) == 1) {
+                    std::lock_guard<std::mutex> lock(jobMutex);
+                    doneCond.notify_all();
+                }
+            }
+        }
+
+
+        /**
+         * Copy events of a lane, splitting the work among the copier threads.
+         * Returns when all data is copied.
+         */
+        void copyAll(et_event **from, et_event **to, int count) {
+            if (copierCount == 0) {
+                auto t = std::chrono::steady_clock::now();
+                uint64_t bytes = copyEvents(from, to, 0, count);
+                copyStats.micros += microsSince(t);
+                copyStats.bytes  += bytes;
+                copyStats.events += count;
+                return;
+            }
+
+            std::atomic<int> remaining {(count + copyBatch - 1) / copyBatch};
+            {
+                std::lock_guard<std::mutex> lock(jobMutex);
+                for (int first = 0; first < count; first += copyBatch) {
+                    jobs.push_back({from, to, first, std::min(count, first + copyBatch), &remaining});
+                }
+            }
+            jobCond.notify_all();
+
+            std::unique_lock<std::mutex> lock(jobMutex);
+            doneCond.wait(lock, [&remaining] {return remaining.load() == 0;});
+        }
+
+
+        /**
+         * Record and print the error which stops a lane.
+         * @param lane lane number.
+         * @param what ET call which failed.
+         * @param err  ET error code.
+         */
+        void laneFailed(int lane, const char *what, int err) {
+            laneErrors[lane] = err;
+            failedLanes++;
+            fprintf(stderr, "EtBridge lane %d: %s error, %s, lane stopped\n", lane, what, et_perror(err));
+        }
+
+
+        /** Lane thread: move chunks of events from source to destination until stopped. */
+        void laneThread(int lane) {
+            et_att_id attFrom = attsFrom[lane];
+            et_att_id attTo   = attsTo[lane];
+            std::vector<et_event *> from(chunk), to(chunk);
+            struct timespec timeout {0, 500000000};
+            int err, nread, nnew;
+
+            while (running) {
+
+                // Get old events
+                auto t = std::chrono::steady_clock::now();
+                EJFAT_PROBE_ET_GET_START(chunk);
+                err = et_events_get(idFrom, attFrom, from.data(), ET_TIMED, &timeout, chunk, &nread);
+                EJFAT_PROBE_ET_GET_DONE(err == ET_OK ? nread : 0, err);
+                if (err == ET_ERROR_TIMEOUT || err == ET_ERROR_WAKEUP || err == ET_ERROR_BUSY) {
+                    continue;
+                }
+                else if (err != ET_OK) {
+                    laneFailed(lane, "get", err);
+                    break;
+                }
+
+                // Make new events big enough for the largest old one
+                size_t maxLen = 0, len;
+                uint64_t bytes = 0;
+                for (int i = 0; i < nread; i++) {
+                    et_event_getlength(from[i], &len);
+                    if (len > maxLen) maxLen = len;
+                    bytes += len;
+                }
+
+                int made = 0;
+                while (made < nread) {
+                    err = et_events_new(idTo, attTo, to.data() + made, ET_SLEEP, nullptr,
+                                        maxLen, nread - made, &nnew);
+                    if (err != ET_OK) break;
+                    made += nnew;
+                }
+                if (made < nread) {
+                    // A wakeup from stop() is not an error
+                    if (running || err != ET_ERROR_WAKEUP) laneFailed(lane, "new", err);
+                    if (made > 0) et_events_dump(idTo, attTo, to.data(), made);
+                    et_events_put(idFrom, attFrom, from.data(), nread);
+                    break;
+                }
+                getStats.micros += microsSince(t);
+                getStats.events += nread;
+                getStats.bytes  += bytes;
+
+                copyAll(from.data(), to.data(), nread);
+
+                // Put new events into destination and old ones back into source
+                t = std::chrono::steady_clock::now();
+                err = et_events_put(idTo, attTo, to.data(), nread);
+                EJFAT_PROBE_ET_PUT(nread, err);
+                if (err != ET_OK) {
+                    laneFailed(lane, "put", err);
+                    et_events_put(idFrom, attFrom, from.data(), nread);
+                    break;
+                }
+                err = et_events_put(idFrom, attFrom, from.data(), nread);
+                EJFAT_PROBE_ET_PUT(nread, err);
+                if (err != ET_OK) {
+                    laneFailed(lane, "put", err);
+                    break;
+                }
+                putStats.micros += microsSince(t);
+                putStats.events += nread;
+                putStats.bytes  += bytes;
+            }
+        }
+    };
+
+}
+
+
+#endif // EJFAT_ET_BRIDGE_H
@@ -0,0 +1,392 @@
+//
+// Copyright 2023, Jefferson Science Associates, LLC.
+// Subject to the terms in the LICENSE file found in the top-level directory.
+//
+// EPSCI Group
+// Thomas Jefferson National Accelerator Facility
+// 12000, Jefferson Ave, Newport News, VA 23606
+// (757)-269-7100
+
+
+/**
+ * @file Contains the one codec for the headers EJFAT puts on the wire:
+ * the load balancer (LB) header, the old (version 1) and new (version 2)
+ * reassembly (RE) headers, and the sync message sent to the control plane.
+ * All packetizing and reassembly headers use it.
+ * Field offsets are compile-time constants. All multi-byte fields are read and
+ * written with memcpy and a byte swap, which compiles to a single (unaligned)
+ * load or store plus bswap/movbe, never a byte at a time and never through a
+ * misaligned pointer cast. The batch routines decode or encode the headers of
+ * a whole array of mmsghdr (as used by recvmmsg/sendmmsg) in one tight loop.
+ */
+#ifndef EJFAT_HEADER_H
+#define EJFAT_HEADER_H
+
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+
+#ifndef htonll
+    #define htonll(x) (ejfat::wire::toBig64(x))
+    #define ntohll(x) (ejfat::wire::toBig64(x))
+#endif
+
+
+#ifdef __linux__
+    #include <byteswap.h>
+#elif !defined(_BYTESWAP_H)
+    #define _BYTESWAP_H
+
+    static inline uint16_t bswap_16(uint16_t x) {
+        return __builtin_bswap16(x);
+    }
+
+    static inline uint32_t bswap_32(uint32_t x) {
+        return __builtin_bswap32(x);
+    }
+
+    static inline uint64_t bswap_64(uint64_t x) {
+        return __builtin_bswap64(x);
+    }
+#endif
+
+
+namespace ejfat {
+
+
+    // Structure to hold reassembly header info
+    typedef struct reHeader_t {
+        uint8_t  version  = 2;
+        int      reserved = 0; // 12 bits, lowest 8 for testing
+        uint16_t dataId;
+        uint32_t offset;
+        uint32_t length;
+        uint64_t tick;
+    } reHeader;
+
+
+    // Structure to hold load balancer header info
+    typedef struct lbHeader_t {
+        uint32_t version;
+        uint32_t protocol;
+        uint32_t entropy;
+        uint64_t tick;
+    } lbHeader;
+
+
+    // Structure to hold the info of a sync message to the control plane
+    typedef struct syncHeader_t {
+        uint32_t version;
+        uint32_t srcId;
+        uint64_t evtNum;
+        uint32_t evtRate;
+        uint64_t nanos;
+    } syncHeader;
+
+
+namespace wire {
+
+
+    /** Version of this codec, bump when any layout below changes. */
+    constexpr int CODEC_VERSION = 1;
+
+    // LB header: 'L:8,B:8,Version:8,Protocol:8,Reserved:16,Entropy:16,Tick:64'
+    constexpr size_t LB_BYTES       = 16;
+    constexpr size_t LB_VERSION     = 2;
+    constexpr size_t LB_PROTOCOL    = 3;
+    constexpr size_t LB_RESERVED    = 4;
+    constexpr size_t LB_ENTROPY     = 6;
+    constexpr size_t LB_TICK        = 8;
+
+    // RE header v2: 'Version:4, Rsvd:12, Data-ID:16, Offset:32, Length:32, Tick:64'
+    constexpr size_t RE_BYTES       = 20;
+    constexpr size_t RE_RESERVED    = 1;
+    constexpr size_t RE_DATA_ID     = 2;
+    constexpr size_t RE_OFFSET      = 4;
+    constexpr size_t RE_LENGTH      = 8;
+    constexpr size_t RE_TICK        = 12;
+
+    // RE header v1: 'Version:4, Rsvd:10, First:1, Last:1, Data-ID:16, Offset:32, Tick:64, Padding:16'
+    constexpr size_t RE_OLD_BYTES    = 18;
+    constexpr size_t RE_OLD_FLAGS    = 1;
+    constexpr size_t RE_OLD_DATA_ID  = 2;
+    constexpr size_t RE_OLD_SEQUENCE = 4;
+    constexpr size_t RE_OLD_TICK     = 8;
+    constexpr size_t RE_OLD_PADDING  = 16;
+
+    // Sync message: 'L:8,C:8,Version:8,Rsvd:8,SrcId:32,EvtNum:64,EvtRate:32,Nanos:64'
+    constexpr size_t SYNC_BYTES     = 28;
+    constexpr size_t SYNC_VERSION   = 2;
+    constexpr size_t SYNC_SRC_ID    = 4;
+    constexpr size_t SYNC_EVT_NUM   = 8;
+    constexpr size_t SYNC_EVT_RATE  = 16;
+    constexpr size_t SYNC_NANOS     = 20;
+
+    static_assert(LB_TICK + 8 == LB_BYTES, "LB header layout");
+    static_assert(RE_TICK + 8 == RE_BYTES, "RE header layout");
+    static_assert(RE_OLD_PADDING + 2 == RE_OLD_BYTES, "old RE header layout");
+    static_assert(SYNC_NANOS + 8 == SYNC_BYTES, "sync header layout");
+
+
+    //-----------------------------------------------------------------------
+    // Big endian loads & stores
+    //-----------------------------------------------------------------------
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    static inline uint16_t toBig16(uint16_t x) {return x;}
+    static inline uint32_t toBig32(uint32_t x) {return x;}
+    static inline uint64_t toBig64(uint64_t x) {return x;}
+#else
+    static inline uint16_t toBig16(uint16_t x) {return __builtin_bswap16(x);}
+    static inline uint32_t toBig32(uint32_t x) {return __builtin_bswap32(x);}
+    static inline uint64_t toBig64(uint64_t x) {return __builtin_bswap64(x);}
+#endif
+
+    static inline uint16_t load16(const char* p) {uint16_t x; std::memcpy(&x, p, 2); return toBig16(x);}
+    static inline uint32_t load32(const char* p) {uint32_t x; std::memcpy(&x, p, 4); return toBig32(x);}
+    static inline uint64_t load64(const char* p) {uint64_t x; std::memcpy(&x, p, 8); return toBig64(x);}
+
+    static inline void store16(char* p, uint16_t x) {x = toBig16(x); std::memcpy(p, &x, 2);}
+    static inline void store32(char* p, uint32_t x) {x = toBig32(x); std::memcpy(p, &x, 4);}
+    static inline void store64(char* p, uint64_t x) {x = toBig64(x); std::memcpy(p, &x, 8);}
+
+
+    //-----------------------------------------------------------------------
+    // LB header
+    //-----------------------------------------------------------------------
+
+    /**
+     * Write a load balancer header.
+     *
+     * @param buffer   buffer in which to write LB_BYTES of header.
+     * @param tick     tick used by the load balancer to pick the backend host.
+     * @param version  version of this software.
+     * @param protocol protocol this software uses.
+     * @param entropy  entropy field used to pick the destination port.
+     */
+    static inline void encodeLb(char* buffer, uint64_t tick, int version, int protocol, int entropy) {
+        buffer[0] = 'L';
+        buffer[1] = 'B';
+        buffer[LB_VERSION]  = (char) version;
+        buffer[LB_PROTOCOL] = (char) protocol;
+        store16(buffer + LB_RESERVED, 0);
+        store16(buffer + LB_ENTROPY, (uint16_t) entropy);
+        store64(buffer + LB_TICK, tick);
+    }
+
+    /**
+     * Read a load balancer header.
+     *
+     * @param buffer buffer holding header.
+     * @param header filled with header's values.
+     * @return true if buffer starts with 'LB', else false (header is filled anyway).
+     */
+    static inline bool decodeLb(const char* buffer, lbHeader* header) {
+        header->version  = (uint8_t) buffer[LB_VERSION];
+        header->protocol = (uint8_t) buffer[LB_PROTOCOL];
+        header->entropy  = load16(buffer + LB_ENTROPY);
+        header->tick     = load64(buffer + LB_TICK);
+        return buffer[0] == 'L' && buffer[1] == 'B';
+    }
+
+
+    //-----------------------------------------------------------------------
+    // RE header
+    //-----------------------------------------------------------------------
+
+    /**
+     * Write a version 2 reassembly header.
+     *
+     * @param buffer   buffer in which to write RE_BYTES of header.
+     * @param offset   byte offset of this packet's data into the full buffer.
+     * @param length   total length in bytes of the full buffer.
+     * @param tick     tick of the full buffer.
+     * @param version  version of this software.
+     * @param dataId   data source id.
+     * @param reserved lowest 12 bits: the highest 4 go next to the version,
+     *                 the lowest 8 into the 2nd byte (for testing).
+     */
+    static inline void encodeRe(char* buffer, uint32_t offset, uint32_t length, uint64_t tick,
+                                int version, uint16_t dataId, int reserved = 0) {
+        buffer[0] = (char) ((version << 4) | ((reserved >> 8) & 0xf));
+        buffer[RE_RESERVED] = (char) (reserved & 0xff);
+        store16(buffer + RE_DATA_ID, dataId);
+        store32(buffer + RE_OFFSET, offset);
+        store32(buffer + RE_LENGTH, length);
+        store64(buffer + RE_TICK, tick);
+    }
+
+    /**
+     * Read a version 2 reassembly header.
+     * @param buffer buffer holding header.
+     * @param header filled with header's values.
+     */
+    static inline void decodeRe(const char* buffer, reHeader* header) {
+        header->version  = (buffer[0] >> 4) & 0xf;
+        header->reserved = ((buffer[0] & 0xf) << 8) | (buffer[RE_RESERVED] & 0xff);
+        header->dataId   = load16(buffer + RE_DATA_ID);
+        header->offset   = load32(buffer + RE_OFFSET);
+        header->length   = load32(buffer + RE_LENGTH);
+        header->tick     = load64(buffer + RE_TICK);
+    }
+
+    /**
+     * Write an old, version 1, reassembly header.
+     *
+     * @param buffer   buffer in which to write RE_OLD_BYTES of header.
+     * @param first    is this the first packet?
+     * @param last     is this the last packet?
+     * @param tick     tick of the full buffer.
+     * @param sequence packet sequence number.
+     * @param version  version of this software.
+     * @param dataId   data source id.
+     */
+    static inline void encodeReOld(char* buffer, bool first, bool last, uint64_t tick,
+                                   uint32_t sequence, int version, uint16_t dataId) {
+        buffer[0] = (char) (version << 4);
+        buffer[RE_OLD_FLAGS] = (char) ((first << 1) + last);
+        store16(buffer + RE_OLD_DATA_ID, dataId);
+        store32(buffer + RE_OLD_SEQUENCE, sequence);
+        store64(buffer + RE_OLD_TICK, tick);
+        // Zero out padding
+        store16(buffer + RE_OLD_PADDING, 0);
+    }
+
+    /**
+     * Read an old, version 1, reassembly header.
+     *
+     * @param buffer   buffer holding header.
+     * @param version  filled with version.
+     * @param first    filled with is-first-packet value.
+     * @param last     filled with is-last-packet value.
+     * @param dataId   filled with data source id.
+     * @param sequence filled with packet sequence number.
+     * @param tick     filled with tick.
+     */
+    static inline void decodeReOld(const char* buffer, int* version, bool* first, bool* last,
+                                   uint16_t* dataId, uint32_t* sequence, uint64_t* tick) {
+        *version  = (buffer[0] >> 4) & 0xf;
+        *first    = (buffer[RE_OLD_FLAGS] & 0x02) >> 1;
+        *last     =  buffer[RE_OLD_FLAGS] & 0x01;
+        *dataId   = load16(buffer + RE_OLD_DATA_ID);
+        *sequence = load32(buffer + RE_OLD_SEQUENCE);
+        *tick     = load64(buffer + RE_OLD_TICK);
+    }
+
+
+    //-----------------------------------------------------------------------
+    // Sync message
+    //-----------------------------------------------------------------------
+
+    /**
+     * Write a sync message for the control plane.
+     *
+     * @param buffer  buffer in which to write SYNC_BYTES.
+     * @param version version of this software.
+     * @param srcId   id of this data source.
+     * @param evtNum  latest event number (tick) sent.
+     * @param evtRate rate of events sent in Hz (0 if unknown).
+     * @param nanos   unix time in nanoseconds this message was sent (0 if unknown).
+     */
+    static inline void encodeSync(char* buffer, int version, uint32_t srcId,
+                                  uint64_t evtNum, uint32_t evtRate, uint64_t nanos) {
+        buffer[0] = 'L';
+        buffer[1] = 'C';
+        buffer[SYNC_VERSION] = (char) version;
+        buffer[3] = 0;
+        store32(buffer + SYNC_SRC_ID,   srcId);
+        store64(buffer + SYNC_EVT_NUM,  evtNum);
+        store32(buffer + SYNC_EVT_RATE, evtRate);
+        store64(buffer + SYNC_NANOS,    nanos);
+    }
+
+    /**
+     * Read a sync message.
+     * @param buffer buffer holding message.
+     * @param header filled with message's values.
+     * @return true if buffer starts with 'LC', else false (header is filled anyway).
+     */
+    static inline bool decodeSync(const char* buffer, syncHeader* header) {
+        header->version = (uint8_t) buffer[SYNC_VERSION];
+        header->srcId   = load32(buffer + SYNC_SRC_ID);
+        header->evtNum  = load64(buffer + SYNC_EVT_NUM);
+        header->evtRate = load32(buffer + SYNC_EVT_RATE);
+        header->nanos   = load64(buffer + SYNC_NANOS);
+        return buffer[0] == 'L' && buffer[1] == 'C';
+    }
+
+
+#ifdef __linux__
+
+    //-----------------------------------------------------------------------
+    // Batches of packets
+    //-----------------------------------------------------------------------
+
+    /**
+     * Decode the RE headers of packets received by recvmmsg.
+     * The header of packet i is at hdrOffset bytes into the first iovec of msgs[i]
+     * (LB_BYTES if the LB header is still there, otherwise 0).
+     * Packets too short to hold a header get a version of 0 in their reHeader.
+     *
+     * @param msgs      messages filled by recvmmsg.
+     * @param count     number of messages received.
+     * @param hdrOffset byte offset of RE header in each packet.
+     * @param headers   array of at least count headers to fill.
+     * @return number of packets with a complete header.
+     */
+    static inline size_t decodeReBatch(const struct mmsghdr* msgs, size_t count,
+                                       size_t hdrOffset, reHeader* headers) {
+        size_t good = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (msgs[i].msg_len < hdrOffset + RE_BYTES) {
+                headers[i].version = 0;
+                continue;
+            }
+            decodeRe((const char*) msgs[i].msg_hdr.msg_iov[0].iov_base + hdrOffset, &headers[i]);
+            good++;
+        }
+        return good;
+    }
+
+    /**
+     * Encode the LB and RE headers of all packets of one buffer before sendmmsg.
+     * The first iovec of msgs[i] must point to room for the headers of packet i,
+     * which carries bytes [i*maxPayload, min((i+1)*maxPayload, length)) of the buffer.
+     *
+     * @param msgs       messages to send.
+     * @param count      number of packets the buffer is split into.
+     * @param maxPayload max data bytes per packet.
+     * @param length     total length of buffer in bytes.
+     * @param tick       tick of buffer.
+     * @param version    version of this software.
+     * @param protocol   protocol this software uses.
+     * @param entropy    entropy used to pick the destination port.
+     * @param dataId     data source id.
+     * @param addLb      if true, write an LB header before each RE header.
+     */
+    static inline void encodeBatch(struct mmsghdr* msgs, size_t count, uint32_t maxPayload,
+                                   uint32_t length, uint64_t tick, int version, int protocol,
+                                   int entropy, uint16_t dataId, bool addLb = true) {
+        for (size_t i = 0; i < count; i++) {
+            char* buf = (char*) msgs[i].msg_hdr.msg_iov[0].iov_base;
+            if (addLb) {
+                encodeLb(buf, tick, version, protocol, entropy);
+                buf += LB_BYTES;
+            }
+            encodeRe(buf, (uint32_t) (i * maxPayload), length, tick, version, dataId);
+        }
+    }
+
+#endif
+
+} // namespace wire
+} // namespace ejfat
+
+
+#endif // EJFAT_HEADER_H
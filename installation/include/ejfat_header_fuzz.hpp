@@ -0,0 +1,276 @@
+//
+// Copyright 2023, Jefferson Science Associates, LLC.
+// Subject to the terms in the LICENSE file found in the top-level directory.
+//
+// EPSCI Group
+// Thomas Jefferson National Accelerator Facility
+// 12000, Jefferson Ave, Newport News, VA 23606
+// (757)-269-7100
+
+
+/**
+ * @file Contains a fuzz target for the wire codec of ejfat_header.hpp.
+ * Arbitrary bytes of arbitrary length are fed to decodeLb, decodeRe, decodeSync
+ * and decodeReBatch, each in a heap buffer of exactly the bytes available so that
+ * AddressSanitizer catches any read past a header. Every decoded header is encoded
+ * again and must give back the same bytes (apart from bits the encoders always
+ * zero), and headers encoded from the input's values must decode to those values.
+ * Any mismatch aborts, which the fuzzer reports as a crash.
+ * <p>
+ * A libFuzzer target is just:
+ * <pre>
+ *   #define EJFAT_HEADER_FUZZ_MAIN
+ *   #include "ejfat_header_fuzz.hpp"
+ * </pre>
+ * built with
+ * <pre>
+ *   clang++ -g -O1 -fsanitize=fuzzer,address,undefined header_fuzz.cpp -o ejfat_header_fuzz
+ * </pre>
+ * Without a fuzzer, ejfat::fuzz::roundTrip() runs the encode/decode checks on
+ * a fixed set of values and returns false on the first mismatch.
+ */
+#ifndef EJFAT_HEADER_FUZZ_H
+#define EJFAT_HEADER_FUZZ_H
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <memory>
+
+#include "ejfat_header.hpp"
+
+
+namespace ejfat {
+
+    namespace fuzz {
+
+
+        /** Report a failed check and abort. */
+        static inline void fail(const char *what) {
+            fprintf(stderr, "ejfat header fuzz: %s\n", what);
+            abort();
+        }
+
+
+        /** Copy of some input bytes in a heap buffer of exactly that size. */
+        static inline std::unique_ptr<char[]> exact(const uint8_t *data, size_t size) {
+            std::unique_ptr<char[]> buf(new char[size > 0 ? size : 1]);
+            if (size > 0) memcpy(buf.get(), data, size);
+            return buf;
+        }
+
+
+        /**
+         * Decode an LB header and check that encoding it again gives the same bytes,
+         * except for the reserved field which the encoder zeroes.
+         * @param buf buffer of at least wire::LB_BYTES.
+         */
+        static inline void checkLb(const char *buf) {
+            lbHeader hdr;
+            if (!wire::decodeLb(buf, &hdr)) return;
+
+            char out[wire::LB_BYTES];
+            wire::encodeLb(out, hdr.tick, (int) hdr.version, (int) hdr.protocol, (int) hdr.entropy);
+            char in[wire::LB_BYTES];
+            memcpy(in, buf, wire::LB_BYTES);
+            wire::store16(in + wire::LB_RESERVED, 0);
+            if (memcmp(in, out, wire::LB_BYTES) != 0) fail("LB header does not round trip");
+        }
+
+
+        /**
+         * Decode a version 2 RE header and check that encoding it again gives the same bytes.
+         * @param buf buffer of at least wire::RE_BYTES.
+         */
+        static inline void checkRe(const char *buf) {
+            reHeader hdr;
+            wire::decodeRe(buf, &hdr);
+
+            char out[wire::RE_BYTES];
+            wire::encodeRe(out, hdr.offset, hdr.length, hdr.tick, hdr.version, hdr.dataId, hdr.reserved);
+            if (memcmp(buf, out, wire::RE_BYTES) != 0) fail("RE header does not round trip");
+        }
+
+
+        /**
+         * Decode a sync message and check that encoding it again gives the same bytes,
+         * except for the reserved byte which the encoder zeroes.
+         * @param buf buffer of at least wire::SYNC_BYTES.
+         */
+        static inline void checkSync(const char *buf) {
+            syncHeader hdr;
+            if (!wire::decodeSync(buf, &hdr)) return;
+
+            char out[wire::SYNC_BYTES];
+            wire::encodeSync(out, (int) hdr.version, hdr.srcId, hdr.evtNum, hdr.evtRate, hdr.nanos);
+            char in[wire::SYNC_BYTES];
+            memcpy(in, buf, wire::SYNC_BYTES);
+            in[3] = 0;
+            if (memcmp(in, out, wire::SYNC_BYTES) != 0) fail("sync message does not round trip");
+        }
+
+
+        /**
+         * Encode headers from the given values, decode them, and check the values come back.
+         * @param tick     tick.
+         * @param offset   RE offset.
+         * @param length   RE length.
+         * @param dataId   data id / source id.
+         * @param version  version (4 bits are kept in the RE header, 8 in the others).
+         * @param protocol LB protocol.
+         * @param entropy  LB entropy.
+         * @param rate     sync event rate.
+         * @return true if all values came back.
+         */
+        static inline bool encodeDecode(uint64_t tick, uint32_t offset, uint32_t length, uint16_t dataId,
+                                        uint8_t version, uint8_t protocol, uint16_t entropy, uint32_t rate) {
+            char buf[wire::SYNC_BYTES];
+
+            wire::encodeLb(buf, tick, version, protocol, entropy);
+            lbHeader lb;
+            if (!wire::decodeLb(buf, &lb) || lb.tick != tick || lb.version != version ||
+                lb.protocol != protocol || lb.entropy != entropy) return false;
+
+            wire::encodeRe(buf, offset, length, tick, version & 0xf, dataId, protocol);
+            reHeader re;
+            wire::decodeRe(buf, &re);
+            if (re.offset != offset || re.length != length || re.tick != tick ||
+                re.version != (version & 0xf) || re.dataId != dataId || re.reserved != protocol) return false;
+
+            wire::encodeSync(buf, version, dataId, tick, rate, tick ^ offset);
+            syncHeader sync;
+            if (!wire::decodeSync(buf, &sync) || sync.version != version || sync.srcId != dataId ||
+                sync.evtNum != tick || sync.evtRate != rate || sync.nanos != (tick ^ offset)) return false;
+
+            return true;
+        }
+
+
+        /**
+         * Run the encode/decode round trip on edge values and a spread of others.
+         * @return true if all checks pass.
+         */
+        static inline bool roundTrip() {
+            const uint64_t ticks[] = {0, 1, 0xff, 0x100000000ULL, 0x8000000000000000ULL, UINT64_MAX};
+            const uint32_t words[] = {0, 1, 9000, 0x80000000U, UINT32_MAX};
+            for (uint64_t tick : ticks) {
+                for (uint32_t w : words) {
+                    if (!encodeDecode(tick, w, ~w, (uint16_t) w, (uint8_t) (tick >> 3),
+                                      (uint8_t) w, (uint16_t) (w >> 16), w ^ 0x5a5a5a5a)) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+
+#ifdef __linux__
+
+        /**
+         * Split the input into packets and check decodeReBatch against decodeRe,
+         * including packets too short to hold a header.
+         * The first byte picks the header offset (0 or LB_BYTES),
+         * the next bytes the packet lengths, the rest is packet data.
+         * @param data input.
+         * @param size input bytes.
+         */
+        static inline void checkBatch(const uint8_t *data, size_t size) {
+            if (size < 2) return;
+            size_t hdrOffset = (data[0] & 1) ? wire::LB_BYTES : 0;
+            size_t count = 1 + (data[0] >> 1) % 16;
+            if (size < 1 + count) return;
+
+            const uint8_t *lengths = data + 1;
+            data += 1 + count;
+            size -= 1 + count;
+
+            std::vector<std::unique_ptr<char[]>> bufs(count);
+            std::vector<struct iovec> iovs(count);
+            std::vector<struct mmsghdr> msgs(count);
+            std::vector<reHeader> headers(count);
+
+            size_t pos = 0, complete = 0;
+            for (size_t i = 0; i < count; i++) {
+                size_t len = (hdrOffset + wire::RE_BYTES) * lengths[i] / 128;
+                if (len > size - pos) len = size - pos;
+                bufs[i] = exact(data + pos, len);
+                pos += len;
+
+                iovs[i].iov_base = bufs[i].get();
+                iovs[i].iov_len = len;
+                memset(&msgs[i], 0, sizeof(struct mmsghdr));
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+                msgs[i].msg_len = (unsigned int) len;
+                if (len >= hdrOffset + wire::RE_BYTES) complete++;
+            }
+
+            if (wire::decodeReBatch(msgs.data(), count, hdrOffset, headers.data()) != complete) {
+                fail("decodeReBatch miscounts complete headers");
+            }
+
+            for (size_t i = 0; i < count; i++) {
+                if (msgs[i].msg_len < hdrOffset + wire::RE_BYTES) {
+                    if (headers[i].version != 0) fail("decodeReBatch accepts a short packet");
+                    continue;
+                }
+                reHeader one;
+                wire::decodeRe(bufs[i].get() + hdrOffset, &one);
+                if (one.version != headers[i].version || one.reserved != headers[i].reserved ||
+                    one.dataId != headers[i].dataId || one.offset != headers[i].offset ||
+                    one.length != headers[i].length || one.tick != headers[i].tick) {
+                    fail("decodeReBatch differs from decodeRe");
+                }
+            }
+        }
+
+#endif
+
+
+        /**
+         * Run every check on one input.
+         * @param data input bytes.
+         * @param size number of input bytes.
+         */
+        static inline void fuzzOne(const uint8_t *data, size_t size) {
+            std::unique_ptr<char[]> buf = exact(data, size);
+
+            if (size >= wire::LB_BYTES)   checkLb(buf.get());
+            if (size >= wire::RE_BYTES)   checkRe(buf.get());
+            if (size >= wire::SYNC_BYTES) checkSync(buf.get());
+
+            if (size >= 23) {
+                uint64_t tick   = wire::load64(buf.get());
+                uint32_t offset = wire::load32(buf.get() + 8);
+                uint32_t length = wire::load32(buf.get() + 12);
+                uint32_t rate   = wire::load32(buf.get() + 16);
+                uint16_t dataId = wire::load16(buf.get() + 20);
+                if (!encodeDecode(tick, offset, length, dataId, data[22], data[21], dataId ^ data[22], rate)) {
+                    fail("encoded header does not decode to its values");
+                }
+            }
+
+#ifdef __linux__
+            checkBatch(data, size);
+#endif
+        }
+    }
+}
+
+
+#ifdef EJFAT_HEADER_FUZZ_MAIN
+
+/** libFuzzer entry point. */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    ejfat::fuzz::fuzzOne(data, size);
+    return 0;
+}
+
+#endif
+
+
+#endif // EJFAT_HEADER_FUZZ_H
@@ -41,6 +41,9 @@
 #include <arpa/inet.h>
 #include <net/if.h>
 
+#include "ejfat_header.hpp"
+#include "ejfat_probes.hpp"
+
 #ifdef __APPLE__
 #include <cctype>
 #endif
@@ -60,28 +63,6 @@
 #define MAX_EJFAT_MTU 9978
 
 
-#ifdef __linux__
-    #define htonll(x) ((1==htonl(1)) ? (x) : (((uint64_t)htonl((x) & 0xFFFFFFFFUL)) << 32) | htonl((uint32_t)((x) >> 32)))
-    #define ntohll(x) ((1==ntohl(1)) ? (x) : (((uint64_t)ntohl((x) & 0xFFFFFFFFUL)) << 32) | ntohl((uint32_t)((x) >> 32)))
-#endif
-
-
-#ifndef _BYTESWAP_H
-    #define _BYTESWAP_H
-
-    static inline uint16_t bswap_16(uint16_t x) {
-        return (x>>8) | (x<<8);
-    }
-
-    static inline uint32_t bswap_32(uint32_t x) {
-        return (bswap_16(x&0xffff)<<16) | (bswap_16(x>>16));
-    }
-
-    static inline uint64_t bswap_64(uint64_t x) {
-        return (((uint64_t)bswap_32(x&0xffffffffull))<<32) |
-                          (bswap_32(x>>32));
-    }
-#endif
 
 #define btoa(x) ((x)?"true":"false")
 #define INPUT_LENGTH_MAX 256
@@ -199,15 +180,7 @@ namespace ejfat {
          * @param entropy  entropy field used to determine destination port.
          */
         static void setLbMetadata(char* buffer, uint64_t tick, int version, int protocol, int entropy) {
-            *buffer     = 'L';
-            *(buffer+1) = 'B';
-            *(buffer+2) = version;
-            *(buffer+3) = protocol;
-            *(buffer+4) = 0;
-            *(buffer+5) = 0;
-            // Put the data in network byte order (big endian)
-            *((uint16_t *)(buffer + 6)) = htons(entropy);
-            *((uint64_t *)(buffer + 8)) = htonll(tick);
+            wire::encodeLb(buffer, tick, version, protocol, entropy);
         }
 
     #else
@@ -260,14 +233,7 @@ namespace ejfat {
         static void setReMetadataOld(char* buffer, bool first, bool last,
                                      uint64_t tick, uint32_t offset,
                                      int version, uint16_t dataId) {
-            buffer[0] = version << 4;
-            buffer[1] = (first << 1) + last;
-
-            *((uint16_t *)(buffer + 2)) = htons(dataId);
-            *((uint32_t *)(buffer + 4)) = htonl(offset);
-            *((uint64_t *)(buffer + 8)) = htonll(tick);
-            // Zero out padding
-            buffer[16] = buffer[17] = 0;
+            wire::encodeReOld(buffer, first, last, tick, offset, version, dataId);
         }
 
 
@@ -308,14 +274,7 @@ namespace ejfat {
         */
         static void setReMetadata(char* buffer, uint32_t offset, uint32_t length,
                                   uint64_t tick, int version, uint16_t dataId) {
-
-            buffer[0] = version << 4;
-            buffer[1] = 0;
-
-            *((uint16_t *)(buffer + 2))  = htons(dataId);
-            *((uint32_t *)(buffer + 4))  = htonl(offset);
-            *((uint32_t *)(buffer + 8))  = htonl(length);
-            *((uint64_t *)(buffer + 12)) = htonll(tick);
+            wire::encodeRe(buffer, offset, length, tick, version, dataId);
         }
 
 
@@ -359,19 +318,12 @@ namespace ejfat {
          * @param version the version of this software.
          * @param dataId  the data source id number.
          * @param reserved the "reserved" number which may be useful in setting during testing.
-         *                 Use lowest 8 bits which are placed next to the data id, 2nd byte from beginning.
+         *                 Lowest 12 bits are used, the lowest 8 are placed next to the data id,
+         *                 2nd byte from beginning.
          */
         static void setReMetadata(char* buffer, uint32_t offset, uint32_t length,
                                   uint64_t tick, int version, uint16_t dataId, int reserved) {
-
-
-            buffer[0] = version << 4;
-            buffer[1] = reserved & 0xff;
-
-            *((uint16_t *)(buffer + 2))  = htons(dataId);
-            *((uint32_t *)(buffer + 4))  = htonl(offset);
-            *((uint32_t *)(buffer + 8))  = htonl(length);
-            *((uint64_t *)(buffer + 12)) = htonll(tick);
+            wire::encodeRe(buffer, offset, length, tick, version, dataId, reserved);
         }
 
 
@@ -419,16 +371,7 @@ namespace ejfat {
          */
         static void setSyncData(char* buffer, int version, uint32_t srcId,
                                 uint64_t evtNum, uint32_t evtRate, uint64_t nanos) {
-            buffer[0] = 'L';
-            buffer[1] = 'C';
-            buffer[2] = version;
-            buffer[3] = 0;
-
-            // Put the data in network byte order (big endian)
-            *((uint32_t *)(buffer + 4))  = htonl(srcId);
-            *((uint64_t *)(buffer + 8))  = htonll(evtNum);
-            *((uint32_t *)(buffer + 16)) = htonl(evtRate);
-            *((uint64_t *)(buffer + 20)) = htonll(nanos);
+            wire::encodeSync(buffer, version, srcId, evtNum, evtRate, nanos);
          }
 
 
@@ -605,6 +548,7 @@ namespace ejfat {
             }
 
             sentPackets++;
+            EJFAT_PROBE_PACKET_SEND(tick, dataId, localOffset, bytesToWrite);
 
             // delay if any
             if (delay > 0) {
@@ -836,10 +780,13 @@ namespace ejfat {
      * @param direct         don't include LB header since packets are going directly to receiver.
      * @param noConnect      socket did NOT have connect called on it.
      * @param packetsSent    filled with number of packets sent over network (valid even if error returned).
-     * @param reserved       set 1 byte of the RE header "reserved" field
-     *                       with least significant byte for testing.
+     * @param reserved       set the 12 bit RE header "reserved" field; the least
+     *                       significant byte is for testing, see crc::RE_TRAILER_FLAG.
      * @param destAddr       destination address to use with sendto if noConnect true.
      * @param destLen        length in bytes of destAddr to use with sendto if noConnect true.
+     * @param usedPayload    if not null, filled with the maximum number of data bytes placed into
+     *                       one UDP packet. This is less than maxUdpPayload if the first packet was
+     *                       too big, and is what following calls for the same tick must use.
      *
      * @return 0 if OK, -1 if error when sending packet. Use errno for more details.
      */
@@ -852,7 +799,8 @@ namespace ejfat {
                                            bool debug, bool direct, bool noConnect,
                                            int64_t *packetsSent, int reserved,
                                            /* if sock not connected, specify dest */
-                                           struct sockaddr* destAddr, socklen_t destLen) {
+                                           struct sockaddr* destAddr, socklen_t destLen,
+                                           int *usedPayload) {
 
         ssize_t err;
         int64_t sentPackets=0;
@@ -951,6 +899,7 @@ namespace ejfat {
             }
 
             sentPackets++;
+            EJFAT_PROBE_PACKET_SEND(tick, dataId, localOffset, bytesToWrite);
 
             // delay if any
             if (delay > 0) {
@@ -972,12 +921,38 @@ namespace ejfat {
 
         *offset = localOffset;
         *packetsSent = sentPackets;
+        if (usedPayload != nullptr) *usedPayload = maxUdpPayload;
         if (debug) fprintf(stderr, "Set next offset to = %u\n", *offset);
 
         return 0;
     }
 
 
+    /**
+     * Same as the routine above, without returning the packet payload size used.
+     * @return 0 if OK, -1 if error when sending packet. Use errno for more details.
+     */
+    static int sendPacketizedBufferSendNew(const char* dataBuffer, size_t dataLen, int maxUdpPayload,
+                                           int clientSocket, uint64_t tick, int protocol, int entropy,
+                                           int version, uint16_t dataId, uint32_t fullLen,
+                                           uint32_t *offset, uint32_t delay,
+                                           uint32_t delayPrescale, uint32_t *delayCounter,
+                                           bool firstBuffer, bool lastBuffer,
+                                           bool debug, bool direct, bool noConnect,
+                                           int64_t *packetsSent, int reserved,
+                                           struct sockaddr* destAddr, socklen_t destLen) {
+
+        return sendPacketizedBufferSendNew(dataBuffer, dataLen, maxUdpPayload,
+                clientSocket, tick, protocol, entropy,
+                version, dataId, fullLen,
+                offset, delay,
+                delayPrescale, delayCounter,
+                firstBuffer, lastBuffer,
+                debug, direct, noConnect,
+                packetsSent, reserved, destAddr, destLen, nullptr);
+    }
+
+
     /** <p>
      * <p>
      * This routine uses the latest, 20-byte RE header with offset into buf and len of buf.
@@ -0,0 +1,99 @@
+//
+// Copyright 2023, Jefferson Science Associates, LLC.
+// Subject to the terms in the LICENSE file found in the top-level directory.
+//
+// EPSCI Group
+// Thomas Jefferson National Accelerator Facility
+// 12000, Jefferson Ave, Newport News, VA 23606
+// (757)-269-7100
+
+
+/**
+ * @file Contains the USDT (user level statically defined tracing) probes of
+ * the EJFAT headers, under the provider name "ejfat". When <sys/sdt.h> is found
+ * (systemtap-sdt-dev / systemtap-sdt-devel) each probe compiles to a single nop
+ * plus a note in the ELF file, which eBPF tools such as bpftrace or bcc attach to
+ * at run time. Untraced, a probe costs nothing but that nop.
+ * Define EJFAT_NO_USDT to compile all probes out. Example bpftrace scripts
+ * are in share/ejfat/bpftrace.
+ *
+ * <pre>
+ *   probe                 arguments
+ *   ---------------------------------------------------------------
+ *   packet_send           tick, dataId, offset, bytes
+ *   packet_recv           tick, dataId, offset, bytes
+ *   tick_start            tick, dataId, total bytes
+ *   tick_complete         tick, dataId, bytes
+ *   tick_discard          tick, dataId, total bytes
+ *   supplier_get          supplier, sequence (of item in ring)
+ *   supplier_publish      supplier, sequence (of item in ring)
+ *   supplier_consume      supplier, sequence (of item in ring)
+ *   supplier_release      supplier, sequence (of item in ring)
+ *   et_get_start          number of events wanted
+ *   et_get_done           number of events gotten, ET status
+ *   et_put                number of events, ET status
+ *   lb_state              fill percent x 100, LB shedding (0/1)
+ * </pre>
+ * The supplier argument is the address of the Supplier, so that several in one
+ * program can be told apart.
+ *
+ * List them in a binary with: bpftrace -l 'usdt:./packetBlasteeEtFifoClientNew:ejfat:*'
+ */
+#ifndef EJFAT_PROBES_H
+#define EJFAT_PROBES_H
+
+
+#include <cstdint>
+
+#if !defined(EJFAT_NO_USDT) && defined(__has_include)
+    #if __has_include(<sys/sdt.h>)
+        #include <sys/sdt.h>
+        #define EJFAT_USDT 1
+    #endif
+#endif
+
+
+#ifdef EJFAT_USDT
+    #define EJFAT_PROBE1(name, a)          DTRACE_PROBE1(ejfat, name, a)
+    #define EJFAT_PROBE2(name, a, b)       DTRACE_PROBE2(ejfat, name, a, b)
+    #define EJFAT_PROBE3(name, a, b, c)    DTRACE_PROBE3(ejfat, name, a, b, c)
+    #define EJFAT_PROBE4(name, a, b, c, d) DTRACE_PROBE4(ejfat, name, a, b, c, d)
+#else
+    #define EJFAT_PROBE1(name, a)          do {} while (0)
+    #define EJFAT_PROBE2(name, a, b)       do {} while (0)
+    #define EJFAT_PROBE3(name, a, b, c)    do {} while (0)
+    #define EJFAT_PROBE4(name, a, b, c, d) do {} while (0)
+#endif
+
+
+// Packets
+#define EJFAT_PROBE_PACKET_SEND(tick, dataId, offset, bytes) \
+    EJFAT_PROBE4(packet_send, (uint64_t)(tick), (uint32_t)(dataId), (uint32_t)(offset), (uint32_t)(bytes))
+#define EJFAT_PROBE_PACKET_RECV(tick, dataId, offset, bytes) \
+    EJFAT_PROBE4(packet_recv, (uint64_t)(tick), (uint32_t)(dataId), (uint32_t)(offset), (uint32_t)(bytes))
+
+// Reassembly of ticks
+#define EJFAT_PROBE_TICK_START(tick, dataId, length) \
+    EJFAT_PROBE3(tick_start, (uint64_t)(tick), (uint32_t)(dataId), (uint32_t)(length))
+#define EJFAT_PROBE_TICK_COMPLETE(tick, dataId, bytes) \
+    EJFAT_PROBE3(tick_complete, (uint64_t)(tick), (uint32_t)(dataId), (uint32_t)(bytes))
+#define EJFAT_PROBE_TICK_DISCARD(tick, dataId, length) \
+    EJFAT_PROBE3(tick_discard, (uint64_t)(tick), (uint32_t)(dataId), (uint32_t)(length))
+
+// Supplier ring items
+#define EJFAT_PROBE_SUPPLIER_GET(supply, seq)      EJFAT_PROBE2(supplier_get, (const void *)(supply), (int64_t)(seq))
+#define EJFAT_PROBE_SUPPLIER_PUBLISH(supply, seq)  EJFAT_PROBE2(supplier_publish, (const void *)(supply), (int64_t)(seq))
+#define EJFAT_PROBE_SUPPLIER_CONSUME(supply, seq)  EJFAT_PROBE2(supplier_consume, (const void *)(supply), (int64_t)(seq))
+#define EJFAT_PROBE_SUPPLIER_RELEASE(supply, seq)  EJFAT_PROBE2(supplier_release, (const void *)(supply), (int64_t)(seq))
+
+// ET system
+#define EJFAT_PROBE_ET_GET_START(wanted)    EJFAT_PROBE1(et_get_start, (int32_t)(wanted))
+#define EJFAT_PROBE_ET_GET_DONE(got, err)   EJFAT_PROBE2(et_get_done, (int32_t)(got), (int32_t)(err))
+#define EJFAT_PROBE_ET_PUT(count, err)      EJFAT_PROBE2(et_put, (int32_t)(count), (int32_t)(err))
+
+// State reported to the load balancer
+#define EJFAT_PROBE_LB_STATE(fillPercent, shedding) \
+    EJFAT_PROBE2(lb_state, (int32_t)((fillPercent) * 100), (int32_t)(shedding))
+
+
+#endif // EJFAT_PROBES_H
@@ -0,0 +1,315 @@
+//
+// Copyright 2023, Jefferson Science Associates, LLC.
+// Subject to the terms in the LICENSE file found in the top-level directory.
+//
+// EPSCI Group
+// Thomas Jefferson National Accelerator Facility
+// 12000, Jefferson Ave, Newport News, VA 23606
+// (757)-269-7100
+
+
+/**
+ * @file Contains a stage which takes completed ticks from reassembly threads,
+ * in the order they complete, and delivers them in increasing tick order.
+ * Ticks are held in a fixed size ring indexed by (tick - base) / tickPrescale,
+ * so ordering costs O(1) per tick and memory is bounded. If the next tick in
+ * order does not arrive within a maximum hold time while later ones wait,
+ * it is given up on and delivery skips ahead to the next tick held.
+ * Ticks arriving after their turn was skipped are counted as late and refused.
+ * A tick too far ahead to fit in the ring waits for room; if nothing earlier is
+ * held, delivery skips ahead to it after the hold time (e.g. after a sender restart).
+ * Ticks which are not a multiple of tickPrescale away from the first tick can never
+ * come up in order, so they are refused and counted as misaligned.
+ */
+#ifndef EJFAT_REORDER_H
+#define EJFAT_REORDER_H
+
+
+#include <cstdio>
+#include <cinttypes>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <chrono>
+#include <stdexcept>
+#include <condition_variable>
+
+
+namespace ejfat {
+
+
+    /** Counters of a TickReorderer. */
+    typedef struct reorderStats_t {
+        /** Ticks delivered in order. */
+        int64_t delivered = 0;
+        /** Ticks refused since their turn had passed. */
+        int64_t late = 0;
+        /** Ticks given up on (never arrived within hold time). */
+        int64_t skipped = 0;
+        /** Ticks refused since already held. */
+        int64_t duplicates = 0;
+        /** Ticks refused since not a multiple of tickPrescale from the first tick. */
+        int64_t misaligned = 0;
+        /** Times put() had to wait for room in the ring. */
+        int64_t fullWaits = 0;
+        /** Most ticks held at once. */
+        int64_t maxHeld = 0;
+    } reorderStats;
+
+
+    /**
+     * In-order delivery of reassembled ticks. Any number of threads may put(),
+     * one thread gets.
+     *
+     * @tparam T type of item holding a reassembled buffer (e.g. a shared_ptr).
+     */
+    template<class T>
+    class TickReorderer {
+
+    private:
+
+        /** One place in the ring. */
+        struct Slot {
+            T item;
+            uint64_t tick = 0;
+            bool full = false;
+        };
+
+        /** Ring of held ticks. */
+        std::vector<Slot> ring;
+
+        /** Difference between consecutive ticks. */
+        uint64_t tickPrescale;
+
+        /** Next tick to deliver. */
+        uint64_t head = 0;
+
+        /** Has head been set (by constructor or first tick)? */
+        bool haveHead = false;
+
+        /** Number of ticks held. */
+        size_t held = 0;
+
+        /** Max time to wait for head while later ticks are held. */
+        std::chrono::microseconds maxHold;
+
+        /** When head started holding up later ticks. */
+        std::chrono::steady_clock::time_point blockedSince;
+
+        /** Is head holding up later ticks? */
+        bool blocked = false;
+
+        /** Ticks of put() calls waiting for room in the ring. */
+        std::multiset<uint64_t> waiting;
+
+        reorderStats stats;
+
+        std::mutex mtx;
+        std::condition_variable arrived;
+        std::condition_variable room;
+
+
+    public:
+
+        /**
+         * Constructor.
+         * @param size         number of ticks the ring can hold.
+         * @param tickPrescale difference between consecutive ticks.
+         * @param maxHold      max time to wait for a missing tick while later ones are held.
+         */
+        explicit TickReorderer(size_t size = 1024, uint64_t tickPrescale = 1,
+                               std::chrono::microseconds maxHold = std::chrono::milliseconds(100)) :
+                ring(size > 0 ? size : 1),
+                tickPrescale(tickPrescale > 0 ? tickPrescale : 1),
+                maxHold(maxHold) {}
+
+
+        /**
+         * Set the first tick to deliver. If not called, it is the first tick put.
+         * @param tick first tick.
+         */
+        void setBase(uint64_t tick) {
+            std::lock_guard<std::mutex> lock(mtx);
+            head = tick;
+            haveHead = true;
+        }
+
+
+        /**
+         * Hand over a completed tick. If the ring has no room for it yet,
+         * wait until the consumer delivers or skips enough ticks. Once nothing
+         * earlier is held, the consumer skips ahead to it after the max hold time,
+         * so this only waits longer than that if the consumer is not getting.
+         *
+         * @param tick tick of item.
+         * @param item reassembled buffer, only moved from if taken.
+         * @return true if taken, false if late, duplicate or misaligned (caller keeps item).
+         */
+        bool put(uint64_t tick, T && item) {
+            std::unique_lock<std::mutex> lock(mtx);
+            if (!haveHead) {
+                head = tick;
+                haveHead = true;
+            }
+
+            if (tick < head) {
+                stats.late++;
+                return false;
+            }
+
+            if ((tick - head) % tickPrescale != 0) {
+                stats.misaligned++;
+                return false;
+            }
+
+            if (distance(tick) >= ring.size()) {
+                stats.fullWaits++;
+                auto pos = waiting.insert(tick);
+                // Let the consumer know, it may have to skip ahead for us
+                arrived.notify_one();
+                room.wait(lock, [this, tick]() {return tick < head || distance(tick) < ring.size();});
+                waiting.erase(pos);
+                if (tick < head) {
+                    stats.late++;
+                    return false;
+                }
+            }
+
+            Slot & slot = ring[index(tick)];
+            if (slot.full) {
+                stats.duplicates++;
+                return false;
+            }
+
+            slot.item = std::move(item);
+            slot.tick = tick;
+            slot.full = true;
+            held++;
+            if ((int64_t)held > stats.maxHeld) stats.maxHeld = held;
+
+            arrived.notify_one();
+            return true;
+        }
+
+
+        /**
+         * Get the next tick in order. If the next tick is missing while later ones
+         * are held, or wait to be put, it is skipped once the max hold time has passed.
+         *
+         * @param tick    filled with tick of item.
+         * @param item    filled with item.
+         * @param timeout max time to wait.
+         * @return true if an item was returned, false on timeout.
+         */
+        bool get(uint64_t & tick, T & item, std::chrono::microseconds timeout) {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            std::unique_lock<std::mutex> lock(mtx);
+
+            while (true) {
+                if (haveHead) {
+                    Slot & slot = ring[index(head)];
+                    if (slot.full && slot.tick == head) {
+                        tick = head;
+                        item = std::move(slot.item);
+                        slot.item = T();
+                        slot.full = false;
+                        held--;
+                        head += tickPrescale;
+                        blocked = false;
+                        stats.delivered++;
+                        room.notify_all();
+                        return true;
+                    }
+
+                    if (held > 0 || !waiting.empty()) {
+                        auto now = std::chrono::steady_clock::now();
+                        if (!blocked) {
+                            blocked = true;
+                            blockedSince = now;
+                        }
+                        else if (now - blockedSince >= maxHold) {
+                            if (held > 0) skipToHeld();
+                            else skipTo(*waiting.begin());
+                            room.notify_all();
+                            continue;
+                        }
+                    }
+                }
+
+                auto now = std::chrono::steady_clock::now();
+                if (now >= deadline) return false;
+
+                auto wakeAt = deadline;
+                if (blocked && blockedSince + maxHold < wakeAt) wakeAt = blockedSince + maxHold;
+                arrived.wait_until(lock, wakeAt);
+            }
+        }
+
+
+        /** @return copy of counters. */
+        reorderStats getStats() {
+            std::lock_guard<std::mutex> lock(mtx);
+            return stats;
+        }
+
+
+        /** @return number of ticks held. */
+        size_t getHeld() {
+            std::lock_guard<std::mutex> lock(mtx);
+            return held;
+        }
+
+
+        /**
+         * Print counters.
+         * @param fp file to print to.
+         */
+        void printStats(FILE *fp = stderr) {
+            reorderStats s = getStats();
+            fprintf(fp, "Reorder: delivered %" PRId64 ", late %" PRId64 ", skipped %" PRId64
+                        ", duplicates %" PRId64 ", misaligned %" PRId64 ", full waits %" PRId64
+                        ", max held %" PRId64 "\n",
+                    s.delivered, s.late, s.skipped, s.duplicates, s.misaligned, s.fullWaits, s.maxHeld);
+        }
+
+
+    private:
+
+
+        /** @return number of prescaled ticks from head to tick (tick >= head). */
+        size_t distance(uint64_t tick) const {
+            return (size_t) ((tick - head) / tickPrescale);
+        }
+
+        /** @return ring index of tick. */
+        size_t index(uint64_t tick) const {
+            return (size_t) ((tick / tickPrescale) % ring.size());
+        }
+
+        /** Move head forward to the earliest tick held, counting ticks given up on. */
+        void skipToHeld() {
+            for (size_t i = 0; i < ring.size(); i++) {
+                Slot & slot = ring[index(head)];
+                if (slot.full && slot.tick == head) break;
+                head += tickPrescale;
+                stats.skipped++;
+            }
+            blocked = false;
+        }
+
+        /**
+         * Move head forward to the given tick, which is too far ahead to fit in
+         * the ring while nothing is held, counting ticks given up on.
+         * @param tick new head.
+         */
+        void skipTo(uint64_t tick) {
+            stats.skipped += (int64_t) distance(tick);
+            head = tick;
+            blocked = false;
+        }
+    };
+
+}
+
+
+#endif // EJFAT_REORDER_H
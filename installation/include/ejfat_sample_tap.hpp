@@ -0,0 +1,392 @@
+//
+// Copyright 2023, Jefferson Science Associates, LLC.
+// Subject to the terms in the LICENSE file found in the top-level directory.
+//
+// EPSCI Group
+// Thomas Jefferson National Accelerator Facility
+// 12000, Jefferson Ave, Newport News, VA 23606
+// (757)-269-7100
+
+
+/**
+ * @file Contains a sampling tap for online monitoring of the reassembled stream.
+ * Every Nth tick, or one tick per time interval, is copied into a small ring in
+ * POSIX shared memory, overwriting the oldest sample. Monitoring clients in other
+ * processes read the ring with TapReader. No locks are used: each slot has a
+ * sequence number which is odd while being written (a seqlock), so the main data
+ * path never waits for a reader, and readers detect and discard torn or
+ * overwritten samples. Samples not taken because their slot was busy are counted.
+ */
+#ifndef EJFAT_SAMPLE_TAP_H
+#define EJFAT_SAMPLE_TAP_H
+
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+namespace ejfat {
+
+
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "sample tap needs lock-free 64 bit atomics in shared memory");
+
+
+    /** Start of shared memory of a tap. */
+    typedef struct tapHeader_t {
+        /** TAP_MAGIC once initialized. */
+        uint32_t magic;
+        /** Layout version. */
+        uint32_t version;
+        /** Number of slots in ring. */
+        uint32_t slots;
+        /** Max data bytes per slot. */
+        uint32_t slotBytes;
+        /** Number of samples ever started, slot = index % slots. */
+        std::atomic<uint64_t> writeIndex;
+        /** Ticks offered to the tap. */
+        std::atomic<uint64_t> offered;
+        /** Samples written. */
+        std::atomic<uint64_t> sampled;
+        /** Samples due but not taken since their slot was still being written. */
+        std::atomic<uint64_t> skipped;
+        /** Samples cut to slotBytes. */
+        std::atomic<uint64_t> truncated;
+    } tapHeader;
+
+
+    /** Header of one slot, followed by slotBytes of data. */
+    typedef struct tapSlot_t {
+        /** Odd while being written, else 2 * (index + 1) of sample held. */
+        std::atomic<uint64_t> seq;
+        uint64_t tick;
+        uint64_t nanos;
+        /** Bytes of data held. */
+        uint32_t length;
+        /** Original length of tick's buffer. */
+        uint32_t fullLength;
+        uint16_t dataId;
+        uint16_t pad[3];
+    } tapSlot;
+
+
+    /** Magic number marking an initialized tap ("TAP1"). */
+    static const uint32_t TAP_MAGIC = 0x54415031;
+
+
+    /**
+     * Base of SampleTap and TapReader: the mapped shared memory.
+     */
+    class TapMemory {
+
+    protected:
+
+        std::string name;
+        size_t bytes = 0;
+        void *mem = nullptr;
+        tapHeader *header = nullptr;
+
+        static size_t slotSize(uint32_t slotBytes) {
+            // Keep slots 64-byte aligned so no two share a cache line
+            return (sizeof(tapSlot) + slotBytes + 63) & ~((size_t)63);
+        }
+
+        static size_t totalSize(uint32_t slots, uint32_t slotBytes) {
+            return ((sizeof(tapHeader) + 63) & ~((size_t)63)) + slots * slotSize(slotBytes);
+        }
+
+        tapSlot *slot(uint64_t index) const {
+            char *base = (char *)mem + ((sizeof(tapHeader) + 63) & ~((size_t)63));
+            return (tapSlot *)(base + (index % header->slots) * slotSize(header->slotBytes));
+        }
+
+        static uint8_t *slotData(tapSlot *s) {
+            return (uint8_t *)(s + 1);
+        }
+
+        void unmap() {
+            if (mem != nullptr) munmap(mem, bytes);
+            mem = nullptr;
+            header = nullptr;
+        }
+
+    public:
+
+        ~TapMemory() {unmap();}
+
+        /** @return counters and layout. */
+        const tapHeader *getHeader() const {return header;}
+    };
+
+
+    /**
+     * Writing side of a tap, used by the main data path.
+     * Any number of threads may call offer().
+     */
+    class SampleTap : public TapMemory {
+
+    private:
+
+        /** Sample one out of this many ticks (0 = don't count ticks). */
+        uint64_t prescale;
+
+        /** Sample at most once per this many nanoseconds (0 = don't use time). */
+        uint64_t intervalNanos;
+
+        /** Time of last sample taken. */
+        std::atomic<uint64_t> lastNanos {0};
+
+        static uint64_t now() {
+            return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+    public:
+
+        /**
+         * Constructor. Creates (or replaces) the shared memory.
+         *
+         * @param name      shared memory name, e.g. "/ejfat_tap".
+         * @param slots     number of samples kept.
+         * @param slotBytes max bytes of data kept per sample (longer buffers are cut).
+         * @param prescale  sample one out of this many ticks (0 = use interval only).
+         * @param interval  sample at most once per interval (0 = use prescale only).
+         * @throws std::runtime_error if shared memory cannot be made.
+         */
+        SampleTap(const std::string & name, uint32_t slots = 16, uint32_t slotBytes = 1 << 20,
+                  uint64_t prescale = 1000,
+                  std::chrono::microseconds interval = std::chrono::microseconds(0)) :
+                prescale(prescale),
+                intervalNanos((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(interval).count()) {
+
+            if (slots == 0 || (prescale == 0 && intervalNanos == 0)) {
+                throw std::runtime_error("sample tap needs slots and a prescale or interval");
+            }
+
+            this->name = name;
+            bytes = totalSize(slots, slotBytes);
+
+            int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+            if (fd < 0) {
+                throw std::runtime_error("cannot create shared memory " + name);
+            }
+            if (ftruncate(fd, (off_t) bytes) < 0) {
+                close(fd);
+                throw std::runtime_error("cannot size shared memory " + name);
+            }
+            mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if (mem == MAP_FAILED) {
+                mem = nullptr;
+                throw std::runtime_error("cannot map shared memory " + name);
+            }
+
+            std::memset(mem, 0, bytes);
+            header = (tapHeader *) mem;
+            header->version   = 1;
+            header->slots     = slots;
+            header->slotBytes = slotBytes;
+            std::atomic_thread_fence(std::memory_order_release);
+            header->magic     = TAP_MAGIC;
+        }
+
+        /** Destructor. Unmaps, but leaves shared memory for readers (see {@link #remove}). */
+        ~SampleTap() = default;
+
+        /** Remove the shared memory name. Readers already attached keep their mapping. */
+        void remove() {
+            shm_unlink(name.c_str());
+        }
+
+
+        /**
+         * Offer a reassembled tick. Copies it into the ring if it is due to be sampled.
+         * Never blocks.
+         *
+         * @param tick   tick of buffer.
+         * @param data   reassembled buffer.
+         * @param length bytes in buffer.
+         * @param dataId data source id.
+         * @return true if sampled.
+         */
+        bool offer(uint64_t tick, const void *data, uint32_t length, uint16_t dataId = 0) {
+            uint64_t n = header->offered.fetch_add(1, std::memory_order_relaxed);
+
+            bool due = prescale > 0 && (n % prescale) == 0;
+            uint64_t t = 0;
+            if (intervalNanos > 0) {
+                t = now();
+                uint64_t last = lastNanos.load(std::memory_order_relaxed);
+                if (t - last >= intervalNanos && lastNanos.compare_exchange_strong(last, t)) {
+                    due = true;
+                }
+            }
+            if (!due) return false;
+
+            uint64_t index = header->writeIndex.fetch_add(1, std::memory_order_relaxed);
+            tapSlot *s = slot(index);
+
+            // Claim slot: must be idle (even). If another writer is still in it, give up.
+            uint64_t seq = s->seq.load(std::memory_order_relaxed);
+            if ((seq & 1) || !s->seq.compare_exchange_strong(seq, seq | 1, std::memory_order_acquire)) {
+                header->skipped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            std::atomic_thread_fence(std::memory_order_release);
+
+            uint32_t copy = length;
+            if (copy > header->slotBytes) {
+                copy = header->slotBytes;
+                header->truncated.fetch_add(1, std::memory_order_relaxed);
+            }
+            s->tick = tick;
+            s->nanos = t != 0 ? t : now();
+            s->length = copy;
+            s->fullLength = length;
+            s->dataId = dataId;
+            std::memcpy(slotData(s), data, copy);
+
+            s->seq.store(2 * (index + 1), std::memory_order_release);
+            header->sampled.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    };
+
+
+    /**
+     * Reading side of a tap, used by monitoring clients. Each reader keeps its own position.
+     */
+    class TapReader : public TapMemory {
+
+    private:
+
+        /** Index of next sample to read. */
+        uint64_t next = 0;
+
+        /** Samples overwritten before this reader got to them. */
+        uint64_t missed = 0;
+
+    public:
+
+        /** One sample. */
+        struct Sample {
+            uint64_t tick;
+            uint64_t nanos;
+            uint32_t fullLength;
+            uint16_t dataId;
+            std::vector<uint8_t> data;
+        };
+
+        /**
+         * Constructor. Attaches to an existing tap and starts at its newest sample.
+         * @param name shared memory name given to SampleTap.
+         * @throws std::runtime_error if tap does not exist.
+         */
+        explicit TapReader(const std::string & name) {
+            this->name = name;
+            int fd = shm_open(name.c_str(), O_RDONLY, 0);
+            if (fd < 0) {
+                throw std::runtime_error("no sample tap " + name);
+            }
+            struct stat st;
+            if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(tapHeader)) {
+                close(fd);
+                throw std::runtime_error("bad sample tap " + name);
+            }
+            bytes = (size_t) st.st_size;
+            mem = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (mem == MAP_FAILED) {
+                mem = nullptr;
+                throw std::runtime_error("cannot map sample tap " + name);
+            }
+
+            header = (tapHeader *) mem;
+            if (header->magic != TAP_MAGIC || totalSize(header->slots, header->slotBytes) > bytes) {
+                unmap();
+                throw std::runtime_error("sample tap " + name + " not initialized");
+            }
+            uint64_t w = header->writeIndex.load(std::memory_order_acquire);
+            next = w > 0 ? w - 1 : 0;
+        }
+
+
+        /**
+         * Read the next sample, if there is one.
+         * @param sample filled with sample.
+         * @return true if a sample was read, false if none is ready.
+         */
+        bool read(Sample & sample) {
+            while (true) {
+                uint64_t w = header->writeIndex.load(std::memory_order_acquire);
+                if (next >= w) return false;
+
+                // Fell behind writer?
+                if (w - next > header->slots) {
+                    missed += w - next - header->slots;
+                    next = w - header->slots;
+                }
+
+                tapSlot *s = slot(next);
+                uint64_t want = 2 * (next + 1);
+                uint64_t seq1 = s->seq.load(std::memory_order_acquire);
+                if (seq1 < want) {
+                    // Not written yet (or writer gave up on it)
+                    if ((seq1 & 1) || w - next <= 1) return false;
+                    missed++;
+                    next++;
+                    continue;
+                }
+                if (seq1 != want) {
+                    // Already overwritten
+                    missed++;
+                    next++;
+                    continue;
+                }
+
+                sample.tick = s->tick;
+                sample.nanos = s->nanos;
+                sample.fullLength = s->fullLength;
+                sample.dataId = s->dataId;
+                uint32_t len = s->length <= header->slotBytes ? s->length : header->slotBytes;
+                sample.data.assign(slotData(s), slotData(s) + len);
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                uint64_t seq2 = s->seq.load(std::memory_order_relaxed);
+                next++;
+                if (seq2 == seq1) return true;
+                missed++;
+            }
+        }
+
+
+        /** @return samples this reader missed since they were overwritten. */
+        uint64_t getMissed() const {return missed;}
+
+
+        /**
+         * Print tap counters.
+         * @param fp file to print to.
+         */
+        void printStats(FILE *fp = stderr) const {
+            fprintf(fp, "Sample tap %s: offered %" PRIu64 ", sampled %" PRIu64 ", skipped %" PRIu64
+                        ", truncated %" PRIu64 ", missed by reader %" PRIu64 "\n",
+                    name.c_str(), header->offered.load(), header->sampled.load(),
+                    header->skipped.load(), header->truncated.load(), missed);
+        }
+    };
+
+}
+
+
+#endif // EJFAT_SAMPLE_TAP_H
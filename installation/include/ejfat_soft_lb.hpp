@@ -0,0 +1,386 @@
+//
+// Copyright 2023, Jefferson Science Associates, LLC.
+// Subject to the terms in the LICENSE file found in the top-level directory.
+//
+// EPSCI Group
+// Thomas Jefferson National Accelerator Facility
+// 12000, Jefferson Ave, Newport News, VA 23606
+// (757)-269-7100
+
+
+/**
+ * @file Contains a load balancer implemented in the sender, for test beds and
+ * sites without the FPGA load balancer. Like the FPGA, it keeps a calendar of
+ * backends in which each backend has a number of slots proportional to its weight.
+ * Each tick picks a slot, and so a backend host, and the entropy picks one of the
+ * backend's ports. Packets then go straight to the backend (no LB header) over a
+ * UDP socket connected to that host:port, so a whole backend farm can be
+ * exercised without special hardware.
+ * The backends and weights come from a static config file or from the backend
+ * list of the (simulated) control plane.
+ */
+#ifndef EJFAT_SOFT_LB_H
+#define EJFAT_SOFT_LB_H
+
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "ejfat_packetize.hpp"
+
+
+namespace ejfat {
+
+
+    /** One backend of the software load balancer. */
+    typedef struct softLbBackend_t {
+        /** Host name or IP address. */
+        std::string host;
+        /** First data port. */
+        uint16_t port = 0;
+        /** Backend uses 2^portRange ports starting at port. */
+        uint32_t portRange = 0;
+        /** Relative weight (0 = gets nothing). */
+        uint32_t weight = 1;
+        /** One socket connected to each port. */
+        std::vector<int> sockets;
+        /** Number of buffers sent. */
+        int64_t buffers = 0;
+        /** Number of packets sent. */
+        int64_t packets = 0;
+        /** Number of data bytes sent. */
+        int64_t bytes = 0;
+    } softLbBackend;
+
+
+    /**
+     * Load balancer run by the sender itself.
+     * Not thread safe: one object per sending thread, or lock around it.
+     */
+    class SoftLb {
+
+    private:
+
+        /** Backends. */
+        std::vector<softLbBackend> backends;
+
+        /** Index of backend for each calendar slot. */
+        std::vector<uint32_t> calendar;
+
+        /** Number of calendar slots. */
+        size_t slots;
+
+        /** Difference between consecutive ticks, so all slots get used. */
+        uint64_t tickPrescale;
+
+        /** Send buffer size of each socket in bytes. */
+        int sendBufBytes;
+
+        bool debug;
+
+
+    public:
+
+        /**
+         * Constructor.
+         * @param slots        number of calendar slots (the FPGA uses 512).
+         * @param tickPrescale difference between consecutive ticks sent.
+         * @param sendBufBytes send buffer size of each socket in bytes.
+         * @param debug        print out what's happening.
+         */
+        explicit SoftLb(size_t slots = 512, uint64_t tickPrescale = 1,
+                        int sendBufBytes = 25000000, bool debug = false) :
+                slots(slots > 0 ? slots : 512),
+                tickPrescale(tickPrescale > 0 ? tickPrescale : 1),
+                sendBufBytes(sendBufBytes), debug(debug) {}
+
+        ~SoftLb() {
+            disconnect();
+        }
+
+        SoftLb(const SoftLb&) = delete;
+        SoftLb& operator=(const SoftLb&) = delete;
+
+
+        /**
+         * Add a backend. Call {@link #connect} afterwards.
+         * @param host      host name or IP address.
+         * @param port      first data port.
+         * @param portRange backend uses 2^portRange ports starting at port (0 - 14).
+         * @param weight    relative weight.
+         */
+        void addBackend(const std::string & host, uint16_t port, uint32_t portRange = 0, uint32_t weight = 1) {
+            if (portRange > 14) {
+                throw std::runtime_error("port range of " + host + " too large");
+            }
+            softLbBackend be;
+            be.host = host;
+            be.port = port;
+            be.portRange = portRange;
+            be.weight = weight;
+            backends.push_back(std::move(be));
+        }
+
+
+        /**
+         * Read backends from a file with one backend per line:
+         * <pre>
+         *   # host        port   portRange  weight
+         *   192.168.1.10  17750  2          3
+         *   192.168.1.11  17750  2          1
+         * </pre>
+         * The portRange and weight are optional (default 0 and 1).
+         * Everything after '#' is a comment.
+         * Previously added backends are removed. Call {@link #connect} afterwards.
+         *
+         * @param fileName name of config file.
+         * @throws std::runtime_error if file cannot be read or has a bad line.
+         */
+        void loadConfig(const std::string & fileName) {
+            std::ifstream in(fileName);
+            if (!in) {
+                throw std::runtime_error("cannot read " + fileName);
+            }
+
+            disconnect();
+            backends.clear();
+
+            std::string line;
+            int lineNum = 0;
+            while (std::getline(in, line)) {
+                lineNum++;
+                line = line.substr(0, line.find('#'));
+                std::istringstream ss(line);
+                std::string host;
+                if (!(ss >> host)) continue;
+
+                uint32_t port, portRange = 0, weight = 1;
+                if (!(ss >> port) || port > 65535) {
+                    throw std::runtime_error(fileName + ":" + std::to_string(lineNum) + ": bad port");
+                }
+                ss >> portRange >> weight;
+                addBackend(host, (uint16_t) port, portRange, weight);
+            }
+        }
+
+
+        /**
+         * Take the backends registered with the control plane,
+         * e.g. LoadBalancerServiceImpl::getBackEnds() of lb_cplane.h.
+         * Inactive or unready backends are skipped. A backend's weight is
+         * the percentage of its buffers still free, so that full backends
+         * get less data. Previously added backends are removed.
+         * Call {@link #connect} afterwards.
+         *
+         * @param cpBackends map of name to BackEnd.
+         */
+        template<class BackEndMap>
+        void setFromControlPlane(const BackEndMap & cpBackends) {
+            disconnect();
+            backends.clear();
+
+            for (auto const & entry : cpBackends) {
+                auto const & be = entry.second;
+                if (!be.getIsActive() || !be.getIsReady()) continue;
+                float free = 100.F - be.getFillPercent();
+                uint32_t weight = free < 1.F ? 1 : (uint32_t) free;
+                addBackend(be.getTargetIP(), (uint16_t) be.getTargetPort(), be.getTargetPortRange(), weight);
+            }
+        }
+
+
+        /**
+         * Fill the calendar and connect a UDP socket to each port of each backend.
+         * @return 0 if OK, -1 if a socket could not be made or connected.
+         */
+        int connect() {
+            disconnect();
+            fillCalendar();
+
+            for (auto & be : backends) {
+                uint32_t ports = 1U << be.portRange;
+                for (uint32_t i = 0; i < ports; i++) {
+                    int sock = connectSocket(be.host, (uint16_t) (be.port + i));
+                    if (sock < 0) {
+                        disconnect();
+                        return -1;
+                    }
+                    be.sockets.push_back(sock);
+                }
+                if (debug) fprintf(stderr, "SoftLb: %s:%hu, %u ports, weight %u\n",
+                                   be.host.c_str(), be.port, ports, be.weight);
+            }
+            return 0;
+        }
+
+
+        /** Close all sockets. */
+        void disconnect() {
+            for (auto & be : backends) {
+                for (int sock : be.sockets) close(sock);
+                be.sockets.clear();
+            }
+        }
+
+
+        /**
+         * Get the backend that receives a tick.
+         * @param tick tick.
+         * @return index of backend.
+         */
+        uint32_t backendOf(uint64_t tick) const {
+            return calendar[(tick / tickPrescale) % calendar.size()];
+        }
+
+
+        /**
+         * Get the connected socket for a tick and entropy.
+         * @param tick    tick.
+         * @param entropy entropy, picks the backend's port.
+         * @return socket.
+         */
+        int socketOf(uint64_t tick, int entropy) const {
+            auto const & be = backends[backendOf(tick)];
+            return be.sockets[(uint32_t) entropy & (be.sockets.size() - 1)];
+        }
+
+
+        /**
+         * Send a whole buffer to the backend of its tick, broken into packets
+         * with an RE header only.
+         *
+         * @param dataBuffer    data to send.
+         * @param dataLen       number of bytes to send.
+         * @param maxUdpPayload max data bytes in one packet.
+         * @param tick          tick of buffer.
+         * @param entropy       entropy of buffer, picks the backend's port.
+         * @param version       version of this software.
+         * @param dataId        data source id.
+         * @param delay         microseconds to wait between packets.
+         * @param delayPrescale wait only once per this many packets.
+         * @param delayCounter  counter of packets for delayPrescale.
+         * @return 0 if OK, else error from sendPacketizedBufferSendNew.
+         */
+        int send(const char* dataBuffer, size_t dataLen, int maxUdpPayload,
+                 uint64_t tick, int entropy, int version, uint16_t dataId,
+                 uint32_t delay = 0, uint32_t delayPrescale = 1, uint32_t *delayCounter = nullptr) {
+
+            auto & be = backends[backendOf(tick)];
+            int sock = be.sockets[(uint32_t) entropy & (be.sockets.size() - 1)];
+
+            uint32_t offset = 0, counter = 0;
+            int64_t packets = 0;
+            int err = sendPacketizedBufferSendNew(dataBuffer, dataLen, maxUdpPayload, sock,
+                                                  tick, 1, entropy, version, dataId, (uint32_t) dataLen,
+                                                  &offset, delay, delayPrescale,
+                                                  delayCounter != nullptr ? delayCounter : &counter,
+                                                  true, true, debug, true, &packets);
+            if (err < 0) return err;
+
+            be.buffers++;
+            be.packets += packets;
+            be.bytes   += (int64_t) dataLen;
+            return 0;
+        }
+
+
+        /** @return backends. */
+        const std::vector<softLbBackend> & getBackends() const {return backends;}
+
+        /** @return calendar, the index of the backend of each slot. */
+        const std::vector<uint32_t> & getCalendar() const {return calendar;}
+
+
+        /**
+         * Print the backends and what each was sent.
+         * @param fp file to print to.
+         */
+        void printStats(FILE *fp = stderr) const {
+            for (size_t i = 0; i < backends.size(); i++) {
+                auto const & be = backends[i];
+                fprintf(fp, "SoftLb backend %zu (%s:%hu): weight %u, buffers %" PRId64
+                            ", packets %" PRId64 ", bytes %" PRId64 "\n",
+                        i, be.host.c_str(), be.port, be.weight, be.buffers, be.packets, be.bytes);
+            }
+        }
+
+
+    private:
+
+
+        /**
+         * Fill the calendar with smooth weighted round robin, so that each backend
+         * gets slots in proportion to its weight, spread evenly over the calendar.
+         * @throws std::runtime_error if no backend has a weight.
+         */
+        void fillCalendar() {
+            int64_t total = 0;
+            for (auto const & be : backends) total += be.weight;
+            if (total == 0) {
+                throw std::runtime_error("no backend to send to");
+            }
+
+            std::vector<int64_t> current(backends.size(), 0);
+            calendar.resize(slots);
+            for (size_t s = 0; s < slots; s++) {
+                size_t best = 0;
+                for (size_t i = 0; i < backends.size(); i++) {
+                    current[i] += backends[i].weight;
+                    if (current[i] > current[best]) best = i;
+                }
+                current[best] -= total;
+                calendar[s] = (uint32_t) best;
+            }
+        }
+
+
+        /**
+         * Make a UDP socket connected to host:port (IPv4 or IPv6).
+         * @return socket, or -1 on error.
+         */
+        int connectSocket(const std::string & host, uint16_t port) {
+            struct addrinfo hints, *res;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family   = AF_UNSPEC;
+            hints.ai_socktype = SOCK_DGRAM;
+
+            std::string service = std::to_string(port);
+            if (getaddrinfo(host.c_str(), service.c_str(), &hints, &res) != 0) {
+                fprintf(stderr, "SoftLb: cannot resolve %s\n", host.c_str());
+                return -1;
+            }
+
+            int sock = socket(res->ai_family, SOCK_DGRAM, 0);
+            if (sock < 0) {
+                perror("SoftLb: creating client socket");
+                freeaddrinfo(res);
+                return -1;
+            }
+
+            setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sendBufBytes, sizeof(sendBufBytes));
+
+            if (::connect(sock, res->ai_addr, res->ai_addrlen) < 0) {
+                if (debug) perror("SoftLb: error connecting UDP socket");
+                close(sock);
+                sock = -1;
+            }
+            freeaddrinfo(res);
+            return sock;
+        }
+    };
+
+}
+
+
+#endif // EJFAT_SOFT_LB_H
@@ -0,0 +1,494 @@
+
+
+#ifndef ERSAP_ENGINE_PROFILER_HPP
+#define ERSAP_ENGINE_PROFILER_HPP
+
+#include <ersap/engine.hpp>
+#include <ersap/third_party/json11.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace ersap {
+
+/**
+ * Latency histogram and counters of one engine or serializer.
+ * Latencies go into power-of-two microsecond buckets: bucket 0 counts
+ * calls under 1 us, bucket i counts calls in [2^(i-1), 2^i) us.
+ * All counters are relaxed atomics, updated by every worker thread.
+ */
+class ExecutionStats
+{
+public:
+    static constexpr int BUCKETS = 32;
+
+    using clock = std::chrono::steady_clock;
+
+    ExecutionStats()
+    {
+        for (auto& b : histogram_) {
+            b = 0;
+        }
+    }
+
+    ExecutionStats(const ExecutionStats&) = delete;
+    ExecutionStats& operator=(const ExecutionStats&) = delete;
+
+public:
+    /**
+     * Marks the start of a call.
+     * Returns the start time to be passed to {@link #end}.
+     */
+    clock::time_point begin()
+    {
+        auto active = active_.fetch_add(1, std::memory_order_relaxed) + 1;
+        auto max = max_active_.load(std::memory_order_relaxed);
+        while (active > max && !max_active_.compare_exchange_weak(max, active)) {
+            // retry
+        }
+        return clock::now();
+    }
+
+    /**
+     * Marks the end of a call that started at the given time.
+     */
+    void end(clock::time_point start, uint64_t items = 1)
+    {
+        auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                clock::now() - start).count();
+        active_.fetch_sub(1, std::memory_order_relaxed);
+        add(static_cast<uint64_t>(nanos), items);
+    }
+
+    /**
+     * Records a call of the given duration.
+     */
+    void add(uint64_t nanos, uint64_t items = 1)
+    {
+        calls_.fetch_add(1, std::memory_order_relaxed);
+        items_.fetch_add(items, std::memory_order_relaxed);
+        busy_nanos_.fetch_add(nanos, std::memory_order_relaxed);
+        histogram_[bucket(nanos)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void clear()
+    {
+        calls_ = 0;
+        items_ = 0;
+        busy_nanos_ = 0;
+        max_active_ = active_.load();
+        for (auto& b : histogram_) {
+            b = 0;
+        }
+        start_nanos_.store(now_nanos(), std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns the counters as a JSON object.
+     * Throughput and utilization are averaged since the last {@link #clear}.
+     * Utilization is the average number of threads busy in this engine.
+     */
+    json11::Json to_json() const
+    {
+        auto secs = (now_nanos() - start_nanos_.load(std::memory_order_relaxed)) / 1e9;
+        auto calls = calls_.load(std::memory_order_relaxed);
+        auto busy = busy_nanos_.load(std::memory_order_relaxed);
+
+        json11::Json::array hist;
+        int last = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            if (histogram_[i].load(std::memory_order_relaxed) > 0) {
+                last = i + 1;
+            }
+        }
+        for (int i = 0; i < last; i++) {
+            hist.push_back(static_cast<double>(histogram_[i].load(std::memory_order_relaxed)));
+        }
+
+        return json11::Json::object {
+            {"calls", static_cast<double>(calls)},
+            {"items", static_cast<double>(items_.load(std::memory_order_relaxed))},
+            {"items_per_sec", secs > 0 ? items_.load(std::memory_order_relaxed) / secs : 0.},
+            {"avg_latency_us", calls > 0 ? busy / 1e3 / calls : 0.},
+            {"latency_hist_log2_us", hist},
+            {"utilization", secs > 0 ? busy / 1e9 / secs : 0.},
+            {"active", active_.load(std::memory_order_relaxed)},
+            {"max_active", max_active_.load(std::memory_order_relaxed)},
+        };
+    }
+
+private:
+    static int64_t now_nanos()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                clock::now().time_since_epoch()).count();
+    }
+
+    static int bucket(uint64_t nanos)
+    {
+        uint64_t micros = nanos / 1000;
+        int b = 0;
+        while (micros > 0 && b < BUCKETS - 1) {
+            micros >>= 1;
+            b++;
+        }
+        return b;
+    }
+
+private:
+    std::atomic<uint64_t> calls_{0};
+    std::atomic<uint64_t> items_{0};
+    std::atomic<uint64_t> busy_nanos_{0};
+    std::atomic<int> active_{0};
+    std::atomic<int> max_active_{0};
+    std::array<std::atomic<uint64_t>, BUCKETS> histogram_;
+    std::atomic<int64_t> start_nanos_{now_nanos()};
+};
+
+
+/**
+ * Registry of the execution and serialization statistics of all profiled
+ * engines and data types of the process.
+ *
+ * Profiling is off unless the <code>ERSAP_PROFILE</code> environment
+ * variable is set, or {@link #set_enabled} is called. When off, the
+ * profiling wrappers only test one flag before forwarding each call.
+ * If <code>ERSAP_PROFILE_FILE</code> is set, the JSON report is also
+ * rewritten to that file every <code>ERSAP_PROFILE_PERIOD</code> seconds
+ * (default 10), so local tools can read it.
+ */
+class EngineProfiler
+{
+public:
+    static EngineProfiler& instance()
+    {
+        static EngineProfiler profiler;
+        return profiler;
+    }
+
+    EngineProfiler(const EngineProfiler&) = delete;
+    EngineProfiler& operator=(const EngineProfiler&) = delete;
+
+    ~EngineProfiler()
+    {
+        stop_dump();
+    }
+
+public:
+    bool enabled() const
+    {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    void set_enabled(bool enabled)
+    {
+        enabled_.store(enabled, std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns the execution statistics of the named engine.
+     * The returned object lives as long as the process.
+     */
+    ExecutionStats& engine(const std::string& name)
+    {
+        return find(engines_, name);
+    }
+
+    /**
+     * Returns the serialization statistics of the named data type.
+     * The returned object lives as long as the process.
+     */
+    ExecutionStats& serializer(const std::string& mime_type)
+    {
+        return find(serializers_, mime_type);
+    }
+
+    /**
+     * Returns a JSON report with one entry per engine and per data type.
+     */
+    json11::Json to_json()
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        json11::Json::object engines;
+        for (const auto& e : engines_) {
+            engines[e.first] = e.second->to_json();
+        }
+        json11::Json::object serializers;
+        for (const auto& s : serializers_) {
+            serializers[s.first] = s.second->to_json();
+        }
+        return json11::Json::object {
+            {"engines", engines},
+            {"serialization", serializers},
+        };
+    }
+
+    /**
+     * Writes the JSON report to the given file.
+     * The file is replaced atomically, so readers never see a partial report.
+     */
+    bool write(const std::string& path)
+    {
+        auto tmp = path + ".tmp";
+        FILE* fp = fopen(tmp.c_str(), "w");
+        if (fp == nullptr) {
+            return false;
+        }
+        auto report = to_json().dump();
+        fwrite(report.data(), 1, report.size(), fp);
+        fclose(fp);
+        return std::rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+    /**
+     * Starts a thread that writes the JSON report to the given file periodically.
+     */
+    void start_dump(const std::string& path, int period_secs)
+    {
+        std::lock_guard<std::mutex> lock{dump_mutex_};
+        if (dumping_) {
+            return;
+        }
+        dumping_ = true;
+        dump_thread_ = std::thread{[this, path, period_secs]() {
+            std::unique_lock<std::mutex> lock{dump_mutex_};
+            while (dumping_) {
+                dump_cond_.wait_for(lock, std::chrono::seconds(period_secs));
+                lock.unlock();
+                write(path);
+                lock.lock();
+            }
+        }};
+    }
+
+    void stop_dump()
+    {
+        {
+            std::lock_guard<std::mutex> lock{dump_mutex_};
+            if (!dumping_) {
+                return;
+            }
+            dumping_ = false;
+        }
+        dump_cond_.notify_all();
+        if (dump_thread_.joinable()) {
+            dump_thread_.join();
+        }
+    }
+
+private:
+    using StatsList = std::vector<std::pair<std::string, std::unique_ptr<ExecutionStats>>>;
+
+    EngineProfiler()
+    {
+        enabled_ = std::getenv("ERSAP_PROFILE") != nullptr;
+        const char* file = std::getenv("ERSAP_PROFILE_FILE");
+        if (file != nullptr) {
+            const char* period = std::getenv("ERSAP_PROFILE_PERIOD");
+            int secs = period != nullptr ? std::atoi(period) : 10;
+            enabled_ = true;
+            start_dump(file, secs > 0 ? secs : 10);
+        }
+    }
+
+    ExecutionStats& find(StatsList& list, const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        for (auto& e : list) {
+            if (e.first == name) {
+                return *e.second;
+            }
+        }
+        list.emplace_back(name, std::make_unique<ExecutionStats>());
+        return *list.back().second;
+    }
+
+private:
+    std::atomic<bool> enabled_{false};
+    std::mutex mutex_;
+    StatsList engines_;
+    StatsList serializers_;
+
+    std::mutex dump_mutex_;
+    std::condition_variable dump_cond_;
+    std::thread dump_thread_;
+    bool dumping_ = false;
+};
+
+
+/**
+ * A serializer that times the serializer of another data type.
+ */
+class ProfiledSerializer : public Serializer
+{
+public:
+    explicit ProfiledSerializer(const EngineDataType& data_type)
+      : data_type_{data_type}
+      , stats_{EngineProfiler::instance().serializer(data_type.mime_type())}
+    {
+        // nothing
+    }
+
+    std::vector<std::uint8_t> write(const any& data) const override
+    {
+        if (!EngineProfiler::instance().enabled()) {
+            return data_type_.serializer()->write(data);
+        }
+        auto start = stats_.begin();
+        auto buffer = data_type_.serializer()->write(data);
+        stats_.end(start);
+        return buffer;
+    }
+
+    any read(const std::vector<std::uint8_t>& buffer) const override
+    {
+        if (!EngineProfiler::instance().enabled()) {
+            return data_type_.serializer()->read(buffer);
+        }
+        auto start = stats_.begin();
+        auto data = data_type_.serializer()->read(buffer);
+        stats_.end(start);
+        return data;
+    }
+
+private:
+    EngineDataType data_type_;
+    ExecutionStats& stats_;
+};
+
+
+/**
+ * Returns a copy of the given data type whose serialization is profiled.
+ */
+inline EngineDataType profiled(const EngineDataType& data_type)
+{
+    return EngineDataType{data_type.mime_type(),
+                          std::make_unique<ProfiledSerializer>(data_type)};
+}
+
+
+/**
+ * An engine that profiles the execution of another engine.
+ *
+ * Every call to <code>execute</code> and <code>execute_group</code> is timed
+ * into the {@link ExecutionStats} registered under the engine name.
+ * The reported input and output data types are wrapped so that the time the
+ * DPE spends serializing them is recorded per mime-type too.
+ * A service library enables profiling by returning
+ * <code>std::make_unique<ProfiledEngine>(std::make_unique<MyEngine>())</code>
+ * from its <code>create_engine</code> function.
+ */
+class ProfiledEngine : public Engine
+{
+public:
+    explicit ProfiledEngine(std::unique_ptr<Engine>&& engine)
+      : engine_{std::move(engine)}
+      , stats_{EngineProfiler::instance().engine(engine_->name())}
+    {
+        // nothing
+    }
+
+    const ExecutionStats& stats() const
+    {
+        return stats_;
+    }
+
+public:
+    EngineData configure(EngineData& input) override
+    {
+        return engine_->configure(input);
+    }
+
+    EngineData execute(EngineData& input) override
+    {
+        if (!EngineProfiler::instance().enabled()) {
+            return engine_->execute(input);
+        }
+        auto start = stats_.begin();
+        auto output = engine_->execute(input);
+        stats_.end(start);
+        return output;
+    }
+
+    EngineData execute_group(const std::vector<EngineData>& inputs) override
+    {
+        if (!EngineProfiler::instance().enabled()) {
+            return engine_->execute_group(inputs);
+        }
+        auto start = stats_.begin();
+        auto output = engine_->execute_group(inputs);
+        stats_.end(start, inputs.size());
+        return output;
+    }
+
+public:
+    std::vector<EngineDataType> input_data_types() const override
+    {
+        return wrap(engine_->input_data_types());
+    }
+
+    std::vector<EngineDataType> output_data_types() const override
+    {
+        return wrap(engine_->output_data_types());
+    }
+
+    std::set<std::string> states() const override
+    {
+        return engine_->states();
+    }
+
+public:
+    std::string name() const override
+    {
+        return engine_->name();
+    }
+
+    std::string author() const override
+    {
+        return engine_->author();
+    }
+
+    std::string description() const override
+    {
+        return engine_->description();
+    }
+
+    std::string version() const override
+    {
+        return engine_->version();
+    }
+
+public:
+    void reset() override
+    {
+        engine_->reset();
+    }
+
+private:
+    static std::vector<EngineDataType> wrap(const std::vector<EngineDataType>& types)
+    {
+        std::vector<EngineDataType> wrapped;
+        for (const auto& dt : types) {
+            wrapped.push_back(profiled(dt));
+        }
+        return wrapped;
+    }
+
+private:
+    std::unique_ptr<Engine> engine_;
+    ExecutionStats& stats_;
+};
+
+} // end namespace ersap
+
+#endif // end of include guard: ERSAP_ENGINE_PROFILER_HPP
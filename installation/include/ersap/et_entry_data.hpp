@@ -0,0 +1,267 @@
+
+
+#ifndef ERSAP_ET_ENTRY_DATA_HPP
+#define ERSAP_ET_ENTRY_DATA_HPP
+
+#include <ersap/engine_data_type.hpp>
+#include <ersap/serializer.hpp>
+
+#include "et_fifo.h"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ersap {
+
+/**
+ * A fifo entry borrowed from an ET system, passed between engines without copying
+ * when they run inside one {@link FusedEngine}.
+ *
+ * The entry's buffers stay in ET's shared memory. Copies of this object share
+ * the entry, and releasing the last copy puts the entry back into ET with
+ * <code>et_fifo_putEntry</code>. The stages of a fused engine can therefore read
+ * (and modify) the data in place. An engine keeping data beyond its request must
+ * keep a copy of this object, which holds back the entry from ET for that long.
+ *
+ * The C++ DPE has no shared memory path between services: it serializes every
+ * service output and sends it over xmsg, even to a service in the same DPE.
+ * So at each service boundary the {@link EtEntrySerializer} copies the buffers,
+ * the entry goes back to ET when the request ends, and the deserialized object
+ * owns its memory instead.
+ */
+class EtEntryData
+{
+public:
+    /**
+     * A view of one buffer of the entry.
+     */
+    struct Buffer
+    {
+        std::uint8_t* data;
+        std::size_t length;
+        int id;
+    };
+
+    EtEntryData() = default;
+
+    /**
+     * Takes ownership of an entry obtained with <code>et_fifo_getEntry</code>
+     * from an entry made by <code>et_fifo_entryCreate</code>.
+     * The entry is put back into ET and freed when the last copy is released.
+     */
+    explicit EtEntryData(et_fifo_entry* entry)
+      : entry_{entry, release}
+    {
+        auto count = et_fifo_getEntryCapacity(entry->fid);
+        auto** bufs = et_fifo_getBufs(entry);
+        for (int i = 0; i < count; ++i) {
+            if (!et_fifo_hasData(bufs[i])) {
+                continue;
+            }
+            void* data;
+            std::size_t length;
+            et_event_getdata(bufs[i], &data);
+            et_event_getlength(bufs[i], &length);
+            buffers_.push_back(Buffer{static_cast<std::uint8_t*>(data), length,
+                                      et_fifo_getId(bufs[i])});
+        }
+    }
+
+    /**
+     * Makes an object owning copies of the given buffers (ids and data).
+     */
+    explicit EtEntryData(std::vector<std::pair<int, std::vector<std::uint8_t>>>&& owned)
+      : owned_{std::make_shared<Owned>(std::move(owned))}
+    {
+        for (auto& buf : *owned_) {
+            buffers_.push_back(Buffer{buf.second.data(), buf.second.size(), buf.first});
+        }
+    }
+
+public:
+    /**
+     * Gets the next fifo entry from ET, waiting at most the given time.
+     *
+     * @param fid the consumer fifo id
+     * @param timeout the time to wait, or nullptr to wait forever
+     * @return the entry, or an empty object if it timed out
+     * @throws std::runtime_error on any other ET error
+     */
+    static EtEntryData get(et_fifo_id fid, struct timespec* timeout = nullptr)
+    {
+        auto* entry = et_fifo_entryCreate(fid);
+        if (entry == nullptr) {
+            throw std::runtime_error{"cannot create fifo entry"};
+        }
+        int err = (timeout == nullptr) ? et_fifo_getEntry(fid, entry)
+                                       : et_fifo_getEntryTO(fid, entry, timeout);
+        if (err != ET_OK) {
+            et_fifo_freeEntry(entry);
+            if (err == ET_ERROR_TIMEOUT) {
+                return EtEntryData{};
+            }
+            throw std::runtime_error{std::string{"cannot get fifo entry: "} + et_perror(err)};
+        }
+        return EtEntryData{entry};
+    }
+
+public:
+    /**
+     * Returns the buffers that have data, in the order of the entry.
+     */
+    const std::vector<Buffer>& buffers() const
+    {
+        return buffers_;
+    }
+
+    /**
+     * Returns the buffer with the given source id, or nullptr if there is none.
+     */
+    const Buffer* buffer(int id) const
+    {
+        for (const auto& buf : buffers_) {
+            if (buf.id == id) {
+                return &buf;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Checks if the data is still in ET (not copied).
+     */
+    bool borrowed() const
+    {
+        return entry_ != nullptr;
+    }
+
+    /**
+     * Returns the borrowed fifo entry, or nullptr.
+     */
+    et_fifo_entry* entry() const
+    {
+        return entry_.get();
+    }
+
+    bool empty() const
+    {
+        return buffers_.empty();
+    }
+
+    /**
+     * Returns how many copies of this object share the borrowed entry.
+     */
+    long use_count() const
+    {
+        return entry_.use_count();
+    }
+
+private:
+    using Owned = std::vector<std::pair<int, std::vector<std::uint8_t>>>;
+
+    static void release(et_fifo_entry* entry)
+    {
+        et_fifo_putEntry(entry);
+        et_fifo_freeEntry(entry);
+    }
+
+private:
+    std::shared_ptr<et_fifo_entry> entry_;
+    std::shared_ptr<Owned> owned_;
+    std::vector<Buffer> buffers_;
+};
+
+
+/**
+ * Copies the buffers of an {@link EtEntryData} when it must be sent to
+ * another process.
+ * The format is the number of buffers, followed by the id, length and
+ * data of each buffer (integers in native byte order).
+ */
+class EtEntrySerializer : public Serializer
+{
+public:
+    std::vector<std::uint8_t> write(const any& data) const override
+    {
+        const auto& entry = any_cast<const EtEntryData&>(data);
+
+        std::size_t size = sizeof(std::uint32_t);
+        for (const auto& buf : entry.buffers()) {
+            size += sizeof(std::int32_t) + sizeof(std::uint64_t) + buf.length;
+        }
+
+        std::vector<std::uint8_t> buffer(size);
+        auto* p = buffer.data();
+        put(p, static_cast<std::uint32_t>(entry.buffers().size()));
+        for (const auto& buf : entry.buffers()) {
+            put(p, static_cast<std::int32_t>(buf.id));
+            put(p, static_cast<std::uint64_t>(buf.length));
+            std::memcpy(p, buf.data, buf.length);
+            p += buf.length;
+        }
+        return buffer;
+    }
+
+    any read(const std::vector<std::uint8_t>& buffer) const override
+    {
+        const auto* p = buffer.data();
+        const auto* end = p + buffer.size();
+
+        auto count = get<std::uint32_t>(p, end);
+        std::vector<std::pair<int, std::vector<std::uint8_t>>> owned;
+        for (std::uint32_t i = 0; i < count; ++i) {
+            auto id = get<std::int32_t>(p, end);
+            auto length = get<std::uint64_t>(p, end);
+            if (length > static_cast<std::uint64_t>(end - p)) {
+                throw std::runtime_error{"truncated ET entry data"};
+            }
+            owned.emplace_back(id, std::vector<std::uint8_t>(p, p + length));
+            p += length;
+        }
+        return EtEntryData{std::move(owned)};
+    }
+
+private:
+    template<typename T>
+    static void put(std::uint8_t*& p, T value)
+    {
+        std::memcpy(p, &value, sizeof(T));
+        p += sizeof(T);
+    }
+
+    template<typename T>
+    static T get(const std::uint8_t*& p, const std::uint8_t* end)
+    {
+        if (end - p < static_cast<std::ptrdiff_t>(sizeof(T))) {
+            throw std::runtime_error{"truncated ET entry data"};
+        }
+        T value;
+        std::memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return value;
+    }
+};
+
+
+namespace type {
+
+/**
+ * A fifo entry borrowed from ET, see {@link EtEntryData}.
+ */
+inline const EngineDataType& ET_ENTRY()
+{
+    static const EngineDataType type{"binary/data-et-entry",
+                                     std::make_unique<EtEntrySerializer>()};
+    return type;
+}
+
+} // end namespace type
+
+} // end namespace ersap
+
+#endif // end of include guard: ERSAP_ET_ENTRY_DATA_HPP
@@ -0,0 +1,359 @@
+
+
+#ifndef ERSAP_FUSED_ENGINE_HPP
+#define ERSAP_FUSED_ENGINE_HPP
+
+#include <ersap/engine.hpp>
+#include <ersap/third_party/json11.hpp>
+
+#include <dlfcn.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ersap {
+
+/**
+ * A chain of engines fused into a single service.
+ *
+ * When the services of a composition (e.g. reassemble &rarr; decode &rarr; filter)
+ * are deployed in the same DPE, deploying them as one fused engine runs
+ * all stages back to back on the worker thread that received the request.
+ * The {@link EngineData} returned by one stage is moved into the next one,
+ * so the data is neither serialized by its {@link EngineDataType} nor sent
+ * through the proxy between stages. Only the input of the first stage and
+ * the output of the last stage go through the normal (xmsg) path, which is
+ * also what is used to link a fused engine with services in other processes.
+ *
+ * The stages can be given directly to the constructor, or loaded from their
+ * service libraries, using the same <code>create_engine</code> entry point
+ * the DPE uses. The libraries must be known when the engine is created,
+ * since the DPE asks for the input and output data types when deploying
+ * the service, before it is configured. The default constructor (used by
+ * the <code>create_engine</code> defined when compiling with
+ * <code>ERSAP_FUSED_ENGINE_SERVICE</code>) reads them from the environment:
+ *
+ * <pre>
+ *   ERSAP_FUSED_CHAIN=libejfat_assemble_et_service.so,libdecoder.so
+ * </pre>
+ *
+ * The same configuration data is passed to every stage.
+ * The chain stops at the first stage returning an error status, or returning
+ * a data type the next stage does not accept, and returns that result.
+ */
+class FusedEngine : public Engine
+{
+public:
+    using EngineFactory = std::unique_ptr<Engine> (*)();
+
+    /**
+     * Loads the stages from the comma separated service libraries
+     * in the <code>ERSAP_FUSED_CHAIN</code> environment variable, if set.
+     *
+     * @throws std::runtime_error if a library cannot be loaded
+     */
+    FusedEngine()
+      : FusedEngine{libraries_from_env()}
+    {
+        // nothing
+    }
+
+    /**
+     * Loads the stages from the given service libraries.
+     *
+     * @throws std::runtime_error if a library cannot be loaded
+     */
+    explicit FusedEngine(const std::vector<std::string>& libraries)
+    {
+        try {
+            for (const auto& library : libraries) {
+                void* handle = nullptr;
+                auto stage = load_engine(library, &handle);
+                handles_.push_back(handle);
+                stages_.push_back(std::move(stage));
+            }
+        } catch (...) {
+            close();
+            throw;
+        }
+        cache_types();
+    }
+
+    explicit FusedEngine(std::vector<std::unique_ptr<Engine>>&& stages)
+      : stages_{std::move(stages)}
+    {
+        cache_types();
+    }
+
+    ~FusedEngine() override
+    {
+        close();
+    }
+
+    FusedEngine(const FusedEngine&) = delete;
+    FusedEngine& operator=(const FusedEngine&) = delete;
+
+public:
+    /**
+     * Loads an engine from a service library.
+     *
+     * @param library the path or name of the service library
+     * @param handle returns the library handle, to be closed after the engine
+     *               is destroyed
+     * @throws std::runtime_error if the library or its factory cannot be loaded
+     */
+    static std::unique_ptr<Engine> load_engine(const std::string& library, void** handle)
+    {
+        *handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (*handle == nullptr) {
+            throw std::runtime_error{"could not load " + library + ": " + dlerror()};
+        }
+        auto factory = reinterpret_cast<EngineFactory>(dlsym(*handle, "create_engine"));
+        if (factory == nullptr) {
+            dlclose(*handle);
+            *handle = nullptr;
+            throw std::runtime_error{"missing create_engine in " + library};
+        }
+        return factory();
+    }
+
+    /**
+     * Appends a stage at the end of the chain.
+     */
+    void add_stage(std::unique_ptr<Engine>&& stage)
+    {
+        stages_.push_back(std::move(stage));
+        cache_types();
+    }
+
+    /**
+     * Returns the number of stages in the chain.
+     */
+    size_t size() const
+    {
+        return stages_.size();
+    }
+
+public:
+    EngineData configure(EngineData& input) override
+    {
+        EngineData output;
+        if (stages_.empty() && input.mime_type() == type::JSON.mime_type()) {
+            // too late to load stages: the DPE already took the data types
+            std::string error;
+            auto config = json11::Json::parse(data_cast<std::string>(input), error);
+            if (error.empty() && config["fused_chain"].is_array()) {
+                output.set_status(EngineStatus::ERROR, 1);
+                output.set_description("fused chain: stages must be given in "
+                                       "ERSAP_FUSED_CHAIN when the service is deployed");
+                return output;
+            }
+        }
+
+        for (auto& stage : stages_) {
+            output = stage->configure(input);
+            if (output.status() == EngineStatus::ERROR) {
+                break;
+            }
+        }
+        return output;
+    }
+
+    EngineData execute(EngineData& input) override
+    {
+        if (stages_.empty()) {
+            return std::move(input);
+        }
+        EngineData data = stages_.front()->execute(input);
+        return run_from(1, std::move(data));
+    }
+
+    EngineData execute_group(const std::vector<EngineData>& inputs) override
+    {
+        if (stages_.empty()) {
+            return EngineData{};
+        }
+        EngineData data = stages_.front()->execute_group(inputs);
+        return run_from(1, std::move(data));
+    }
+
+public:
+    std::vector<EngineDataType> input_data_types() const override
+    {
+        if (stages_.empty()) {
+            return std::vector<EngineDataType>{};
+        }
+        return stages_.front()->input_data_types();
+    }
+
+    std::vector<EngineDataType> output_data_types() const override
+    {
+        if (stages_.empty()) {
+            return std::vector<EngineDataType>{};
+        }
+        return stages_.back()->output_data_types();
+    }
+
+    std::set<std::string> states() const override
+    {
+        std::set<std::string> all;
+        for (const auto& stage : stages_) {
+            auto states = stage->states();
+            all.insert(states.begin(), states.end());
+        }
+        return all;
+    }
+
+public:
+    std::string name() const override
+    {
+        std::string name;
+        for (const auto& stage : stages_) {
+            if (!name.empty()) {
+                name += "+";
+            }
+            name += stage->name();
+        }
+        return name.empty() ? "FusedEngine" : name;
+    }
+
+    std::string author() const override
+    {
+        return stages_.empty() ? "" : stages_.front()->author();
+    }
+
+    std::string description() const override
+    {
+        return "In-process chain of " + std::to_string(stages_.size()) + " engines: " + name();
+    }
+
+    std::string version() const override
+    {
+        return stages_.empty() ? "" : stages_.front()->version();
+    }
+
+public:
+    void reset() override
+    {
+        for (auto& stage : stages_) {
+            stage->reset();
+        }
+    }
+
+private:
+    /**
+     * Returns the libraries listed in <code>ERSAP_FUSED_CHAIN</code>.
+     */
+    static std::vector<std::string> libraries_from_env()
+    {
+        std::vector<std::string> libraries;
+        const char* chain = std::getenv("ERSAP_FUSED_CHAIN");
+        if (chain == nullptr) {
+            return libraries;
+        }
+        std::string list{chain};
+        size_t start = 0;
+        while (start <= list.size()) {
+            auto end = list.find(',', start);
+            if (end == std::string::npos) {
+                end = list.size();
+            }
+            auto first = list.find_first_not_of(" \t", start);
+            auto last = list.find_last_not_of(" \t", end - 1);
+            if (first != std::string::npos && first < end && last >= first) {
+                libraries.push_back(list.substr(first, last - first + 1));
+            }
+            start = end + 1;
+        }
+        return libraries;
+    }
+
+    /**
+     * Destroys the stages, then closes their libraries.
+     */
+    void close()
+    {
+        // engines must be destroyed before their libraries are closed
+        stages_.clear();
+        for (auto* handle : handles_) {
+            dlclose(handle);
+        }
+        handles_.clear();
+    }
+
+    /**
+     * Runs stages [first, size) on the given data, moving the result of each
+     * stage into the next one.
+     */
+    EngineData run_from(size_t first, EngineData&& data)
+    {
+        for (size_t i = first; i < stages_.size(); ++i) {
+            if (data.status() == EngineStatus::ERROR || !data.has_data()) {
+                break;
+            }
+            if (!accepts(i, data.mime_type())) {
+                data.set_status(EngineStatus::ERROR, 1);
+                data.set_description("fused chain: " + stages_[i]->name() +
+                                     " does not accept " + data.mime_type());
+                break;
+            }
+            EngineData next = stages_[i]->execute(data);
+            data = std::move(next);
+        }
+        return std::move(data);
+    }
+
+    /**
+     * Caches the mime-types accepted by each stage, so that the chain
+     * can be checked on every request without locking.
+     * Must only be called while no request is being executed.
+     */
+    void cache_types()
+    {
+        accepted_.clear();
+        for (const auto& stage : stages_) {
+            std::vector<std::string> types;
+            for (const auto& dt : stage->input_data_types()) {
+                types.push_back(dt.mime_type());
+            }
+            accepted_.push_back(std::move(types));
+        }
+    }
+
+    /**
+     * Checks if the given stage accepts the given mime-type.
+     */
+    bool accepts(size_t stage, const std::string& mime_type) const
+    {
+        const auto& types = accepted_[stage];
+        return types.empty() ||
+               std::find(types.begin(), types.end(), mime_type) != types.end();
+    }
+
+private:
+    std::vector<std::unique_ptr<Engine>> stages_;
+    std::vector<void*> handles_;
+    std::vector<std::vector<std::string>> accepted_;
+};
+
+} // end namespace ersap
+
+#ifdef ERSAP_FUSED_ENGINE_SERVICE
+/**
+ * Entry point of a fused service library, built from a source file that
+ * defines <code>ERSAP_FUSED_ENGINE_SERVICE</code> and includes this header.
+ */
+extern "C"
+std::unique_ptr<ersap::Engine> create_engine()
+{
+    return std::make_unique<ersap::FusedEngine>();
+}
+#endif
+
+#endif // end of include guard: ERSAP_FUSED_ENGINE_HPP
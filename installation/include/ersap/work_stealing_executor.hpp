@@ -0,0 +1,413 @@
+
+
+#ifndef ERSAP_WORK_STEALING_EXECUTOR_HPP
+#define ERSAP_WORK_STEALING_EXECUTOR_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace ersap {
+
+/**
+ * A work-stealing executor for service requests.
+ *
+ * Each worker thread owns a deque. Requests are pushed to the deque of the
+ * worker given as affinity hint; a request submitted from a worker thread
+ * without a hint stays on that worker, so consecutive stages of one event
+ * run on the same core with warm caches. Workers take their own newest
+ * request first and steal the oldest requests of other workers when idle.
+ * Each worker keeps one deque per service, so deferred requests are never
+ * scanned: a take only looks at the ends of each service's deque.
+ *
+ * Instead of a fixed per-service core cap, the number of requests of a
+ * service that may run at once follows the measured queue depth: each
+ * service gets a share of the workers proportional to its share of queued
+ * requests (at least one). A service over its share is deferred only when
+ * requests of other services are waiting, so a backlogged service borrows
+ * all idle capacity.
+ *
+ * A request that throws is counted as failed for its service and passed to
+ * the error handler; the worker goes on with the next request.
+ */
+class WorkStealingExecutor
+{
+public:
+    using Task = std::function<void()>;
+    using ErrorHandler = std::function<void(const std::string&, std::exception_ptr)>;
+
+    static constexpr size_t NO_AFFINITY = std::numeric_limits<size_t>::max();
+
+    /**
+     * Creates the executor and starts its workers.
+     *
+     * @param workers number of worker threads (0 for one per hardware thread)
+     * @param cores if not empty, worker i is pinned to cores[i % cores.size()]
+     */
+    explicit WorkStealingExecutor(size_t workers = 0, std::vector<int> cores = {})
+    {
+        if (workers == 0) {
+            workers = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (size_t i = 0; i < workers; ++i) {
+            queues_.push_back(std::make_unique<WorkerQueue>());
+        }
+        for (size_t i = 0; i < workers; ++i) {
+            threads_.emplace_back([this, i]() { run(i); });
+            if (!cores.empty()) {
+                pin(threads_.back(), cores[i % cores.size()]);
+            }
+        }
+    }
+
+    WorkStealingExecutor(const WorkStealingExecutor&) = delete;
+    WorkStealingExecutor& operator=(const WorkStealingExecutor&) = delete;
+
+    ~WorkStealingExecutor()
+    {
+        {
+            std::lock_guard<std::mutex> lock{sleep_mutex_};
+            stopping_ = true;
+        }
+        sleep_cond_.notify_all();
+        for (auto& t : threads_) {
+            t.join();
+        }
+    }
+
+public:
+    /**
+     * Registers a service and returns the id used to submit its requests.
+     * Must be called before requests are submitted.
+     */
+    int register_service(const std::string& name)
+    {
+        services_.push_back(std::make_unique<ServiceState>(name));
+        return static_cast<int>(services_.size() - 1);
+    }
+
+    /**
+     * Sets the function called (on the worker thread) with the service name
+     * and the exception when a request throws. By default the error is
+     * printed to stderr. Must be called before requests are submitted.
+     */
+    void set_error_handler(ErrorHandler handler)
+    {
+        error_handler_ = std::move(handler);
+    }
+
+    /**
+     * Submits a request of the given service.
+     *
+     * @param service id returned by {@link #register_service}
+     * @param task the request to run
+     * @param affinity preferred worker (e.g. a hash of the event id),
+     *                 or NO_AFFINITY to stay on the calling worker
+     */
+    void submit(int service, Task task, size_t affinity = NO_AFFINITY)
+    {
+        size_t worker;
+        if (affinity != NO_AFFINITY) {
+            worker = affinity % queues_.size();
+        } else if (current_worker() != NO_AFFINITY && current_executor() == this) {
+            worker = current_worker();
+        } else {
+            worker = next_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+        }
+
+        services_[service]->queued.fetch_add(1, std::memory_order_relaxed);
+        total_queued_.fetch_add(1, std::memory_order_relaxed);
+        {
+            auto& q = *queues_[worker];
+            std::lock_guard<std::mutex> lock{q.mutex};
+            if (q.services.size() <= static_cast<size_t>(service)) {
+                q.services.resize(service + 1);
+            }
+            q.services[service].push_back(Item{service, q.next_seq++, std::move(task)});
+        }
+        wake();
+    }
+
+    /**
+     * Returns the index of the calling worker thread, or NO_AFFINITY if the
+     * caller is not a worker.
+     */
+    static size_t current_worker()
+    {
+        return worker_index();
+    }
+
+    size_t size() const
+    {
+        return queues_.size();
+    }
+
+    /**
+     * Returns how many requests of the given service may currently run at once.
+     */
+    size_t concurrency_limit(int service) const
+    {
+        auto total = total_queued_.load(std::memory_order_relaxed);
+        auto queued = services_[service]->queued.load(std::memory_order_relaxed);
+        if (total == 0) {
+            return queues_.size();
+        }
+        auto share = (queues_.size() * queued + total - 1) / total;
+        return std::max<size_t>(1, share);
+    }
+
+    /**
+     * Returns the number of queued and running requests of the given service.
+     */
+    std::pair<size_t, size_t> load(int service) const
+    {
+        const auto& s = *services_[service];
+        return {s.queued.load(std::memory_order_relaxed),
+                s.running.load(std::memory_order_relaxed)};
+    }
+
+    /**
+     * Returns how many requests of the given service threw an exception.
+     */
+    uint64_t failures(int service) const
+    {
+        return services_[service]->failed.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns how many requests were stolen from another worker.
+     */
+    uint64_t steals() const
+    {
+        return steals_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Item
+    {
+        int service;
+        uint64_t seq;  // order of submission to the worker
+        Task task;
+    };
+
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        std::vector<std::deque<Item>> services;  // indexed by service id
+        uint64_t next_seq = 0;
+    };
+
+    struct ServiceState
+    {
+        explicit ServiceState(std::string n) : name{std::move(n)} {}
+
+        std::string name;
+        std::atomic<size_t> queued{0};
+        std::atomic<size_t> running{0};
+        std::atomic<uint64_t> failed{0};
+    };
+
+    static size_t& worker_index()
+    {
+        static thread_local size_t index = NO_AFFINITY;
+        return index;
+    }
+
+    static WorkStealingExecutor*& current_executor()
+    {
+        static thread_local WorkStealingExecutor* executor = nullptr;
+        return executor;
+    }
+
+    static void pin(std::thread& thread, int core)
+    {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core, &set);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+    }
+
+    /**
+     * Checks if a request of the given service may start now.
+     */
+    bool may_run(int service) const
+    {
+        const auto& s = *services_[service];
+        if (s.running.load(std::memory_order_relaxed) < concurrency_limit(service)) {
+            return true;
+        }
+        // over its share: only yield if other services have requests waiting
+        return total_queued_.load(std::memory_order_relaxed) ==
+               s.queued.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Takes a request from the given queue: the newest runnable one for the
+     * owner, the oldest runnable one for a thief.
+     * Only the ends of each service's deque are compared, so a take costs
+     * O(services) however many requests are deferred.
+     */
+    bool take(WorkerQueue& q, bool owner, Item& item)
+    {
+        std::lock_guard<std::mutex> lock{q.mutex};
+        std::deque<Item>* best = nullptr;
+        for (size_t i = 0; i < q.services.size(); ++i) {
+            auto& d = q.services[i];
+            if (d.empty() || !may_run(static_cast<int>(i))) {
+                continue;
+            }
+            if (best == nullptr ||
+                (owner ? d.back().seq > best->back().seq : d.front().seq < best->front().seq)) {
+                best = &d;
+            }
+        }
+        if (best == nullptr) {
+            return false;
+        }
+        if (owner) {
+            item = std::move(best->back());
+            best->pop_back();
+        } else {
+            item = std::move(best->front());
+            best->pop_front();
+        }
+        return true;
+    }
+
+    /**
+     * Tells sleeping workers that a request was queued or that a deferred
+     * one may have become runnable. Sleepers register before their last
+     * look at the queues and both sides use sequentially consistent
+     * atomics, so either the sleeper sees the new epoch or this sees
+     * the sleeper and notifies it under the mutex.
+     */
+    void wake()
+    {
+        epoch_.fetch_add(1);
+        if (sleepers_.load() > 0) {
+            {
+                std::lock_guard<std::mutex> lock{sleep_mutex_};
+            }
+            sleep_cond_.notify_one();
+        }
+    }
+
+    void execute(Item& item)
+    {
+        auto& s = *services_[item.service];
+        try {
+            item.task();
+        } catch (...) {
+            s.failed.fetch_add(1, std::memory_order_relaxed);
+            report(s.name, std::current_exception());
+        }
+    }
+
+    void report(const std::string& service, std::exception_ptr error)
+    {
+        if (error_handler_) {
+            try {
+                error_handler_(service, error);
+                return;
+            } catch (...) {
+                // fall back to printing the original error
+            }
+        }
+        try {
+            std::rethrow_exception(error);
+        } catch (const std::exception& e) {
+            std::cerr << "ersap: request of service " << service
+                      << " failed: " << e.what() << std::endl;
+        } catch (...) {
+            std::cerr << "ersap: request of service " << service
+                      << " failed with unknown exception" << std::endl;
+        }
+    }
+
+    bool find(size_t self, Item& item)
+    {
+        if (take(*queues_[self], true, item)) {
+            return true;
+        }
+        for (size_t k = 1; k < queues_.size(); ++k) {
+            if (take(*queues_[(self + k) % queues_.size()], false, item)) {
+                steals_.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(size_t self)
+    {
+        worker_index() = self;
+        current_executor() = this;
+
+        Item item;
+        while (true) {
+            auto seen = epoch_.load();
+            if (find(self, item)) {
+                auto& s = *services_[item.service];
+                s.queued.fetch_sub(1, std::memory_order_relaxed);
+                total_queued_.fetch_sub(1, std::memory_order_relaxed);
+                s.running.fetch_add(1, std::memory_order_relaxed);
+                execute(item);
+                s.running.fetch_sub(1, std::memory_order_relaxed);
+                item.task = nullptr;
+                // requests deferred by their limit may run now
+                if (total_queued_.load(std::memory_order_relaxed) > 0) {
+                    wake();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock{sleep_mutex_};
+            if (stopping_) {
+                break;
+            }
+            sleepers_.fetch_add(1);
+            sleep_cond_.wait(lock, [&] { return stopping_ || epoch_.load() != seen; });
+            sleepers_.fetch_sub(1);
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<WorkerQueue>> queues_;
+    std::vector<std::unique_ptr<ServiceState>> services_;
+    std::vector<std::thread> threads_;
+
+    std::atomic<size_t> total_queued_{0};
+    std::atomic<size_t> next_{0};
+    std::atomic<uint64_t> steals_{0};
+
+    ErrorHandler error_handler_;
+
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_cond_;
+    std::atomic<uint64_t> epoch_{0};
+    std::atomic<size_t> sleepers_{0};
+    bool stopping_ = false;
+};
+
+} // end namespace ersap
+
+#endif // end of include guard: ERSAP_WORK_STEALING_EXECUTOR_HPP
@@ -47,6 +47,8 @@
 #include <sys/ioctl.h>
 #include <arpa/inet.h>
 
+#include "ejfat_header.hpp"
+
 
 #ifdef __APPLE__
 #include <cctype>
@@ -64,9 +66,6 @@
     #ifndef _GNU_SOURCE
         #define _GNU_SOURCE
     #endif
-
-    #define htonll(x) ((1==htonl(1)) ? (x) : (((uint64_t)htonl((x) & 0xFFFFFFFFUL)) << 32) | htonl((uint32_t)((x) >> 32)))
-    #define ntohll(x) ((1==ntohl(1)) ? (x) : (((uint64_t)ntohl((x) & 0xFFFFFFFFUL)) << 32) | ntohl((uint32_t)((x) >> 32)))
 #endif
 
 
@@ -401,14 +400,15 @@ extern int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
         {
             *ll = buffer[0];
             *bb = buffer[1];
-            if ((*ll != 'L') || (*bb != 'B')) {
+            lbHeader hdr;
+            if (!wire::decodeLb(buffer, &hdr)) {
                 throw std::runtime_error("ersap pkt does not start with 'LB'");
             }
 
-            *version  = ((uint32_t)buffer[2] & 0xff);
-            *protocol = ((uint32_t)buffer[3] & 0xff);
-            *entropy  = ntohs(*((uint16_t *)(&buffer[6]))) & 0xffff;
-            *tick     = ntohll(*((uint64_t *)(&buffer[8])));
+            *version  = hdr.version;
+            *protocol = hdr.protocol;
+            *entropy  = hdr.entropy;
+            *tick     = hdr.tick;
         }
 
 
@@ -446,12 +446,13 @@ extern int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
         static void parseReHeader(const char* buffer, int* version, uint16_t* dataId,
                                   uint32_t* offset, uint32_t* length, uint64_t *tick)
         {
-            // Now pull out the component values
-            *version = (buffer[0] >> 4) & 0xf;
-            *dataId  = ntohs(*((uint16_t *)  (buffer + 2)));
-            *offset  = ntohl(*((uint32_t *)  (buffer + 4)));
-            *length  = ntohl(*((uint32_t *)  (buffer + 8)));
-            *tick    = ntohll(*((uint64_t *) (buffer + 12)));
+            reHeader hdr;
+            wire::decodeRe(buffer, &hdr);
+            *version = hdr.version;
+            *dataId  = hdr.dataId;
+            *offset  = hdr.offset;
+            *length  = hdr.length;
+            *tick    = hdr.tick;
         }
 
 
@@ -497,11 +498,13 @@ extern int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
        static void parseSyncData(const char *buffer, uint32_t *version, uint32_t *srcId,
                                  uint64_t *evtNum, uint32_t *evtRate, uint64_t *nanos) {
 
-           *version  = buffer[2] & 0xff;
-           *srcId    = ntohl (*((uint32_t *)  (buffer + 4)));
-           *evtNum   = ntohll(*((uint64_t *)  (buffer + 8)));
-           *evtRate  = ntohl (*((uint32_t *)  (buffer + 16)));
-           *nanos    = ntohll(*((uint64_t *)  (buffer + 20)));
+           syncHeader hdr;
+           wire::decodeSync(buffer, &hdr);
+           *version  = hdr.version;
+           *srcId    = hdr.srcId;
+           *evtNum   = hdr.evtNum;
+           *evtRate  = hdr.evtRate;
+           *nanos    = hdr.nanos;
        }
 
 
@@ -533,9 +536,9 @@ extern int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
                                     uint32_t* totalPkts, uint32_t* pktSequence)
         {
             // Now pull out the component values
-            *delay       = ntohl(*((uint32_t *)  (buffer)));
-            *totalPkts   = ntohl(*((uint32_t *)  (buffer + 4)));
-            *pktSequence = ntohl(*((uint32_t *)  (buffer + 8)));
+            *delay       = wire::load32(buffer);
+            *totalPkts   = wire::load32(buffer + 4);
+            *pktSequence = wire::load32(buffer + 8);
         }
 
 
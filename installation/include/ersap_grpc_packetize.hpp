@@ -49,6 +49,8 @@
 #include <arpa/inet.h>
 #include <net/if.h>
 
+#include "ejfat_header.hpp"
+
 #ifdef __APPLE__
 #include <cctype>
 #endif
@@ -61,28 +63,6 @@
 #define RE_HEADER_BYTES  20
 
 
-#ifdef __linux__
-    #define htonll(x) ((1==htonl(1)) ? (x) : (((uint64_t)htonl((x) & 0xFFFFFFFFUL)) << 32) | htonl((uint32_t)((x) >> 32)))
-    #define ntohll(x) ((1==ntohl(1)) ? (x) : (((uint64_t)ntohl((x) & 0xFFFFFFFFUL)) << 32) | ntohl((uint32_t)((x) >> 32)))
-#endif
-
-
-#ifndef _BYTESWAP_H
-    #define _BYTESWAP_H
-
-    static inline uint16_t bswap_16(uint16_t x) {
-        return (x>>8) | (x<<8);
-    }
-
-    static inline uint32_t bswap_32(uint32_t x) {
-        return (bswap_16(x&0xffff)<<16) | (bswap_16(x>>16));
-    }
-
-    static inline uint64_t bswap_64(uint64_t x) {
-        return (((uint64_t)bswap_32(x&0xffffffffull))<<32) |
-                          (bswap_32(x>>32));
-    }
-#endif
 
 #define btoa(x) ((x)?"true":"false")
 #define INPUT_LENGTH_MAX 256
@@ -195,13 +175,7 @@ namespace ejfat {
      * @param entropy  entropy field used to determine destination port.
      */
     static void setLbMetadata(char *buffer, uint64_t tick, int version, int protocol, int entropy) {
-        *buffer = 'L';
-        *(buffer + 1) = 'B';
-        *(buffer + 2) = version;
-        *(buffer + 3) = protocol;
-        // Put the data in network byte order (big endian)
-        *((uint16_t * )(buffer + 6)) = htons(entropy);
-        *((uint64_t * )(buffer + 8)) = htonll(tick);
+        wire::encodeLb(buffer, tick, version, protocol, entropy);
     }
 
 
@@ -242,13 +216,7 @@ namespace ejfat {
      */
     static void setReMetadata(char *buffer, uint32_t offset, uint32_t length,
                               uint64_t tick, int version, uint16_t dataId) {
-
-        buffer[0] = version << 4;
-
-        *((uint16_t * )(buffer + 2)) = htons(dataId);
-        *((uint32_t * )(buffer + 4)) = htonl(offset);
-        *((uint32_t * )(buffer + 8)) = htonl(length);
-        *((uint64_t * )(buffer + 12)) = htonll(tick);
+        wire::encodeRe(buffer, offset, length, tick, version, dataId);
     }
 
 
@@ -294,15 +262,7 @@ namespace ejfat {
      */
     static void setSyncData(char *buffer, int version, uint32_t srcId,
                             uint64_t evtNum, uint32_t evtRate, uint64_t nanos) {
-        buffer[0] = 'L';
-        buffer[1] = 'C';
-        buffer[2] = version;
-
-        // Put the data in network byte order (big endian)
-        *((uint32_t * )(buffer + 4)) = htonl(srcId);
-        *((uint64_t * )(buffer + 8)) = htonll(evtNum);
-        *((uint32_t * )(buffer + 16)) = htonl(evtRate);
-        *((uint64_t * )(buffer + 20)) = htonll(nanos);
+        wire::encodeSync(buffer, version, srcId, evtNum, evtRate, nanos);
     }
 
 
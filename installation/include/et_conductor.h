@@ -0,0 +1,427 @@
+//
+// Copyright 2023, Jefferson Science Associates, LLC.
+// Subject to the terms in the LICENSE file found in the top-level directory.
+//
+// EPSCI Group
+// Thomas Jefferson National Accelerator Facility
+// 12000, Jefferson Ave, Newport News, VA 23606
+// (757)-269-7100
+
+
+/**
+ * @file
+ * Batched, event-driven transfers between ET stations.<p>
+ *
+ * Each station's conductor thread normally wakes up for every put into its
+ * output list and moves events one at a time into the next station's input,
+ * taking and handing off station mutexes along the way. With long chains of
+ * stations, the wakeups and lock handoffs of every hop add latency and CPU.
+ * This file contains the pieces of a batching conductor mode:
+ * <ul>
+ * <li>{@link et_conductor_wait} coalesces wakeups: after the first event arrives
+ *     the conductor keeps sleeping until a full batch is there or a short
+ *     window has passed;</li>
+ * <li>{@link et_list_take_all} and {@link et_list_append_chain} move a whole
+ *     output list into the next input list with pointer splicing and a single
+ *     wakeup of its readers, instead of event by event;</li>
+ * <li>{@link et_station_put_direct} lets a putting attachment write straight into
+ *     the next station's input list, skipping the output list and the conductor,
+ *     when the next station takes every event;</li>
+ * <li>{@link et_chain_latency} measures the latency of a station chain through the
+ *     public API, so hops can be compared before and after switching modes.</li>
+ * </ul>
+ * Splicing keeps ET's priority order: high priority events stay at the head
+ * of a list, in front of all low priority ones.<p>
+ *
+ * The conductor thread and et_event_put are compiled into the prebuilt libet,
+ * whose sources are not in this tree, so nothing in the library calls the list
+ * and station routines yet. They are written against the et_station and et_list
+ * layout of et_private.h for that code to use. {@link et_chain_latency} and the
+ * hop statistics only need the public API and work with the library as it is,
+ * giving the baseline per hop latency to compare against.
+ */
+#ifndef ET_CONDUCTOR_H_
+#define ET_CONDUCTOR_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "et.h"
+#include "et_private.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** Default number of events the conductor waits for before transferring. */
+#define ET_CONDUCTOR_BATCH      64
+/** Default window, in nanoseconds, over which the conductor coalesces wakeups. */
+#define ET_CONDUCTOR_WINDOW_NS  50000
+/** Number of bins in a latency histogram, bin i counting latencies in [2^i, 2^(i+1)) ns. */
+#define ET_HOP_BINS             32
+
+
+/** Structure holding the settings of a batching conductor. */
+typedef struct et_conductor_config_t {
+    int      batch;     /**< Transfer as soon as this many events are in the output list. */
+    int64_t  windowNs;  /**< Max nanoseconds to wait for a full batch after the first event arrives, 0 for no wait. */
+    int      direct;    /**< If 1, allow attachments to put directly into the next station's input list. */
+} et_conductor_config;
+
+
+/** Structure holding latency statistics of a hop (or chain) of stations. */
+typedef struct et_hop_stats_t {
+    uint64_t count;                     /**< Number of latencies recorded. */
+    uint64_t totalNs;                   /**< Sum of latencies in nanoseconds. */
+    uint64_t maxNs;                     /**< Largest latency in nanoseconds. */
+    uint64_t batches;                   /**< Number of transfers (for conductors). */
+    uint64_t events;                    /**< Number of events transferred (for conductors). */
+    uint64_t histogram[ET_HOP_BINS];    /**< Log2 histogram of latencies. */
+} et_hop_stats;
+
+
+/**
+ * Initialize a conductor configuration with default values.
+ * @param config configuration.
+ */
+static inline void et_conductor_config_init(et_conductor_config *config) {
+    config->batch    = ET_CONDUCTOR_BATCH;
+    config->windowNs = ET_CONDUCTOR_WINDOW_NS;
+    config->direct   = 1;
+}
+
+
+/** Get the current time (CLOCK_MONOTONIC) in nanoseconds. */
+static inline int64_t et_conductor_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+
+/**
+ * Record a latency.
+ * @param stats statistics.
+ * @param ns    latency in nanoseconds.
+ */
+static inline void et_hop_record(et_hop_stats *stats, uint64_t ns) {
+    int bin = 0;
+    uint64_t v = ns;
+    while (v > 1 && bin < ET_HOP_BINS - 1) {
+        v >>= 1;
+        bin++;
+    }
+    stats->histogram[bin]++;
+    stats->count++;
+    stats->totalNs += ns;
+    if (ns > stats->maxNs) stats->maxNs = ns;
+}
+
+
+/**
+ * Print latency statistics on a single line, including the median and
+ * 99th percentile (as the upper edge of their histogram bin).
+ *
+ * @param name  name of hop.
+ * @param stats statistics.
+ * @param fp    file to print to.
+ */
+static inline void et_hop_print(const char *name, const et_hop_stats *stats, FILE *fp) {
+    uint64_t sum = 0, p50 = 0, p99 = 0;
+    int i;
+
+    for (i = 0; i < ET_HOP_BINS && stats->count > 0; i++) {
+        sum += stats->histogram[i];
+        if (p50 == 0 && 2*sum >= stats->count)   p50 = 2ULL << i;
+        if (p99 == 0 && 100*sum >= 99*stats->count) p99 = 2ULL << i;
+    }
+
+    fprintf(fp, "%s: %" PRIu64 " samples, avg %.1f us, p50 < %.1f us, p99 < %.1f us, max %.1f us",
+            name, stats->count,
+            stats->count ? stats->totalNs / 1000. / stats->count : 0.,
+            p50 / 1000., p99 / 1000., stats->maxNs / 1000.);
+    if (stats->batches > 0) {
+        fprintf(fp, ", %.1f events/batch", (double)stats->events / stats->batches);
+    }
+    fprintf(fp, "\n");
+}
+
+
+/**
+ * Wait for events in a list, coalescing wakeups. Called by a conductor with
+ * the list's mutex locked, returns with it locked. Returns as soon as there are
+ * config->batch events, or when config->windowNs nanoseconds have passed since
+ * there was at least one event, or when the quit flag is set.
+ *
+ * @param pl     list (station output list).
+ * @param config conductor settings.
+ * @param quit   pointer to flag which, when set to @ref ET_THREAD_KILL, makes this return
+ *               (the station's conductor field), may be NULL.
+ * @return number of events in list.
+ */
+static inline int et_conductor_wait(et_list *pl, const et_conductor_config *config, volatile int *quit) {
+    struct timespec deadline;
+    int64_t end;
+
+    while (pl->cnt < 1) {
+        if (quit != NULL && *quit == ET_THREAD_KILL) return pl->cnt;
+        pthread_cond_wait(&pl->cread, &pl->mutex);
+    }
+
+    if (pl->cnt >= config->batch || config->windowNs <= 0) return pl->cnt;
+
+    /* cond waits use the realtime clock */
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    end = (int64_t)deadline.tv_nsec + config->windowNs;
+    deadline.tv_sec  += end / 1000000000LL;
+    deadline.tv_nsec  = end % 1000000000LL;
+
+    while (pl->cnt < config->batch) {
+        if (quit != NULL && *quit == ET_THREAD_KILL) break;
+        if (pthread_cond_timedwait(&pl->cread, &pl->mutex, &deadline) == ETIMEDOUT) break;
+    }
+    return pl->cnt;
+}
+
+
+/**
+ * Take all events out of a list as a single chain. Must be called with the
+ * list's mutex locked.
+ *
+ * @param pl     list.
+ * @param pfirst filled with first event of chain (NULL if none).
+ * @param plast  filled with last event of chain (NULL if none).
+ * @param phigh  filled with number of high priority events at head of chain.
+ * @return number of events in chain.
+ */
+static inline int et_list_take_all(et_list *pl, et_event **pfirst, et_event **plast, int *phigh) {
+    int cnt = pl->cnt;
+
+    *pfirst = pl->firstevent;
+    *plast  = pl->lastevent;
+    *phigh  = pl->lasthigh;
+
+    pl->firstevent = NULL;
+    pl->lastevent  = NULL;
+    pl->lasthigh   = 0;
+    pl->cnt        = 0;
+    pl->events_out += cnt;
+
+    if (*plast != NULL) (*plast)->next = NULL;
+    return cnt;
+}
+
+
+/**
+ * Append a chain of events to a list, keeping high priority events in front of
+ * low priority ones, and wake up the list's readers once.
+ * Must be called with the list's mutex locked.
+ * Only the high priority part of the chain, and of the list, is walked;
+ * low priority events are spliced on in constant time.
+ *
+ * @param pl    list (station input list).
+ * @param first first event of chain.
+ * @param last  last event of chain.
+ * @param cnt   number of events in chain.
+ * @param nhigh number of high priority events at head of chain.
+ */
+static inline void et_list_append_chain(et_list *pl, et_event *first, et_event *last, int cnt, int nhigh) {
+    et_event *lastHighIn = NULL, *lastHighChain = NULL, *lows;
+    int i;
+
+    if (cnt < 1 || first == NULL) return;
+    last->next = NULL;
+
+    if (nhigh > 0) {
+        /* find end of high priority parts of chain and list */
+        lastHighChain = first;
+        for (i = 1; i < nhigh; i++) lastHighChain = lastHighChain->next;
+        lows = lastHighChain->next;
+
+        if (pl->lasthigh > 0) {
+            lastHighIn = pl->firstevent;
+            for (i = 1; i < pl->lasthigh; i++) lastHighIn = lastHighIn->next;
+        }
+
+        /* insert highs after the list's highs */
+        if (lastHighIn == NULL) {
+            lastHighChain->next = pl->firstevent;
+            pl->firstevent = first;
+        }
+        else {
+            lastHighChain->next = lastHighIn->next;
+            lastHighIn->next = first;
+        }
+        if (pl->lastevent == NULL || pl->lastevent == lastHighIn) {
+            pl->lastevent = lastHighChain;
+        }
+        pl->lasthigh += nhigh;
+        first = lows;
+        if (first == NULL) {
+            /* all events were high priority */
+            pl->cnt += cnt;
+            pl->events_try += cnt;
+            pl->events_in  += cnt;
+            pthread_cond_broadcast(&pl->cread);
+            return;
+        }
+    }
+
+    /* lows go at the end */
+    if (pl->lastevent == NULL) {
+        pl->firstevent = first;
+    }
+    else {
+        pl->lastevent->next = first;
+    }
+    pl->lastevent = last;
+
+    pl->cnt        += cnt;
+    pl->events_try += cnt;
+    pl->events_in  += cnt;
+    pthread_cond_broadcast(&pl->cread);
+}
+
+
+/**
+ * Can events bypass the conductor and go straight into a station's input list?
+ * True only if the station is active, takes part in serial flow, and
+ * accepts every event (blocking, select all, no prescaling).
+ *
+ * @param ps station receiving events.
+ * @return 1 if yes, else 0.
+ */
+static inline int et_station_direct_ok(const et_station *ps) {
+    return ps->data.status        == ET_STATION_ACTIVE   &&
+           ps->config.flow_mode   == ET_STATION_SERIAL   &&
+           ps->config.block_mode  == ET_STATION_BLOCKING &&
+           ps->config.select_mode == ET_STATION_SELECT_ALL &&
+           ps->config.prescale    == 1;
+}
+
+
+/**
+ * Put events from an attachment straight into the next station's input list,
+ * skipping the putting station's output list and its conductor. This is only
+ * done if the next station takes every event and the output list is empty
+ * (so events cannot overtake ones already waiting for the conductor).
+ * The events' next pointers are overwritten.
+ *
+ * @param from   station of putting attachment.
+ * @param to     next station in chain.
+ * @param pe     array of events, already in priority order.
+ * @param num    number of events.
+ * @return 1 if events were put, 0 if the caller must put them into the
+ *         output list as usual.
+ */
+static inline int et_station_put_direct(et_station *from, et_station *to, et_event *pe[], int num) {
+    int i, nhigh = 0, done = 0;
+
+    if (num < 1 || !et_station_direct_ok(to)) return 0;
+
+    for (i = 0; i < num; i++) {
+        pe[i]->next = (i + 1 < num) ? pe[i+1] : NULL;
+        if (pe[i]->priority == ET_HIGH) nhigh++;
+    }
+
+    pthread_mutex_lock(&from->list_out.mutex);
+    if (from->list_out.cnt == 0) {
+        pthread_mutex_lock(&to->list_in.mutex);
+        et_list_append_chain(&to->list_in, pe[0], pe[num-1], num, nhigh);
+        pthread_mutex_unlock(&to->list_in.mutex);
+
+        from->list_out.events_try += num;
+        from->list_out.events_in  += num;
+        from->list_out.events_out += num;
+        done = 1;
+    }
+    pthread_mutex_unlock(&from->list_out.mutex);
+
+    return done;
+}
+
+
+/**
+ * Move all events of a station's output list into the next station's input
+ * list in one batch. This is the transfer step of a batching conductor for
+ * a next station which takes every event (see {@link et_station_direct_ok});
+ * other stations need ET's per event selection.
+ * Must be called with the output list's mutex locked.
+ *
+ * @param from   station whose output list is emptied.
+ * @param to     next station in chain.
+ * @param stats  if not NULL, updated with batch size.
+ * @return number of events moved.
+ */
+static inline int et_conductor_transfer(et_station *from, et_station *to, et_hop_stats *stats) {
+    et_event *first, *last;
+    int cnt, nhigh;
+
+    cnt = et_list_take_all(&from->list_out, &first, &last, &nhigh);
+    if (cnt < 1) return 0;
+
+    pthread_mutex_lock(&to->list_in.mutex);
+    et_list_append_chain(&to->list_in, first, last, cnt, nhigh);
+    pthread_mutex_unlock(&to->list_in.mutex);
+
+    if (stats != NULL) {
+        stats->batches++;
+        stats->events += cnt;
+    }
+    return cnt;
+}
+
+
+/**
+ * Measure the latency of a chain of stations. Events are made through an
+ * attachment to GrandCentral, stamped with the time, put, and read back through
+ * an attachment to the last station of the chain, one at a time.
+ * Running this with the normal and the batching conductor (whose window
+ * adds to the latency of a single event) shows the per hop difference.
+ *
+ * @param id      ET system id.
+ * @param attIn   attachment to GrandCentral.
+ * @param attOut  attachment to last station of chain.
+ * @param count   number of events to send.
+ * @param stats   filled with latencies.
+ * @return @ref ET_OK if successful, or error code of ET routine that failed.
+ */
+static inline int et_chain_latency(et_sys_id id, et_att_id attIn, et_att_id attOut,
+                                   int count, et_hop_stats *stats) {
+    et_event *pe;
+    int64_t t, *pdata;
+    int i, err;
+
+    for (i = 0; i < count; i++) {
+        err = et_event_new(id, attIn, &pe, ET_SLEEP, NULL, sizeof(int64_t));
+        if (err != ET_OK) return err;
+
+        et_event_getdata(pe, (void **) &pdata);
+        t = et_conductor_now();
+        memcpy(pdata, &t, sizeof(t));
+        et_event_setlength(pe, sizeof(t));
+
+        if ((err = et_event_put(id, attIn, pe)) != ET_OK) return err;
+        if ((err = et_event_get(id, attOut, &pe, ET_SLEEP, NULL)) != ET_OK) return err;
+
+        et_event_getdata(pe, (void **) &pdata);
+        memcpy(&t, pdata, sizeof(t));
+        et_hop_record(stats, (uint64_t)(et_conductor_now() - t));
+
+        if ((err = et_event_put(id, attOut, pe)) != ET_OK) return err;
+    }
+    return ET_OK;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ET_CONDUCTOR_H_ */
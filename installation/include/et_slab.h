@@ -0,0 +1,429 @@
+//
+// Copyright 2023, Jefferson Science Associates, LLC.
+// Subject to the terms in the LICENSE file found in the top-level directory.
+//
+// EPSCI Group
+// Thomas Jefferson National Accelerator Facility
+// 12000, Jefferson Ave, Newport News, VA 23606
+// (757)-269-7100
+
+
+/**
+ * @file
+ * Slab of preallocated oversize event buffers.<p>
+ *
+ * When an event needs more than the configured event size, ET makes a temp event
+ * backed by its own file (et_temp_create) which is mapped, and later unmapped and
+ * removed, by every process using it. A burst of large events then causes a storm
+ * of mmap/munmap calls and page faults. A slab is carved out of shared memory once,
+ * at startup, and holds a fixed number of buffers in several size classes.
+ * An oversize event takes the smallest free buffer that fits and gives it back when
+ * the event is recycled, so no file is mapped. Only when no class fits, or all fitting
+ * classes are used up, does the caller fall back to a regular temp event.<p>
+ *
+ * The slab uses offsets instead of pointers so it survives being mapped at a
+ * different address in each process, and its mutex is process-shared.
+ * A slab buffer is identified by (class, index), which can be stored in the
+ * temp event's filename with {@link et_slab_name} so that other processes
+ * find the buffer with {@link et_slab_parse} instead of attaching a file.<p>
+ *
+ * Use counters are kept for each class so the number and size of buffers
+ * (and ET_SYSTEM_NTEMPS) can be tuned from {@link et_slab_print}.<p>
+ *
+ * The mutex is robust, so a process dying while holding it does not hang the others,
+ * and the next one to lock it rebuilds the free lists.
+ * A buffer which is handed out is marked in its free list link, so freeing it
+ * twice, or freeing one never allocated, is refused instead of corrupting the slab.<p>
+ *
+ * Nothing in the ET library calls these routines yet; they are here to be wired into
+ * et_temp_create / et_temp_remove, whose code is in the prebuilt libet.
+ */
+#ifndef ET_SLAB_H_
+#define ET_SLAB_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** Max number of size classes in a slab. */
+#define ET_SLAB_CLASSES_MAX  8
+/** Index marking the end of a free list. */
+#define ET_SLAB_NONE         0xffffffffU
+/** Free list link value marking a buffer which is in use. */
+#define ET_SLAB_USED         0xfffffffeU
+/** Alignment of each buffer in bytes. */
+#define ET_SLAB_ALIGN        4096
+/** Prefix of the temp event filename of an event using a slab buffer. */
+#define ET_SLAB_PREFIX       "et_slab:"
+
+
+/** Structure describing one size class of a slab. All counts are since the slab was created. */
+typedef struct et_slab_class_t {
+    uint64_t  bufSize;      /**< Size of each buffer in bytes. */
+    uint64_t  dataOffset;   /**< Offset of first buffer from start of slab. */
+    uint64_t  nextOffset;   /**< Offset of free list links (one uint32_t per buffer) from start of slab. */
+    uint32_t  count;        /**< Number of buffers. */
+    uint32_t  freeHead;     /**< Index of first free buffer, or @ref ET_SLAB_NONE. */
+    uint32_t  inUse;        /**< Number of buffers currently in use. */
+    uint32_t  maxInUse;     /**< Max number of buffers ever in use at once. */
+    uint64_t  allocs;       /**< Number of buffers handed out. */
+    uint64_t  spills;       /**< Number of those given to events which would have fit in a smaller, full class. */
+    uint64_t  exhausted;    /**< Number of times this was the best fitting class but no buffer was free. */
+} et_slab_class;
+
+
+/** Structure at the start of a slab, followed by free list links and then buffers. */
+typedef struct et_slab_t {
+    pthread_mutex_t  mutex;        /**< Process-shared mutex protecting everything below. */
+    uint64_t         totalSize;    /**< Total size of slab in bytes. */
+    uint64_t         fallbacks;    /**< Number of oversize events which had to use a file-backed temp event. */
+    int              nclasses;     /**< Number of size classes. */
+    et_slab_class    classes[ET_SLAB_CLASSES_MAX]; /**< Size classes in order of increasing buffer size. */
+} et_slab;
+
+
+/**
+ * Rebuild the free lists of a slab from the links marked @ref ET_SLAB_USED.
+ * Allocating and freeing each take two dependent stores (free list head and
+ * the buffer's link), so a process dying between them leaves a buffer which
+ * is on no free list, or a list whose head skips it. In both cases the buffer's
+ * link is not yet (or no longer) marked used and it was never handed to a caller,
+ * so it is put back on its free list. Buffers marked used stay used, including
+ * any the dead process held or was about to return; those are lost until the
+ * slab is created again.
+ * Must be called with the mutex held.
+ *
+ * @param slab slab.
+ */
+static inline void et_slab_repair(et_slab *slab) {
+    int i;
+    uint32_t k;
+
+    for (i = 0; i < slab->nclasses; i++) {
+        et_slab_class *pc = &slab->classes[i];
+        uint32_t *next = (uint32_t *)((char *)slab + pc->nextOffset);
+
+        pc->freeHead = ET_SLAB_NONE;
+        pc->inUse    = 0;
+        for (k = pc->count; k-- > 0; ) {
+            if (next[k] == ET_SLAB_USED) {
+                pc->inUse++;
+                continue;
+            }
+            next[k] = pc->freeHead;
+            pc->freeHead = k;
+        }
+        if (pc->inUse > pc->maxInUse) pc->maxInUse = pc->inUse;
+    }
+}
+
+
+/**
+ * Lock a slab's mutex. If the process holding it died, the free lists are
+ * rebuilt with {@link et_slab_repair}, the mutex is made consistent again
+ * and the lock proceeds. Only the statistics counters may then be off by one.
+ *
+ * @param slab slab.
+ * @return 0 if locked, -1 if the mutex cannot be locked.
+ */
+static inline int et_slab_lock(et_slab *slab) {
+    int err = pthread_mutex_lock(&slab->mutex);
+    if (err == EOWNERDEAD) {
+        et_slab_repair(slab);
+        err = pthread_mutex_consistent(&slab->mutex);
+    }
+    return (err == 0) ? 0 : -1;
+}
+
+
+/** Round up to a multiple of @ref ET_SLAB_ALIGN. */
+static inline uint64_t et_slab_align(uint64_t size) {
+    return (size + ET_SLAB_ALIGN - 1) & ~((uint64_t)ET_SLAB_ALIGN - 1);
+}
+
+
+/**
+ * Calculate the number of bytes a slab needs.
+ *
+ * @param nclasses number of size classes.
+ * @param sizes    buffer size of each class in bytes.
+ * @param counts   number of buffers of each class.
+ * @return number of bytes needed, or 0 if bad args.
+ */
+static inline uint64_t et_slab_bytes(int nclasses, const uint64_t *sizes, const uint32_t *counts) {
+    uint64_t total, links = 0;
+    int i;
+
+    if (nclasses < 1 || nclasses > ET_SLAB_CLASSES_MAX || sizes == NULL || counts == NULL) return 0;
+
+    for (i = 0; i < nclasses; i++) {
+        links += counts[i] * sizeof(uint32_t);
+    }
+    total = et_slab_align(sizeof(et_slab) + links);
+
+    for (i = 0; i < nclasses; i++) {
+        total += et_slab_align(sizes[i]) * counts[i];
+    }
+    return total;
+}
+
+
+/**
+ * Fill in a default set of size classes for a given normal event size:
+ * buffers of 2, 4, 8 and 16 times the event size, with half of the allowed
+ * temp events in the smallest class, a quarter in the next one, etc.
+ * (at least one buffer per class).
+ *
+ * @param eventSize size of normal events in bytes.
+ * @param ntemps    max number of temp events allowed.
+ * @param sizes     array of at least 4 elements filled with buffer sizes.
+ * @param counts    array of at least 4 elements filled with buffer counts.
+ * @return number of classes.
+ */
+static inline int et_slab_default_classes(uint64_t eventSize, int ntemps, uint64_t *sizes, uint32_t *counts) {
+    int i, n = ntemps;
+    for (i = 0; i < 4; i++) {
+        sizes[i]  = eventSize << (i + 1);
+        n /= 2;
+        counts[i] = (n < 1) ? 1 : (uint32_t)n;
+    }
+    return 4;
+}
+
+
+/**
+ * Create a slab in the given memory (usually part of the ET system's shared memory).
+ * Classes are sorted by buffer size.
+ *
+ * @param mem      pointer to memory of at least {@link et_slab_bytes} bytes,
+ *                 aligned to @ref ET_SLAB_ALIGN.
+ * @param nclasses number of size classes.
+ * @param sizes    buffer size of each class in bytes.
+ * @param counts   number of buffers of each class.
+ * @return pointer to slab, or NULL if bad args or mutex could not be made.
+ */
+static inline et_slab *et_slab_init(void *mem, int nclasses, const uint64_t *sizes, const uint32_t *counts) {
+    et_slab *slab = (et_slab *) mem;
+    pthread_mutexattr_t attr;
+    uint64_t linkOffset, dataOffset;
+    int i, j;
+    uint32_t k;
+
+    uint64_t total = et_slab_bytes(nclasses, sizes, counts);
+    if (mem == NULL || total == 0) return NULL;
+
+    memset(slab, 0, sizeof(et_slab));
+    slab->totalSize = total;
+    slab->nclasses  = nclasses;
+
+    for (i = 0; i < nclasses; i++) {
+        slab->classes[i].bufSize = et_slab_align(sizes[i]);
+        slab->classes[i].count   = counts[i];
+    }
+
+    /* Insertion sort by buffer size */
+    for (i = 1; i < nclasses; i++) {
+        et_slab_class c = slab->classes[i];
+        for (j = i - 1; j >= 0 && slab->classes[j].bufSize > c.bufSize; j--) {
+            slab->classes[j+1] = slab->classes[j];
+        }
+        slab->classes[j+1] = c;
+    }
+
+    linkOffset = sizeof(et_slab);
+    dataOffset = 0;
+    for (i = 0; i < nclasses; i++) {
+        dataOffset += slab->classes[i].count * sizeof(uint32_t);
+    }
+    dataOffset = et_slab_align(linkOffset + dataOffset);
+
+    for (i = 0; i < nclasses; i++) {
+        et_slab_class *pc = &slab->classes[i];
+        uint32_t *next = (uint32_t *)((char *)mem + linkOffset);
+
+        pc->nextOffset = linkOffset;
+        pc->dataOffset = dataOffset;
+        pc->freeHead   = (pc->count > 0) ? 0 : ET_SLAB_NONE;
+        for (k = 0; k < pc->count; k++) {
+            next[k] = (k + 1 < pc->count) ? k + 1 : ET_SLAB_NONE;
+        }
+
+        linkOffset += pc->count * sizeof(uint32_t);
+        dataOffset += pc->count * pc->bufSize;
+    }
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    if (pthread_mutex_init(&slab->mutex, &attr) != 0) {
+        pthread_mutexattr_destroy(&attr);
+        return NULL;
+    }
+    pthread_mutexattr_destroy(&attr);
+
+    return slab;
+}
+
+
+/**
+ * Get a pointer to a slab buffer.
+ *
+ * @param slab   slab.
+ * @param cls    class of buffer.
+ * @param index  index of buffer in its class.
+ * @return pointer to buffer in this process's mapping, or NULL if bad args.
+ */
+static inline void *et_slab_ptr(et_slab *slab, int cls, uint32_t index) {
+    et_slab_class *pc;
+    if (slab == NULL || cls < 0 || cls >= slab->nclasses) return NULL;
+    pc = &slab->classes[cls];
+    if (index >= pc->count) return NULL;
+    return (char *)slab + pc->dataOffset + index * pc->bufSize;
+}
+
+
+/**
+ * Get a buffer of at least the given size.
+ * The smallest class that fits is tried first, then larger classes.
+ * If NULL is returned, the caller is expected to make a file-backed temp event
+ * and this is counted as a fallback.
+ *
+ * @param slab   slab.
+ * @param size   number of bytes needed.
+ * @param pcls   filled with class of buffer.
+ * @param pindex filled with index of buffer in its class.
+ * @return pointer to buffer, or NULL if none available.
+ */
+static inline void *et_slab_alloc(et_slab *slab, uint64_t size, int *pcls, uint32_t *pindex) {
+    int i, fit = -1;
+    uint32_t *next;
+
+    if (slab == NULL || et_slab_lock(slab) != 0) return NULL;
+
+    for (i = 0; i < slab->nclasses; i++) {
+        et_slab_class *pc = &slab->classes[i];
+        if (pc->bufSize < size) continue;
+        if (fit < 0) fit = i;
+
+        if (pc->freeHead == ET_SLAB_NONE) {
+            if (i == fit) pc->exhausted++;
+            continue;
+        }
+
+        next = (uint32_t *)((char *)slab + pc->nextOffset);
+        *pcls   = i;
+        *pindex = pc->freeHead;
+        pc->freeHead = next[*pindex];
+        next[*pindex] = ET_SLAB_USED;
+        pc->allocs++;
+        if (i != fit) pc->spills++;
+        if (++pc->inUse > pc->maxInUse) pc->maxInUse = pc->inUse;
+
+        pthread_mutex_unlock(&slab->mutex);
+        return (char *)slab + pc->dataOffset + (*pindex) * pc->bufSize;
+    }
+
+    slab->fallbacks++;
+    pthread_mutex_unlock(&slab->mutex);
+    return NULL;
+}
+
+
+/**
+ * Give a buffer back to the slab.
+ *
+ * @param slab   slab.
+ * @param cls    class of buffer.
+ * @param index  index of buffer in its class.
+ * @return 0 if OK, -1 if bad args, buffer is not in use (e.g. freed twice)
+ *         or mutex cannot be locked.
+ */
+static inline int et_slab_free(et_slab *slab, int cls, uint32_t index) {
+    et_slab_class *pc;
+    uint32_t *next;
+
+    if (slab == NULL || cls < 0 || cls >= slab->nclasses) return -1;
+    pc = &slab->classes[cls];
+    if (index >= pc->count) return -1;
+
+    next = (uint32_t *)((char *)slab + pc->nextOffset);
+
+    if (et_slab_lock(slab) != 0) return -1;
+    if (next[index] != ET_SLAB_USED) {
+        pthread_mutex_unlock(&slab->mutex);
+        return -1;
+    }
+    next[index]  = pc->freeHead;
+    pc->freeHead = index;
+    pc->inUse--;
+    pthread_mutex_unlock(&slab->mutex);
+    return 0;
+}
+
+
+/**
+ * Write the name identifying a slab buffer into a temp event's filename.
+ *
+ * @param cls    class of buffer.
+ * @param index  index of buffer in its class.
+ * @param name   filled with name.
+ * @param len    length of name array (ET_TEMPNAME_LENGTH).
+ */
+static inline void et_slab_name(int cls, uint32_t index, char *name, size_t len) {
+    snprintf(name, len, ET_SLAB_PREFIX "%d:%u", cls, index);
+}
+
+
+/**
+ * Find out if a temp event's filename refers to a slab buffer and which one.
+ *
+ * @param name   temp event filename.
+ * @param pcls   filled with class of buffer.
+ * @param pindex filled with index of buffer in its class.
+ * @return 1 if name refers to a slab buffer, else 0 (regular temp file).
+ */
+static inline int et_slab_parse(const char *name, int *pcls, uint32_t *pindex) {
+    size_t plen = strlen(ET_SLAB_PREFIX);
+    if (name == NULL || strncmp(name, ET_SLAB_PREFIX, plen) != 0) return 0;
+    return sscanf(name + plen, "%d:%u", pcls, pindex) == 2;
+}
+
+
+/**
+ * Print use counters of each class. An often exhausted class, or many
+ * fallbacks, means more (or larger) buffers are needed, while a class
+ * with low max use is oversized.
+ *
+ * @param slab slab.
+ * @param fp   file to print to.
+ */
+static inline void et_slab_print(et_slab *slab, FILE *fp) {
+    int i;
+    if (slab == NULL || et_slab_lock(slab) != 0) return;
+
+    fprintf(fp, "ET slab: %" PRIu64 " bytes, %" PRIu64 " fallbacks to temp files\n",
+            slab->totalSize, slab->fallbacks);
+    for (i = 0; i < slab->nclasses; i++) {
+        et_slab_class *pc = &slab->classes[i];
+        fprintf(fp, "  class %d: %" PRIu64 " bytes x %u, in use %u (max %u), allocs %" PRIu64
+                    ", spills %" PRIu64 ", exhausted %" PRIu64 "\n",
+                i, pc->bufSize, pc->count, pc->inUse, pc->maxInUse,
+                pc->allocs, pc->spills, pc->exhausted);
+    }
+    pthread_mutex_unlock(&slab->mutex);
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ET_SLAB_H_ */
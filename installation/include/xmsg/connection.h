@@ -51,6 +51,7 @@ using RegDriverPtr = std::unique_ptr<RegDriver, RegDriverDeleter>;
 } // end namespace detail
 
 class ConnectionPool;
+class ThreadConnectionCache;
 
 
 template<typename A, typename U>
@@ -120,6 +121,7 @@ private:
 
 private:
     friend ConnectionPool;
+    friend ThreadConnectionCache;
     friend xMsg;
 
     A addr_;
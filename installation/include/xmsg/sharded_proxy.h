@@ -0,0 +1,455 @@
+/*
+ * Copyright (C) 2015. Jefferson Lab, xMsg framework (JLAB). All Rights Reserved.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for educational, research, and not-for-profit purposes,
+ * without fee and without a signed licensing agreement.
+ *
+ * Contact Vardan Gyurjyan
+ * Department of Experimental Nuclear Physics, Jefferson Lab.
+ *
+ * IN NO EVENT SHALL JLAB BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL,
+ * INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, ARISING OUT OF
+ * THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF JLAB HAS BEEN ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * JLAB SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE. THE CLARA SOFTWARE AND ACCOMPANYING DOCUMENTATION, IF ANY, PROVIDED
+ * HEREUNDER IS PROVIDED "AS IS". JLAB HAS NO OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ */
+
+#ifndef XMSG_CORE_SHARDED_PROXY_H_
+#define XMSG_CORE_SHARDED_PROXY_H_
+
+#include <xmsg/address.h>
+#include <xmsg/constants.h>
+#include <xmsg/context.h>
+#include <xmsg/proxy.h>
+#include <xmsg/topic.h>
+
+#include <zmq.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace xmsg {
+namespace sys {
+
+/**
+ * A proxy split into N independent shards, to spread pub/sub forwarding of a
+ * busy node over several cores.
+ *
+ * Each shard is a regular Proxy with its own context, sockets and forwarding
+ * thread, listening on its own ports: shard \c i uses the base PUB port plus
+ * \c i * \ref port_stride (and the matching SUB and control ports), so shard 0
+ * is the usual proxy of the node. When cores are given, the threads of shard
+ * \c i (including its 0MQ I/O thread) are pinned to core \c cores[i % size].
+ *
+ * Messages are partitioned by a hash of the full topic:
+ *
+ * - publishers send to \ref publish_address for the topic of the message,
+ *   so the messages of one topic (e.g. the requests of one ERSAP service) go
+ *   through a single shard and stay in order;
+ * - subscribers connect to all shards, see \ref subscribe_addresses, since a
+ *   subscription accepts every topic it is a string prefix of (\c "A:B:C"
+ *   accepts \c "A:B:C:D" and \c "A:B:CD"), and those can be on any shard.
+ *   Each shard only sends a subscriber the messages it subscribed to, so this
+ *   costs one connection per shard but no extra traffic.
+ *
+ * The hash (FNV-1a) does not depend on the language or standard library,
+ * so all actors agree on the partition.
+ *
+ * Optionally, a metrics thread samples, every 100 ms, the kernel queues of the
+ * TCP connections of each shard (from \c /proc/net/tcp): the bytes published
+ * but not yet read by the shard (its backlog), and the bytes forwarded but not
+ * yet sent to subscribers. This adds no traffic. Counting messages and bytes
+ * needs a subscriber receiving a copy of everything a shard forwards, which
+ * doubles its outgoing traffic, so it is enabled separately.
+ */
+class ShardedProxy final
+{
+public:
+    /// Distance between the PUB ports of consecutive shards (PUB, SUB and control ports)
+    static constexpr int port_stride = 3;
+
+    /**
+     * Queues of a shard, and messages and bytes it forwarded.
+     * Rates are computed since the previous call to \ref stats.
+     */
+    struct ShardStats
+    {
+        int shard = 0;
+        int pub_port = 0;
+        uint64_t messages = 0;              ///< only if messages are counted
+        uint64_t bytes = 0;                 ///< only if messages are counted
+        double messages_per_sec = 0;
+        double bytes_per_sec = 0;
+        uint64_t backlog_bytes = 0;         ///< published bytes not yet read by the shard
+        uint64_t max_backlog_bytes = 0;     ///< largest backlog since start
+        uint64_t send_queue_bytes = 0;      ///< forwarded bytes not yet sent to subscribers
+        uint64_t max_send_queue_bytes = 0;  ///< largest send queue since start
+    };
+
+public:
+    /**
+     * Creates the shards. They are not started until \ref start is called.
+     *
+     * \param base the address of shard 0
+     * \param shards the number of shards
+     * \param cores if not empty, the cores to pin the shards to
+     * \param metrics if true, sample the socket queues of each shard
+     * \param count_messages if true (and metrics is true), also count the
+     *        messages forwarded by each shard, at the cost of a copy of them
+     */
+    ShardedProxy(const ProxyAddress& base, int shards,
+                 std::vector<int> cores = {}, bool metrics = false,
+                 bool count_messages = false)
+      : base_{base}
+      , cores_{std::move(cores)}
+      , metrics_{metrics}
+      , count_messages_{metrics && count_messages}
+      , counters_(static_cast<size_t>(std::max(shards, 1)))
+    {
+        if (shards < 1) {
+            throw std::invalid_argument{"invalid number of proxy shards"};
+        }
+        for (int i = 0; i < shards; ++i) {
+            proxies_.push_back(std::make_unique<Proxy>(Context::create(),
+                                                       shard_address(base, i)));
+        }
+    }
+
+    ShardedProxy(const ShardedProxy&) = delete;
+    ShardedProxy& operator=(const ShardedProxy&) = delete;
+
+    ~ShardedProxy()
+    {
+        stop();
+    }
+
+public:
+    /**
+     * Starts all shards (and the metrics thread if enabled).
+     */
+    void start()
+    {
+        if (is_alive_.exchange(true)) {
+            return;
+        }
+        for (size_t i = 0; i < proxies_.size(); ++i) {
+            if (cores_.empty()) {
+                proxies_[i]->start();
+                continue;
+            }
+            // threads inherit the CPU affinity of the thread that creates them
+            cpu_set_t old_set;
+            pthread_getaffinity_np(pthread_self(), sizeof(old_set), &old_set);
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cores_[i % cores_.size()], &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            proxies_[i]->start();
+            pthread_setaffinity_np(pthread_self(), sizeof(old_set), &old_set);
+        }
+        if (metrics_) {
+            last_time_ = std::chrono::steady_clock::now();
+            metrics_thread_ = std::thread{&ShardedProxy::count, this};
+        }
+    }
+
+    /**
+     * Stops all shards.
+     */
+    void stop()
+    {
+        if (!is_alive_.exchange(false)) {
+            return;
+        }
+        if (metrics_thread_.joinable()) {
+            metrics_thread_.join();
+        }
+        for (auto& proxy : proxies_) {
+            proxy->stop();
+        }
+    }
+
+    int size() const
+    {
+        return static_cast<int>(proxies_.size());
+    }
+
+    /**
+     * Returns the counters of each shard (all zero if metrics are disabled).
+     */
+    std::vector<ShardStats> stats()
+    {
+        std::lock_guard<std::mutex> lock{stats_mutex_};
+        auto now = std::chrono::steady_clock::now();
+        double secs = std::chrono::duration<double>(now - last_time_).count();
+        last_time_ = now;
+
+        std::vector<ShardStats> all;
+        for (size_t i = 0; i < counters_.size(); ++i) {
+            auto& c = counters_[i];
+            ShardStats s;
+            s.shard = static_cast<int>(i);
+            s.pub_port = shard_address(base_, s.shard).pub_port();
+            s.messages = c.messages.load(std::memory_order_relaxed);
+            s.bytes = c.bytes.load(std::memory_order_relaxed);
+            s.backlog_bytes = c.backlog.load(std::memory_order_relaxed);
+            s.max_backlog_bytes = c.max_backlog.load(std::memory_order_relaxed);
+            s.send_queue_bytes = c.send_queue.load(std::memory_order_relaxed);
+            s.max_send_queue_bytes = c.max_send_queue.load(std::memory_order_relaxed);
+            if (secs > 0) {
+                s.messages_per_sec = (s.messages - c.last_messages) / secs;
+                s.bytes_per_sec = (s.bytes - c.last_bytes) / secs;
+            }
+            c.last_messages = s.messages;
+            c.last_bytes = s.bytes;
+            all.push_back(s);
+        }
+        return all;
+    }
+
+    /**
+     * Returns the counters of each shard as text, one line per shard.
+     */
+    std::string report()
+    {
+        std::ostringstream out;
+        for (const auto& s : stats()) {
+            out << "shard " << s.shard << " (port " << s.pub_port << "): ";
+            if (count_messages_) {
+                out << s.messages_per_sec << " msg/s, "
+                    << s.bytes_per_sec / 1e6 << " MB/s, ";
+            }
+            out << "backlog " << s.backlog_bytes << " B (max " << s.max_backlog_bytes
+                << "), send queue " << s.send_queue_bytes << " B (max "
+                << s.max_send_queue_bytes << ")\n";
+        }
+        return out.str();
+    }
+
+public:
+    /**
+     * Returns the address of the given shard.
+     */
+    static ProxyAddress shard_address(const ProxyAddress& base, int shard)
+    {
+        return ProxyAddress{base.host(), base.pub_port() + shard * port_stride};
+    }
+
+    /**
+     * Returns the shard of a full topic.
+     */
+    static int shard_of(const Topic& topic, int shards)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        for (unsigned char c : topic.str()) {
+            hash = (hash ^ c) * 1099511628211ULL;
+        }
+        return static_cast<int>(hash % static_cast<uint64_t>(shards));
+    }
+
+    /**
+     * Returns the address of the shard to publish messages with the given topic.
+     */
+    static ProxyAddress publish_address(const ProxyAddress& base, int shards,
+                                        const Topic& topic)
+    {
+        return shard_address(base, shard_of(topic, shards));
+    }
+
+    /**
+     * Returns the addresses of the shards to subscribe to for the given topic.
+     * These are all shards, since the topics a subscription accepts can be
+     * published to any shard.
+     */
+    static std::vector<ProxyAddress> subscribe_addresses(const ProxyAddress& base, int shards,
+                                                         const Topic& /*topic*/)
+    {
+        std::vector<ProxyAddress> all;
+        for (int i = 0; i < shards; ++i) {
+            all.push_back(shard_address(base, i));
+        }
+        return all;
+    }
+
+private:
+    struct Counters
+    {
+        std::atomic<uint64_t> messages{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> backlog{0};
+        std::atomic<uint64_t> max_backlog{0};
+        std::atomic<uint64_t> send_queue{0};
+        std::atomic<uint64_t> max_send_queue{0};
+        uint64_t last_messages = 0;
+        uint64_t last_bytes = 0;
+    };
+
+    static constexpr int max_drain = 10000;
+    static constexpr int sample_ms = 100;
+
+    static void store_max(std::atomic<uint64_t>& value, std::atomic<uint64_t>& max, uint64_t v)
+    {
+        value.store(v, std::memory_order_relaxed);
+        if (v > max.load(std::memory_order_relaxed)) {
+            max.store(v, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Adds up the receive queues of the connections to the PUB ports of the
+     * shards and the send queues of the connections to their SUB ports,
+     * read from one of the /proc/net/tcp files.
+     */
+    void read_socket_queues(const char* file,
+                            std::vector<uint64_t>& backlog,
+                            std::vector<uint64_t>& send_queue) const
+    {
+        FILE* in = std::fopen(file, "r");
+        if (in == nullptr) {
+            return;
+        }
+        char line[512];
+        unsigned int port, state;
+        unsigned long tx, rx;
+        while (std::fgets(line, sizeof(line), in) != nullptr) {
+            // sl local_address rem_address st tx_queue:rx_queue ...
+            if (std::sscanf(line, " %*d: %*[0-9A-Fa-f]:%x %*[0-9A-Fa-f]:%*x %x %lx:%lx",
+                            &port, &state, &tx, &rx) != 4 || state != 0x01) {
+                continue;
+            }
+            int offset = static_cast<int>(port) - base_.pub_port();
+            if (offset < 0 || offset / port_stride >= size()) {
+                continue;
+            }
+            auto shard = static_cast<size_t>(offset / port_stride);
+            if (offset % port_stride == 0) {
+                backlog[shard] += rx;
+            } else if (offset % port_stride == 1) {
+                send_queue[shard] += tx;
+            }
+        }
+        std::fclose(in);
+    }
+
+    /// Samples the socket queues of all shards
+    void sample_queues()
+    {
+        std::vector<uint64_t> backlog(counters_.size()), send_queue(counters_.size());
+        read_socket_queues("/proc/net/tcp", backlog, send_queue);
+        read_socket_queues("/proc/net/tcp6", backlog, send_queue);
+        for (size_t i = 0; i < counters_.size(); ++i) {
+            auto& c = counters_[i];
+            store_max(c.backlog, c.max_backlog, backlog[i]);
+            store_max(c.send_queue, c.max_send_queue, send_queue[i]);
+        }
+    }
+
+    /// Metrics thread: samples the shard queues, and counts what they forward if enabled
+    void count()
+    {
+        if (!count_messages_) {
+            while (is_alive_.load()) {
+                sample_queues();
+                std::this_thread::sleep_for(std::chrono::milliseconds(sample_ms));
+            }
+            return;
+        }
+
+        void* ctx = zmq_ctx_new();
+        std::vector<void*> sockets;
+        std::vector<zmq_pollitem_t> items;
+        for (int i = 0; i < size(); ++i) {
+            auto addr = shard_address(base_, i);
+            void* sub = zmq_socket(ctx, ZMQ_SUB);
+            int linger = 0;
+            zmq_setsockopt(sub, ZMQ_LINGER, &linger, sizeof(linger));
+            zmq_setsockopt(sub, ZMQ_SUBSCRIBE, "", 0);
+            auto endpoint = "tcp://" + addr.host() + ":" + std::to_string(addr.sub_port());
+            zmq_connect(sub, endpoint.c_str());
+            sockets.push_back(sub);
+            items.push_back(zmq_pollitem_t{sub, 0, ZMQ_POLLIN, 0});
+        }
+
+        zmq_msg_t frame;
+        zmq_msg_init(&frame);
+        auto next_sample = std::chrono::steady_clock::now();
+        while (is_alive_.load()) {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= next_sample) {
+                sample_queues();
+                next_sample = now + std::chrono::milliseconds(sample_ms);
+            }
+            if (zmq_poll(items.data(), static_cast<int>(items.size()), sample_ms) <= 0) {
+                continue;
+            }
+            for (size_t i = 0; i < items.size(); ++i) {
+                if (!(items[i].revents & ZMQ_POLLIN)) {
+                    continue;
+                }
+                uint64_t messages = 0, bytes = 0;
+                bool first = true, control = false;
+                // bounded, so a flooded shard does not starve the others
+                for (int n = 0; n < max_drain && zmq_msg_recv(&frame, sockets[i], ZMQ_DONTWAIT) >= 0; ++n) {
+                    if (first) {
+                        const auto& ctrl = constants::ctrl_topic;
+                        control = zmq_msg_size(&frame) >= ctrl.size() &&
+                                  std::memcmp(zmq_msg_data(&frame), ctrl.data(), ctrl.size()) == 0;
+                    }
+                    bytes += zmq_msg_size(&frame);
+                    first = !zmq_msg_more(&frame);
+                    if (first && !control) {
+                        ++messages;
+                    }
+                }
+                auto& c = counters_[i];
+                c.messages.fetch_add(messages, std::memory_order_relaxed);
+                c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+            }
+        }
+        zmq_msg_close(&frame);
+
+        for (auto* sub : sockets) {
+            zmq_close(sub);
+        }
+        zmq_ctx_term(ctx);
+    }
+
+private:
+    ProxyAddress base_;
+    std::vector<int> cores_;
+    bool metrics_;
+    bool count_messages_;
+
+    std::vector<std::unique_ptr<Proxy>> proxies_;
+    std::vector<Counters> counters_;
+
+    std::atomic_bool is_alive_{false};
+    std::thread metrics_thread_;
+
+    std::mutex stats_mutex_;
+    std::chrono::steady_clock::time_point last_time_;
+};
+
+} // end namespace sys
+} // end namespace xmsg
+
+#endif // XMSG_CORE_SHARDED_PROXY_H_
@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2015. Jefferson Lab, xMsg framework (JLAB). All Rights Reserved.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for educational, research, and not-for-profit purposes,
+ * without fee and without a signed licensing agreement.
+ *
+ * Contact Vardan Gyurjyan
+ * Department of Experimental Nuclear Physics, Jefferson Lab.
+ *
+ * IN NO EVENT SHALL JLAB BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL,
+ * INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, ARISING OUT OF
+ * THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF JLAB HAS BEEN ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * JLAB SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE. THE CLARA SOFTWARE AND ACCOMPANYING DOCUMENTATION, IF ANY, PROVIDED
+ * HEREUNDER IS PROVIDED "AS IS". JLAB HAS NO OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ */
+
+#ifndef XMSG_CORE_THREAD_CONNECTION_CACHE_H_
+#define XMSG_CORE_THREAD_CONNECTION_CACHE_H_
+
+#include <xmsg/connection.h>
+#include <xmsg/connection_pool.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace xmsg {
+
+/**
+ * A per-thread fast path in front of a ConnectionPool.
+ *
+ * Services publishing from many worker threads get and return a proxy
+ * connection for every message, and all of them go through the locked cache
+ * of the pool. This class keeps the most recently returned connections of
+ * each thread in thread-local storage:
+ *
+ * - \ref get_connection first looks for a connection to the address in the
+ *   calling thread's cache, without any lock, and only asks the pool on a miss;
+ * - destroying the returned ScopedConnection puts the connection back into the
+ *   cache of the destroying thread, also without any lock. Only when that
+ *   thread already keeps \c slots connections of this cache is the connection
+ *   given back to the pool;
+ * - \ref prewarm creates connections ahead of time, so the first messages of a
+ *   service do not pay for the connection setup.
+ *
+ * The pool must outlive this cache and all connections obtained from it.
+ * Connections still kept by other threads when the cache is destroyed are
+ * closed when those threads exit.
+ */
+class ThreadConnectionCache final
+{
+public:
+    static constexpr size_t default_slots = 4;
+
+    /**
+     * Creates a cache in front of the given pool.
+     *
+     * \param pool the pool used when a thread has no cached connection
+     * \param slots max number of connections each thread keeps
+     */
+    explicit ThreadConnectionCache(ConnectionPool& pool, size_t slots = default_slots)
+      : pool_{pool}
+      , state_{std::make_shared<State>(slots)}
+    { }
+
+    ThreadConnectionCache(const ThreadConnectionCache&) = delete;
+    ThreadConnectionCache& operator=(const ThreadConnectionCache&) = delete;
+
+    ~ThreadConnectionCache()
+    {
+        state_->alive.store(false, std::memory_order_release);
+        local().drop(state_.get());
+    }
+
+public:
+    /**
+     * Obtains a connection to the specified proxy, preferring one
+     * cached by the calling thread.
+     */
+    ProxyConnection get_connection(const ProxyAddress& addr)
+    {
+        auto& slots = local().slots;
+        for (auto i = slots.size(); i-- > 0; ) {
+            auto& slot = slots[i];
+            if (slot.origin->state.get() == state_.get() && slot.origin->addr == addr) {
+                auto origin = std::move(slot.origin);
+                auto con = std::move(slot.con);
+                slots[i] = std::move(slots.back());
+                slots.pop_back();
+                state_->hits.fetch_add(1, std::memory_order_relaxed);
+                return wrap(std::move(origin), std::move(con));
+            }
+        }
+
+        state_->misses.fetch_add(1, std::memory_order_relaxed);
+        auto pc = pool_.get_connection(addr);
+        auto origin = std::make_shared<Origin>(state_, addr, std::move(pc.del_));
+        return wrap(std::move(origin), pc.release());
+    }
+
+    /**
+     * Creates connections to the given proxy and returns them to the pool,
+     * so they are ready for the first messages of any thread.
+     *
+     * \param addr the proxy address
+     * \param count the number of connections to create
+     */
+    void prewarm(const ProxyAddress& addr, size_t count)
+    {
+        std::vector<ProxyConnection> cons;
+        for (size_t i = 0; i < count; ++i) {
+            cons.push_back(pool_.get_connection(addr));
+        }
+    }
+
+    /**
+     * Creates a connection to the given proxy and keeps it in the cache
+     * of the calling thread (e.g. at the start of a worker thread).
+     */
+    void prewarm_thread(const ProxyAddress& addr)
+    {
+        get_connection(addr);
+    }
+
+    /**
+     * Returns how many connections were found in the thread caches.
+     */
+    uint64_t hits() const
+    {
+        return state_->hits.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns how many connections had to be obtained from the pool.
+     */
+    uint64_t misses() const
+    {
+        return state_->misses.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns how many connections were given back to the pool
+     * because the thread cache was full.
+     */
+    uint64_t overflows() const
+    {
+        return state_->overflows.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct State
+    {
+        explicit State(size_t n) : slots{n} {}
+
+        size_t slots;
+        std::atomic_bool alive{true};
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+        std::atomic<uint64_t> overflows{0};
+    };
+
+    /// Where a driver came from, shared by all uses of the driver
+    struct Origin
+    {
+        Origin(std::shared_ptr<State> s, const ProxyAddress& a, ProxyConnection::deleter&& d)
+          : state{std::move(s)}, addr{a}, pool_del{std::move(d)}
+        { }
+
+        std::shared_ptr<State> state;
+        ProxyAddress addr;
+        ProxyConnection::deleter pool_del;
+    };
+
+    struct Slot
+    {
+        std::shared_ptr<Origin> origin;
+        detail::ProxyDriverPtr con;
+    };
+
+    struct LocalCache
+    {
+        std::vector<Slot> slots;
+
+        ~LocalCache()
+        {
+            drop(nullptr);
+        }
+
+        /// Releases the cached connections of the given cache, or all of them
+        void drop(const State* state)
+        {
+            for (auto i = slots.size(); i-- > 0; ) {
+                if (state == nullptr || slots[i].origin->state.get() == state) {
+                    release(std::move(slots[i]));
+                    slots[i] = std::move(slots.back());
+                    slots.pop_back();
+                }
+            }
+        }
+    };
+
+    static LocalCache& local()
+    {
+        static thread_local LocalCache cache;
+        return cache;
+    }
+
+    static void release(Slot&& slot)
+    {
+        if (slot.origin->state->alive.load(std::memory_order_acquire)) {
+            slot.origin->pool_del(std::move(slot.con));
+        } else {
+            slot.con.reset();
+        }
+    }
+
+    /// Lock-free return path of a connection into the destroying thread's cache
+    static void give_back(const std::shared_ptr<Origin>& origin, detail::ProxyDriverPtr&& con)
+    {
+        auto& state = *origin->state;
+        if (!state.alive.load(std::memory_order_acquire)) {
+            con.reset();
+            return;
+        }
+
+        auto& slots = local().slots;
+        size_t mine = 0;
+        for (const auto& slot : slots) {
+            if (slot.origin->state.get() == &state) {
+                ++mine;
+            }
+        }
+        if (mine < state.slots) {
+            slots.push_back(Slot{origin, std::move(con)});
+            return;
+        }
+        state.overflows.fetch_add(1, std::memory_order_relaxed);
+        origin->pool_del(std::move(con));
+    }
+
+    static ProxyConnection wrap(std::shared_ptr<Origin>&& origin, detail::ProxyDriverPtr&& con)
+    {
+        const auto& addr = origin->addr;
+        return ProxyConnection{addr, std::move(con),
+                               [origin](detail::ProxyDriverPtr&& c) {
+                                   give_back(origin, std::move(c));
+                               }};
+    }
+
+private:
+    ConnectionPool& pool_;
+    std::shared_ptr<State> state_;
+};
+
+} // end namespace xmsg
+
+#endif // XMSG_CORE_THREAD_CONNECTION_CACHE_H_
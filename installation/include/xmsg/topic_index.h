@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2015. Jefferson Lab, xMsg framework (JLAB). All Rights Reserved.
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for educational, research, and not-for-profit purposes,
+ * without fee and without a signed licensing agreement.
+ *
+ * Contact Vardan Gyurjyan
+ * Department of Experimental Nuclear Physics, Jefferson Lab.
+ *
+ * IN NO EVENT SHALL JLAB BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL,
+ * INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, ARISING OUT OF
+ * THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF JLAB HAS BEEN ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * JLAB SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE. THE CLARA SOFTWARE AND ACCOMPANYING DOCUMENTATION, IF ANY, PROVIDED
+ * HEREUNDER IS PROVIDED "AS IS". JLAB HAS NO OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ */
+
+#ifndef XMSG_CORE_TOPIC_INDEX_H_
+#define XMSG_CORE_TOPIC_INDEX_H_
+
+#include <xmsg/topic.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace xmsg {
+
+/**
+ * An index of subscriptions by topic, to find all subscriptions accepting a
+ * received message without testing each one of them.
+ *
+ * A subscription accepts exactly the topics it is a parent of (see
+ * Topic::is_parent), which is the same string prefix test the ZeroMQ socket
+ * uses to filter messages. So \c "A:B" also accepts \c "A:BC", and a
+ * \c "*" part is a plain character, not a wildcard.
+ *
+ * Subscription topics are stored in a trie, one level per topic part
+ * (domain, subject, type). Matching a message topic walks the trie once
+ * along the parts of the topic, collecting at each level the subscriptions
+ * whose last part is a prefix of the message part. The cost of a match
+ * therefore depends on the length of the topic and the number of matching
+ * subscriptions, but not on the total number of subscriptions.
+ *
+ * The index can be shared by all subscriptions of a connection. Matching only
+ * takes a shared lock, so several dispatching threads do not block each other.
+ *
+ * \tparam T the subscription data (e.g. a handler or a subscription pointer),
+ *           which must be equality comparable to be removed
+ */
+template <typename T>
+class TopicIndex final
+{
+public:
+    TopicIndex() = default;
+
+    TopicIndex(const TopicIndex&) = delete;
+    TopicIndex& operator=(const TopicIndex&) = delete;
+
+public:
+    /**
+     * Adds a subscription to the given topic.
+     *
+     * \param topic the subscription topic
+     * \param value the subscription data
+     */
+    void add(const Topic& topic, T value)
+    {
+        std::lock_guard<std::shared_timed_mutex> lock{mutex_};
+        Node* node = &root_;
+        for_each_part(topic.str(), [&node](const std::string& part) {
+            auto& child = node->children[part];
+            if (!child) {
+                child = std::make_unique<Node>();
+            }
+            node = child.get();
+            return true;
+        });
+        node->values.push_back(std::move(value));
+        ++size_;
+    }
+
+    /**
+     * Removes a subscription from the given topic.
+     *
+     * \param topic the subscription topic
+     * \param value the subscription data
+     * \return true if the subscription was found
+     */
+    bool remove(const Topic& topic, const T& value)
+    {
+        std::lock_guard<std::shared_timed_mutex> lock{mutex_};
+        std::vector<std::pair<Node*, std::string>> path;
+        Node* node = &root_;
+        for_each_part(topic.str(), [&node, &path](const std::string& part) {
+            auto it = node->children.find(part);
+            if (it == node->children.end()) {
+                node = nullptr;
+                return false;
+            }
+            path.emplace_back(node, part);
+            node = it->second.get();
+            return true;
+        });
+        if (node == nullptr) {
+            return false;
+        }
+        auto it = std::find(node->values.begin(), node->values.end(), value);
+        if (it == node->values.end()) {
+            return false;
+        }
+        node->values.erase(it);
+        --size_;
+
+        // prune the branch that is left empty
+        while (!path.empty() && node->values.empty() && node->children.empty()) {
+            Node* parent = path.back().first;
+            parent->children.erase(path.back().second);
+            path.pop_back();
+            node = parent;
+        }
+        return true;
+    }
+
+    /**
+     * Calls the given function for every subscription that accepts the topic.
+     * The function must not modify the index.
+     *
+     * \param topic the topic of a received message
+     * \param fn called with a const reference to each matching subscription
+     */
+    template <typename F>
+    void match(const Topic& topic, F&& fn) const
+    {
+        std::shared_lock<std::shared_timed_mutex> lock{mutex_};
+        std::vector<std::string> parts;
+        for_each_part(topic.str(), [&parts](const std::string& part) {
+            parts.push_back(part);
+            return true;
+        });
+        match(&root_, parts, 0, fn);
+    }
+
+    /**
+     * Returns all subscriptions that accept the topic.
+     */
+    std::vector<T> matches(const Topic& topic) const
+    {
+        std::vector<T> result;
+        match(topic, [&result](const T& value) { result.push_back(value); });
+        return result;
+    }
+
+    /**
+     * Returns the number of subscriptions in the index.
+     */
+    size_t size() const
+    {
+        std::shared_lock<std::shared_timed_mutex> lock{mutex_};
+        return size_;
+    }
+
+private:
+    struct Node
+    {
+        std::vector<T> values;
+        std::unordered_map<std::string, std::unique_ptr<Node>> children;
+    };
+
+    template <typename F>
+    static void for_each_part(const std::string& topic, F&& fn)
+    {
+        std::string part;
+        size_t start = 0;
+        while (start <= topic.size()) {
+            auto end = topic.find(':', start);
+            if (end == std::string::npos) {
+                end = topic.size();
+            }
+            part.assign(topic, start, end - start);
+            if (!fn(part)) {
+                return;
+            }
+            start = end + 1;
+        }
+    }
+
+    template <typename F>
+    static void match(const Node* node, const std::vector<std::string>& parts,
+                      size_t level, F& fn)
+    {
+        std::string prefix;
+        while (level < parts.size() && !node->children.empty()) {
+            const auto& part = parts[level];
+            // subscriptions ending with a proper prefix of this part
+            for (size_t n = 0; n < part.size(); ++n) {
+                prefix.assign(part, 0, n);
+                auto it = node->children.find(prefix);
+                if (it != node->children.end()) {
+                    for (const auto& value : it->second->values) {
+                        fn(value);
+                    }
+                }
+            }
+            auto it = node->children.find(part);
+            if (it == node->children.end()) {
+                return;
+            }
+            node = it->second.get();
+            for (const auto& value : node->values) {
+                fn(value);
+            }
+            ++level;
+        }
+    }
+
+private:
+    Node root_;
+    size_t size_ = 0;
+    mutable std::shared_timed_mutex mutex_;
+};
+
+} // end namespace xmsg
+
+#endif // XMSG_CORE_TOPIC_INDEX_H_
@@ -0,0 +1,35 @@
+#!/bin/bash
+#
+# Run one of the EJFAT bpftrace scripts against a program or a running process.
+#
+#   ejfat_trace.sh <script.bt> <program path | pid>
+#
+# USDT probes are found in the binary they are compiled into, so the script's
+# EJFAT_BIN placeholder is replaced by the program's path (for a pid, /proc/<pid>/exe).
+# Give the path of a shared library instead if the probes are compiled into it.
+# Needs root (or CAP_BPF + CAP_PERFMON) and bpftrace.
+
+if [ $# -ne 2 ]; then
+    echo "usage: $0 <script.bt> <program path | pid>"
+    exit 1
+fi
+
+script=$1
+target=$2
+pidOpt=""
+
+if [[ "$target" =~ ^[0-9]+$ ]]; then
+    pidOpt="-p $target"
+    target=$(readlink -f /proc/$target/exe)
+fi
+
+if [ ! -f "$target" ]; then
+    echo "$0: cannot find $target"
+    exit 1
+fi
+
+tmp=$(mktemp /tmp/ejfat_trace.XXXXXX.bt)
+trap 'rm -f "$tmp"' EXIT
+sed "s|EJFAT_BIN|$target|g" "$script" > "$tmp"
+
+bpftrace $pidOpt "$tmp"